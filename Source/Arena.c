@@ -0,0 +1,183 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Every allocation starts on its own cache line
+#define ARENA_ALIGNMENT ((size_t)64)
+
+// Blocks taken when an arena overflows, freed at the next reset
+typedef struct ArenaBlock {
+    struct ArenaBlock * next;
+    void              * memory;  // As returned by malloc(), data is aligned
+    uint8_t           * data;
+    size_t              size;
+    size_t              used;
+} ArenaBlock;
+
+// Bump allocator for memory that only lives until the end of a frame.
+// Allocations are never freed individually, the whole arena is reset at
+// once. When a frame needs more than the arena holds the rest is taken
+// from overflow blocks, and the next reset replaces them all with a single
+// block large enough for the most ever used, so that steady state frames
+// never allocate.
+typedef struct Arena {
+    ArenaBlock   block;       // Reused every frame
+    ArenaBlock * overflow;    // Most recent first
+    size_t       used;        // This frame, including alignment
+    size_t       high_water;  // Most used by any frame
+} Arena;
+
+static inline size_t
+ArenaAlign(
+    const size_t size)
+{
+    return SizeAdd(size, ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static inline int
+ArenaBlockAlloc(
+          ArenaBlock * const block,
+    const size_t             size)
+{
+    SDL_assert(block);
+    SDL_assert(!block->memory);
+
+    block->memory = malloc(SizeAdd(size, ARENA_ALIGNMENT - 1));
+
+    if (!block->memory)
+        return SDL_SetError("Unable to allocate arena memory");
+
+    block->data = (uint8_t *)ArenaAlign((uintptr_t)block->memory);
+    block->size = size;
+    block->used = 0;
+
+    return 0;
+}
+
+static inline void
+ArenaBlockFree(
+    ArenaBlock * const block)
+{
+    SDL_assert(block);
+
+    free(block->memory);
+    block->memory = NULL;
+    block->data   = NULL;
+    block->size   = 0;
+    block->used   = 0;
+}
+
+static inline void
+ArenaFreeOverflow(
+    Arena * const arena)
+{
+    SDL_assert(arena);
+
+    while (arena->overflow)
+    {
+        ArenaBlock * const next = arena->overflow->next;
+        ArenaBlockFree(arena->overflow);
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+}
+
+static inline void
+ArenaFree(
+    Arena * const arena)
+{
+    SDL_assert(arena);
+
+    ArenaFreeOverflow(arena);
+
+    ArenaBlockFree(&arena->block);
+    arena->used       = 0;
+    arena->high_water = 0;
+}
+
+// Frees everything allocated since the last reset. Only allocates when the
+// previous frame overflowed, in which case the arena is regrown to the high
+// water mark.
+static inline int
+ArenaReset(
+    Arena * const arena)
+{
+    SDL_assert(arena);
+
+    arena->high_water = SDL_max(arena->high_water, arena->used);
+    arena->used       = 0;
+    arena->block.used = 0;
+
+    if (!arena->overflow)
+        return 0;
+
+    ArenaFreeOverflow(arena);
+    ArenaBlockFree(&arena->block);
+
+    return ArenaBlockAlloc(&arena->block, arena->high_water);
+}
+
+// Returns uninitialized memory aligned to ARENA_ALIGNMENT, valid until the
+// next reset
+static inline void *
+ArenaAlloc(
+          Arena * const arena,
+    const size_t        size)
+{
+    SDL_assert(arena);
+
+    const size_t aligned = ArenaAlign(SDL_max(size, (size_t)1));
+
+    ArenaBlock * block = (arena->overflow) ? arena->overflow : &arena->block;
+
+    if (block->size - block->used < aligned)
+    {
+        // Double the overflow each time so that a growing frame only takes
+        // a few blocks
+        const size_t size_hint = SizeMult(SDL_max(block->size, (size_t)4096), 2);
+
+        block = calloc(1, sizeof(ArenaBlock));
+
+        if (!block)
+        {
+            SDL_SetError("Unable to allocate arena block");
+            return NULL;
+        }
+
+        if (ArenaBlockAlloc(block, SDL_max(size_hint, aligned)))
+        {
+            free(block);
+            return NULL;
+        }
+
+        block->next     = arena->overflow;
+        arena->overflow = block;
+    }
+
+    void * const result = block->data + block->used;
+
+    block->used += aligned;
+    arena->used  = SizeAdd(arena->used, aligned);
+
+    return result;
+}
+
+static inline void *
+ArenaAllocArray(
+          Arena * const arena,
+    const size_t        count,
+    const size_t        size)
+{
+    return ArenaAlloc(arena, SizeMult(count, size));
+}
@@ -0,0 +1,586 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Batch rendering of many meshes from many views, for throughput rather
+// than latency. The calling thread loads meshes one ahead of their renders,
+// which run as jobs on the scheduler. Each of its threads has its own
+// RenderContext and shares the read-only meshes.
+
+typedef struct BatchJob {
+    const char * file;  // Points into the manifest source
+    int          width;
+    int          height;
+    unsigned     modes;  // One bit per RenderMode
+    Angles     * views;
+    size_t       view_count;
+} BatchJob;
+
+typedef struct Manifest {
+    char     * source;
+    BatchJob * jobs;
+    size_t     size;
+} Manifest;
+
+static inline void
+ManifestFree(
+    Manifest * const manifest)
+{
+    SDL_assert(manifest);
+
+    for (size_t i = 0; i < manifest->size; ++i)
+        free(manifest->jobs[i].views);
+
+    free(manifest->jobs);
+    free(manifest->source);
+    memset(manifest, 0, sizeof(Manifest));
+}
+
+// Splits the next whitespace delimited token off of a line in place
+static inline char *
+NextToken(
+    char ** const cursor)
+{
+    SDL_assert(cursor && *cursor);
+
+    char * token = *cursor + strspn(*cursor, " \t\r");
+
+    if (!*token)
+        return NULL;
+
+    char * const end = token + strcspn(token, " \t\r");
+
+    *cursor = (*end) ? end + 1 : end;
+    *end = '\0';
+
+    return token;
+}
+
+static inline int
+BatchJobAddView(
+          BatchJob * const job,
+    const Angles   * const view)
+{
+    SDL_assert(job);
+    SDL_assert(view);
+
+    Angles * const views = realloc(
+        job->views, SizeMult(sizeof(Angles), SizeAdd(job->view_count, 1))
+    );
+
+    if (!views)
+        return SDL_SetError("Unable to allocate views");
+
+    job->views = views;
+    job->views[job->view_count++] = *view;
+    return 0;
+}
+
+static inline int
+ParseBatchJob(
+    char     *       line,
+    BatchJob * const job)
+{
+    SDL_assert(line);
+    SDL_assert(job);
+
+    job->file = NextToken(&line);
+
+    const char * const size  = NextToken(&line);
+          char *       modes = NextToken(&line);
+
+    if (!job->file || !size || !modes)
+        return SDL_SetError("Expected <file> <w>x<h> <modes> <views>");
+
+    if (ParseSize(size, &job->width, &job->height))
+        return -1;
+
+    for (char * mode = modes; mode; )
+    {
+        char * const next = strchr(mode, ',');
+
+        if (next)
+            *next = '\0';
+
+        RenderMode result = RENDER_WIREFRAME;
+        if (ParseRenderMode(mode, &result))
+            return -1;
+
+        job->modes |= 1u << result;
+        mode = (next) ? next + 1 : NULL;
+    }
+
+    for (char * view = NextToken(&line); view; view = NextToken(&line))
+    {
+        static const char turntable[] = "turntable:";
+
+        if (strncmp(view, turntable, sizeof(turntable) - 1))
+        {
+            Angles angles;
+            if (ParseAngles(view, &angles) || BatchJobAddView(job, &angles))
+                return -1;
+
+            continue;
+        }
+
+        // Evenly spaced yaw around the model, at an optional pitch
+        char * const pitch = strchr(view, '@');
+
+        if (pitch)
+            *pitch = '\0';
+
+        int count = 0;
+        if (ParseInt(view + sizeof(turntable) - 1, 1, 3600, &count))
+            return -1;
+
+        Angles angles = {.yaw = 0.0f};
+
+        if (pitch)
+        {
+            char * end;
+            errno = 0;
+            angles.pitch = strtof(pitch + 1, &end);
+
+            if (end == pitch + 1 || *end || errno || !isfinite(angles.pitch))
+                return SDL_SetError("Invalid turntable pitch '%s'", pitch + 1);
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            angles.yaw = 360.0f * (float)i / (float)count;
+
+            if (BatchJobAddView(job, &angles))
+                return -1;
+        }
+    }
+
+    if (!job->view_count)
+        return SDL_SetError("No views given");
+
+    return 0;
+}
+
+static inline int
+LoadManifest(
+    const char     * const filepath,
+          Manifest * const manifest)
+{
+    SDL_assert(filepath);
+    SDL_assert(manifest);
+
+    memset(manifest, 0, sizeof(Manifest));
+
+    const File source = LoadFile(filepath);
+
+    if (!source.data)
+        return -1;
+
+    manifest->source = source.data;
+
+    size_t line = 0;
+
+    char * ptr = source.data;
+    while (ptr < source.data + source.size)
+    {
+        line++;
+
+        char * const newline = memchr(ptr, '\n', (size_t)(source.data + source.size - ptr));
+
+        if (newline)
+            *newline = '\0';
+
+        char * const start = ptr + strspn(ptr, " \t\r");
+        ptr = (newline) ? newline + 1 : source.data + source.size;
+
+        // Blank lines and comments
+        if (!*start || *start == '#')
+            continue;
+
+        BatchJob * const jobs = realloc(
+            manifest->jobs,
+            SizeMult(sizeof(BatchJob), SizeAdd(manifest->size, 1))
+        );
+
+        if (!jobs)
+        {
+            SDL_SetError("Unable to allocate batch jobs");
+            goto Error;
+        }
+
+        manifest->jobs = jobs;
+
+        BatchJob * const job = &manifest->jobs[manifest->size++];
+        memset(job, 0, sizeof(BatchJob));
+
+        if (ParseBatchJob(start, job))
+        {
+            SDL_SetError("%s:%zu: %s", filepath, line, SDL_GetError());
+            goto Error;
+        }
+    }
+
+    if (!manifest->size)
+    {
+        SDL_SetError("%s: No jobs given", filepath);
+        goto Error;
+    }
+
+    return 0;
+
+Error:
+    ManifestFree(manifest);
+    return -1;
+}
+
+typedef struct Batch Batch;
+
+typedef struct BatchMesh {
+    Batch          * batch;
+    const BatchJob * job;
+    Mesh           * mesh;
+    Lights           lights;
+    char             name[256];
+    size_t           index;      // Of the job, as names may repeat
+    uint64_t         serial;     // Unique to each load, as meshes may reuse addresses
+    int              mode_count;
+    SDL_atomic_t     remaining;  // Renders left before the mesh is freed
+} BatchMesh;
+
+// Render state of each thread of the scheduler, by worker index
+typedef struct BatchWorker {
+    RenderContext   context;
+    uint64_t        serial;      // Of the mesh last rendered
+    PerfCounters    perf;
+    bool            perf_tried;  // Counters are opened by the first render
+} BatchWorker;
+
+struct Batch {
+    const Options * options;
+    const Camera  * camera;
+    const Vector  * light;
+    SDL_Surface   * texture;  // Optional
+    Trace         * trace;    // Optional
+
+    JobSystem     * jobs;     // Optional
+    BatchWorker   * workers;
+    JobCounter      pending;  // Meshes with renders still queued or running
+
+    SDL_sem       * resident;  // Meshes that may be loaded at once
+
+    SDL_atomic_t    frames;
+    SDL_atomic_t    failures;
+};
+
+static inline void
+BatchMeshRelease(
+    Batch     * const batch,
+    BatchMesh * const mesh)
+{
+    SDL_assert(batch);
+    SDL_assert(mesh);
+
+    if (!SDL_AtomicDecRef(&mesh->remaining))
+        return;
+
+    MeshFree(mesh->mesh);
+    free(mesh->mesh);
+    free(mesh->lights.data);
+    free(mesh);
+
+    SDL_SemPost(batch->resident);
+}
+
+// Renders one view and mode of a mesh, renders being numbered by view and
+// then by mode
+static inline void
+BatchRender(
+          Batch     * const batch,
+          BatchMesh * const mesh,
+    const size_t            render,
+    const size_t            index)
+{
+    SDL_assert(batch);
+    SDL_assert(mesh && mesh->mode_count > 0);
+
+    BatchWorker   * const worker  = &batch->workers[index];
+    RenderContext * const context = &worker->context;
+
+    const BatchJob * const job = mesh->job;
+
+    const size_t view = render / (size_t)mesh->mode_count;
+
+    // Lowest mode bits first
+    unsigned modes = job->modes;
+    for (size_t i = 0; i < render % (size_t)mesh->mode_count; ++i)
+        modes &= modes - 1;
+
+    int mode = 0;
+    while (!(modes & (1u << mode)))
+        mode++;
+
+    // Counters only measure the thread that opens them, and each worker
+    // index always runs on the same thread
+    if (batch->options->perf && !worker->perf_tried)
+    {
+        worker->perf_tried = true;
+
+        if (PerfOpen(&worker->perf) == 0)
+            context->perf = &worker->perf;
+        else
+        {
+            printf("%s\n", SDL_GetError());
+            SDL_ClearError();
+        }
+    }
+
+    if (!context->target
+     || context->target->w != job->width
+     || context->target->h != job->height)
+    {
+        SDL_FreeSurface(context->target);
+
+        context->target = SDL_CreateRGBSurfaceWithFormat(
+            0 /* flags */,
+            job->width, job->height,
+            32, SDL_PIXELFORMAT_RGBA32
+        );
+
+        if (!context->target)
+            goto Error;
+    }
+
+    // Caches kept between frames may belong to a freed mesh at the same
+    // address
+    if (worker->serial != mesh->serial)
+    {
+        RenderContextForgetMesh(context);
+        worker->serial = mesh->serial;
+    }
+
+    context->mesh     = mesh->mesh;
+    context->lights   = mesh->lights;
+    context->mode     = (RenderMode)mode;
+    context->rotation = AnglesToRotation(&job->views[view]);
+
+    if (Render(context) != 0)
+        goto Error;
+
+    if (batch->trace)
+        TraceFrame(batch->trace, context, (int)index + 1);
+
+    if (context->flags & RENDER_HUD)
+        DrawStats(context, context->target);
+
+    if (!batch->options->no_output)
+    {
+        char path[4096];
+        const int length = SDL_snprintf(
+            path, sizeof(path),
+            "%s/%04zu_%s_%s_%03zu.bmp",
+            batch->options->output_dir,
+            mesh->index,
+            mesh->name,
+            RenderModeName((RenderMode)mode),
+            view
+        );
+
+        if (length < 0 || (size_t)length >= sizeof(path))
+        {
+            SDL_SetError("Output path is too long");
+            goto Error;
+        }
+
+        if (SDL_SaveBMP(context->target, path) != 0)
+            goto Error;
+    }
+
+    SDL_AtomicAdd(&batch->frames, 1);
+    BatchMeshRelease(batch, mesh);
+    return;
+
+Error:
+    printf("%s: %s\n", job->file, SDL_GetError());
+    SDL_AtomicAdd(&batch->failures, 1);
+    BatchMeshRelease(batch, mesh);
+}
+
+static void
+BatchRenderJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    BatchMesh * const mesh = data;
+    SDL_assert(mesh && mesh->batch);
+
+    // The mesh may be freed by the last render
+    Batch * const batch = mesh->batch;
+
+    for (size_t i = begin; i < end; ++i)
+        BatchRender(batch, mesh, i, worker);
+}
+
+static int
+RunBatch(
+    const Options     * const options,
+          JobSystem   * const jobs,
+    const Camera      * const camera,
+    const Vector      * const light,
+          SDL_Surface * const texture,
+          Trace       * const trace)
+{
+    SDL_assert(options && options->batch);
+    SDL_assert(camera);
+    SDL_assert(light);
+
+    Manifest manifest;
+    if (LoadManifest(options->batch, &manifest))
+        return -1;
+
+    const size_t thread_count = JobThreadCount(jobs);
+
+    Batch batch = {
+        .options = options,
+        .camera  = camera,
+        .light   = light,
+        .texture = texture,
+        .trace   = trace,
+        .jobs    = jobs,
+        .workers = calloc(thread_count, sizeof(BatchWorker)),
+    };
+
+    int status = -1;
+
+    // The mesh being rendered, and the next one being loaded
+    batch.resident = SDL_CreateSemaphore(2);
+
+    if (!batch.workers || !batch.resident)
+        goto Cleanup;
+
+    // Renders don't split their own frames, as every thread already has
+    // frames of its own
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        batch.workers[i].context = (RenderContext){
+            .camera  = *camera,
+            .light   = *light,
+            .flags   = options->flags,
+            .samples = options->samples,
+
+            .texture_source = texture,
+        };
+    }
+
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t start     = SDL_GetPerformanceCounter();
+
+    uint64_t load_time = 0;
+    size_t   meshes    = 0;
+
+    for (size_t i = 0; i < manifest.size; ++i)
+    {
+        const BatchJob * const job = &manifest.jobs[i];
+
+        int mode_count = 0;
+        for (unsigned modes = job->modes; modes; modes &= modes - 1)
+            mode_count++;
+
+        const int renders = mode_count * (int)job->view_count;
+
+        SDL_SemWait(batch.resident);
+
+        const uint64_t load_start = SDL_GetPerformanceCounter();
+
+        BatchMesh * const mesh = calloc(1, sizeof(BatchMesh));
+
+        if (!mesh || !(mesh->mesh = LoadObj(job->file, jobs, true))
+         || (options->lights && LightsScatter(&mesh->lights, (size_t)options->lights, mesh->mesh)))
+        {
+            printf("%s: %s\n", job->file, SDL_GetError());
+            SDL_AtomicAdd(&batch.failures, renders);
+            SDL_SemPost(batch.resident);
+
+            if (mesh && mesh->mesh)
+            {
+                MeshFree(mesh->mesh);
+                free(mesh->mesh);
+            }
+
+            free(mesh);
+            continue;
+        }
+
+        load_time += SDL_GetPerformanceCounter() - load_start;
+        meshes++;
+
+        mesh->batch      = &batch;
+        mesh->job        = job;
+        mesh->index      = i;
+        mesh->serial     = meshes;
+        mesh->mode_count = mode_count;
+        FileStem(mesh->name, sizeof(mesh->name), job->file);
+        SDL_AtomicSet(&mesh->remaining, renders);
+
+        // Split between idle threads as they steal it, while this thread
+        // loads the next mesh
+        JobRun(jobs, BatchRenderJob, mesh, (size_t)renders, 1, &batch.pending);
+    }
+
+    JobWait(jobs, &batch.pending);
+
+    const double seconds = (double)(SDL_GetPerformanceCounter() - start)
+                         / (double)frequency;
+
+    const int frames = SDL_AtomicGet(&batch.frames);
+
+    printf(
+        "meshes: %zu\n"
+        "frames: %d (%d failed)\n"
+        "threads: %zu\n"
+        "load: %.3f s\n"
+        "total: %.3f s, %.1f fps\n",
+        meshes,
+        frames, SDL_AtomicGet(&batch.failures),
+        thread_count,
+        (double)load_time / (double)frequency,
+        seconds, (double)frames / seconds
+    );
+
+    status = SDL_AtomicGet(&batch.failures) ? -1 : 0;
+
+    if (status)
+        SDL_SetError("Some batch renders failed");
+
+Cleanup:
+    if (batch.workers)
+    {
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            RenderContext * const context = &batch.workers[i].context;
+
+            if (context->perf)
+                PerfClose(context->perf);
+
+            SDL_FreeSurface(context->target);
+            RenderContextFree(context);
+        }
+    }
+
+    free(batch.workers);
+    SDL_DestroySemaphore(batch.resident);
+    ManifestFree(&manifest);
+
+    return status;
+}
@@ -0,0 +1,966 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Reproducible end-to-end benchmark. Every mesh is rendered in every mode
+// along fixed rotation paths, and the per-stage frame times are written as
+// JSON that later runs can be compared against.
+
+// POSIX directories and syscall() for the performance counters and thread
+// pinning
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+#endif
+
+#include <SDL2/SDL.h>
+
+#include "Utils.c"
+#include "Arena.c"
+#include "PerfCounters.c"
+#include "Jobs.c"
+#include "Vector.c"
+#include "Matrix.c"
+#include "Quaternion.c"
+#include "Mesh.c"
+#include "Wavefront.c"
+#include "Lighting.c"
+#include "Shadow.c"
+#include "Texture.c"
+#include "Temporal.c"
+#include "Render.c"
+#include "Render/Wireframe.c"
+#include "Render/Flat.c"
+#include "Render/Gouraud.c"
+#include "Render/Phong.c"
+#include "Render/Toon.c"
+#include "Output.c"
+#include "Options.c"
+#include "BenchmarkUtils.c"
+
+#define MODE_COUNT (RENDER_TOON + 1)
+
+typedef struct BenchmarkPath {
+    const char * name;
+    Angles       start;
+    Angles       step;  // Per frame, in degrees
+} BenchmarkPath;
+
+static const BenchmarkPath PATHS[] = {
+    {"turntable", {.pitch = 15.0f}, {.yaw = 3.0f}},
+    {"tumble",    {.yaw = 0.0f},    {.yaw = 3.0f, .pitch = 1.7f, .roll = 0.9f}},
+};
+
+#define PATH_COUNT (sizeof(PATHS) / sizeof(PATHS[0]))
+
+typedef struct BenchmarkOptions {
+    bool         help;
+    bool         no_perf;
+    int          width;
+    int          height;
+    int          samples;
+    int          flags;
+    int          lights;
+    int          frames;
+    int          warmup;
+    int          loads;
+    int          threshold;  // Percent
+    const char * resources;
+    const char * output;
+    const char * compare;
+    const char * input;
+
+    const char * const * files;
+    size_t               file_count;
+} BenchmarkOptions;
+
+enum {
+    STAGE_FRAME,
+    STAGE_CLEAR,
+    STAGE_TRANSFORM,
+    STAGE_LIGHTING,
+    STAGE_RASTER,
+    STAGE_RESOLVE,
+    STAGE_PRESENT,
+    STAGE_COUNT,
+};
+
+static const char * const STAGE_NAMES[STAGE_COUNT] = {
+    "frame", "clear", "transform", "lighting", "raster", "resolve", "present",
+};
+
+typedef struct BenchmarkResult {
+    char        mesh[64];
+    char        mode[16];
+    char        path[16];
+    Percentiles load;
+    Percentiles stages[STAGE_COUNT];
+
+    // Mean hardware counts per load and per frame, with a bit per counter
+    // that was available
+    unsigned    counted;
+    PerfValues  load_counts;
+    PerfValues  stage_counts[STAGE_COUNT];
+} BenchmarkResult;
+
+typedef struct BenchmarkResults {
+    BenchmarkResult * data;
+    size_t            size;
+} BenchmarkResults;
+
+static void
+PrintBenchmarkUsage(void)
+{
+    printf(
+        "Usage: QuickRenderBenchmark [options] [<file>...]\n"
+        "\n"
+        "Renders each file, or every .obj in the resources directory, in\n"
+        "every mode along fixed rotation paths.\n"
+        "\n"
+        "Options:\n"
+        "  --help                    Show this message\n"
+        "  --size <w>x<h>            Frame size (default 800x600)\n"
+        "  --samples <1|2|4>         Samples per pixel\n"
+        "  --specular                Add specular highlights\n"
+        "  --shadows                 Cast shadows from the light\n"
+        "  --pcf                     Cast shadows with filtered edges\n"
+        "  --lights <n>              Add point and spot lights around each mesh\n"
+        "  --screen-order            Draw faces in screen order rather than\n"
+        "                            front to back\n"
+        "  --frames <n>              Timed frames per path (default 120)\n"
+        "  --warmup <n>              Untimed frames per path (default 10)\n"
+        "  --loads <n>               Timed loads per mesh (default 5)\n"
+        "  --resources <dir>         Meshes used when no files are given\n"
+        "                            (default Resources)\n"
+        "  --output <file>           JSON results (default benchmark.json)\n"
+        "  --compare <file>          Fail if frame times regressed against\n"
+        "                            the results in file\n"
+        "  --threshold <percent>     Allowed p50 and p95 regression\n"
+        "                            (default 10)\n"
+        "  --input <file>            Compare existing results instead of\n"
+        "                            running the benchmark\n"
+        "  --no-perf                 Don't read hardware performance counters\n"
+    );
+}
+
+static inline int
+ParseBenchmarkOptions(
+    const int                argc,
+    const char * const *     argv,
+          BenchmarkOptions * options)
+{
+    SDL_assert(argv);
+    SDL_assert(options);
+
+    *options = (BenchmarkOptions){
+        .width     = 800,
+        .height    = 600,
+        .samples   = 1,
+        .frames    = 120,
+        .warmup    = 10,
+        .loads     = 5,
+        .threshold = 10,
+        .resources = "Resources",
+        .output    = "benchmark.json",
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char * const arg   = argv[i];
+        const char * const value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        // Files are the trailing arguments
+        if (strncmp(arg, "--", 2))
+        {
+            options->files      = &argv[i];
+            options->file_count = (size_t)(argc - i);
+            break;
+        }
+
+        if (!strcmp(arg, "--help"))
+        {
+            options->help = true;
+            return 0;
+        }
+        else if (!strcmp(arg, "--specular"))
+        {
+            options->flags |= RENDER_SPECULAR;
+            continue;
+        }
+        else if (!strcmp(arg, "--shadows"))
+        {
+            options->flags |= RENDER_SHADOWS;
+            continue;
+        }
+        else if (!strcmp(arg, "--pcf"))
+        {
+            options->flags |= RENDER_SHADOWS | RENDER_SHADOW_PCF;
+            continue;
+        }
+        else if (!strcmp(arg, "--screen-order"))
+        {
+            options->flags |= RENDER_SCREEN_ORDER;
+            continue;
+        }
+        else if (!strcmp(arg, "--no-perf"))
+        {
+            options->no_perf = true;
+            continue;
+        }
+
+        if (!value)
+            return SDL_SetError("Missing value for %s", arg);
+
+        i++;
+
+        if (!strcmp(arg, "--size"))
+        {
+            if (ParseSize(value, &options->width, &options->height))
+                return -1;
+        }
+        else if (!strcmp(arg, "--samples"))
+        {
+            if (ParseInt(value, 1, 4, &options->samples))
+                return -1;
+
+            if (options->samples == 3)
+                return SDL_SetError("Samples must be 1, 2 or 4");
+        }
+        else if (!strcmp(arg, "--lights"))
+        {
+            if (ParseInt(value, 0, LIGHTS_MAX, &options->lights))
+                return -1;
+        }
+        else if (!strcmp(arg, "--frames"))
+        {
+            if (ParseInt(value, 1, 1000000, &options->frames))
+                return -1;
+        }
+        else if (!strcmp(arg, "--warmup"))
+        {
+            if (ParseInt(value, 0, 1000000, &options->warmup))
+                return -1;
+        }
+        else if (!strcmp(arg, "--loads"))
+        {
+            if (ParseInt(value, 1, 1000, &options->loads))
+                return -1;
+        }
+        else if (!strcmp(arg, "--threshold"))
+        {
+            if (ParseInt(value, 0, 1000, &options->threshold))
+                return -1;
+        }
+        else if (!strcmp(arg, "--resources"))
+        {
+            options->resources = value;
+        }
+        else if (!strcmp(arg, "--output"))
+        {
+            options->output = value;
+        }
+        else if (!strcmp(arg, "--compare"))
+        {
+            options->compare = value;
+        }
+        else if (!strcmp(arg, "--input"))
+        {
+            options->input = value;
+        }
+        else
+        {
+            return SDL_SetError("Unknown option %s", arg);
+        }
+    }
+
+    if (options->input && !options->compare)
+        return SDL_SetError("--input needs --compare");
+
+    return 0;
+}
+
+static inline int
+BenchmarkMesh(
+    const BenchmarkOptions * const options,
+    const char             * const file,
+          RenderContext    * const context,
+          SDL_Surface      * const display,
+          uint64_t         * const samples,  // frames * STAGE_COUNT
+          BenchmarkResults * const results)
+{
+    SDL_assert(options);
+    SDL_assert(file);
+    SDL_assert(context);
+    SDL_assert(display);
+    SDL_assert(samples);
+    SDL_assert(results);
+
+    Mesh * mesh = NULL;
+
+    uint64_t loads[1000];
+    SDL_assert((size_t)options->loads <= sizeof(loads) / sizeof(loads[0]));
+
+    PerfValues load_counts = {{0}};
+
+    for (int i = 0; i < options->loads; ++i)
+    {
+        if (mesh)
+        {
+            MeshFree(mesh);
+            free(mesh);
+        }
+
+        PerfValues counts[2] = {{{0}}};
+
+        if (context->perf)
+            PerfRead(context->perf, &counts[0]);
+
+        const uint64_t start = GetTimeNs();
+
+        mesh = LoadObj(file, NULL, true);
+
+        if (!mesh)
+            return SDL_SetError("%s: %s", file, SDL_GetError());
+
+        loads[i] = GetTimeNs() - start;
+
+        if (context->perf)
+            PerfRead(context->perf, &counts[1]);
+
+        PerfAccumulate(&load_counts, &counts[0], &counts[1]);
+    }
+
+    const Percentiles load = GetPercentiles(loads, (size_t)options->loads);
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i)
+        load_counts.counts[i] /= (uint64_t)options->loads;
+
+    BenchmarkResult * const resized = realloc(
+        results->data,
+        SizeMult(sizeof(BenchmarkResult), SizeAdd(results->size, MODE_COUNT * PATH_COUNT))
+    );
+
+    if (!resized)
+    {
+        MeshFree(mesh);
+        free(mesh);
+        return SDL_SetError("Unable to allocate results");
+    }
+
+    results->data = resized;
+
+    context->mesh   = mesh;
+    context->lights = (Lights){.data = NULL};
+
+    if (options->lights && LightsScatter(&context->lights, (size_t)options->lights, mesh))
+        goto Error;
+
+    const size_t frames = (size_t)options->frames;
+
+    for (int mode = 0; mode < MODE_COUNT; ++mode)
+    {
+        for (size_t path = 0; path < PATH_COUNT; ++path)
+        {
+            context->mode = (RenderMode)mode;
+
+            PerfValues stage_counts[STAGE_COUNT];
+            memset(stage_counts, 0, sizeof(stage_counts));
+
+            for (int frame = -options->warmup; frame < options->frames; ++frame)
+            {
+                // Warmup frames replay the start of the path
+                const float t = (float)SDL_max(frame, 0);
+
+                const Angles angles = {
+                    .yaw   = PATHS[path].start.yaw   + PATHS[path].step.yaw   * t,
+                    .pitch = PATHS[path].start.pitch + PATHS[path].step.pitch * t,
+                    .roll  = PATHS[path].start.roll  + PATHS[path].step.roll  * t,
+                };
+
+                context->rotation = AnglesToRotation(&angles);
+
+                const uint64_t start = GetTimeNs();
+
+                if (Render(context) != 0)
+                    goto Error;
+
+                PerfValues present_counts[2] = {{{0}}};
+
+                if (context->perf)
+                    PerfRead(context->perf, &present_counts[0]);
+
+                const uint64_t present = GetTimeNs();
+
+                // Convert into the typical window format, as when presenting
+                if (SDL_BlitSurface(context->target, NULL, display, NULL) != 0)
+                    goto Error;
+
+                const uint64_t end = GetTimeNs();
+
+                if (context->perf)
+                    PerfRead(context->perf, &present_counts[1]);
+
+                if (frame < 0)
+                    continue;
+
+                if (context->perf)
+                {
+                    const PerfValues zero = {{0}};
+
+                    // In the same order as the stages
+                    const PerfValues * const counts[] = {
+                        &context->counters.clear,
+                        &context->counters.transform,
+                        &context->counters.lighting,
+                        &context->counters.raster,
+                        &context->counters.resolve,
+                    };
+
+                    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+                    {
+                        PerfAccumulate(&stage_counts[STAGE_CLEAR + i], &zero, counts[i]);
+                        PerfAccumulate(&stage_counts[STAGE_FRAME],     &zero, counts[i]);
+                    }
+
+                    PerfAccumulate(&stage_counts[STAGE_PRESENT], &present_counts[0], &present_counts[1]);
+                    PerfAccumulate(&stage_counts[STAGE_FRAME],   &present_counts[0], &present_counts[1]);
+                }
+
+                const size_t f = (size_t)frame;
+
+                samples[STAGE_FRAME     * frames + f] = end - start;
+                samples[STAGE_CLEAR     * frames + f] = context->timings.clear;
+                samples[STAGE_TRANSFORM * frames + f] = context->timings.transform;
+                samples[STAGE_LIGHTING  * frames + f] = context->timings.lighting;
+                samples[STAGE_RASTER    * frames + f] = context->timings.raster;
+                samples[STAGE_RESOLVE   * frames + f] = context->timings.resolve;
+                samples[STAGE_PRESENT   * frames + f] = end - present;
+            }
+
+            BenchmarkResult * const result = &results->data[results->size++];
+
+            *result = (BenchmarkResult){
+                .load        = load,
+                .counted     = 0,
+                .load_counts = load_counts,
+            };
+
+            for (size_t i = 0; i < PERF_COUNTERS; ++i)
+                if (PerfAvailable(context->perf, (PerfCounter)i))
+                    result->counted |= 1u << i;
+
+            for (size_t stage = 0; stage < STAGE_COUNT; ++stage)
+                for (size_t i = 0; i < PERF_COUNTERS; ++i)
+                    result->stage_counts[stage].counts[i] = stage_counts[stage].counts[i] / frames;
+
+            FileStem(result->mesh, sizeof(result->mesh), file);
+            SDL_snprintf(result->mode, sizeof(result->mode), "%s", RenderModeName((RenderMode)mode));
+            SDL_snprintf(result->path, sizeof(result->path), "%s", PATHS[path].name);
+
+            for (size_t stage = 0; stage < STAGE_COUNT; ++stage)
+                result->stages[stage] = GetPercentiles(&samples[stage * frames], frames);
+
+            printf(
+                "%-12s %-10s %-10s p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms",
+                result->mesh, result->mode, result->path,
+                (double)result->stages[STAGE_FRAME].p50 / 1e6,
+                (double)result->stages[STAGE_FRAME].p95 / 1e6,
+                (double)result->stages[STAGE_FRAME].p99 / 1e6
+            );
+
+            if ((result->counted & (1u << PERF_CYCLES)) && (result->counted & (1u << PERF_INSTRUCTIONS)))
+            {
+                const uint64_t * const raster = result->stage_counts[STAGE_RASTER].counts;
+
+                printf(
+                    "  raster ipc %.2f",
+                    (double)raster[PERF_INSTRUCTIONS] / (double)SDL_max(raster[PERF_CYCLES], 1)
+                );
+            }
+
+            printf("\n");
+        }
+    }
+
+    context->mesh = NULL;
+    MeshFree(mesh);
+    free(mesh);
+    free(context->lights.data);
+    context->lights = (Lights){.data = NULL};
+    return 0;
+
+Error:
+    context->mesh = NULL;
+    MeshFree(mesh);
+    free(mesh);
+    free(context->lights.data);
+    context->lights = (Lights){.data = NULL};
+    return -1;
+}
+
+static inline int
+RunBenchmark(
+    const BenchmarkOptions * const options,
+          BenchmarkResults * const results)
+{
+    SDL_assert(options);
+    SDL_assert(results);
+
+    char   ** found       = NULL;
+    size_t    found_count = 0;
+
+    const char * const * files      = options->files;
+    size_t               file_count = options->file_count;
+
+    if (!file_count)
+    {
+        if (FindMeshes(options->resources, &found, &found_count))
+            return -1;
+
+        files      = (const char * const *)found;
+        file_count = found_count;
+    }
+
+    // Same camera and light as the viewer
+    RenderContext context = {
+        .samples = options->samples,
+        .flags   = options->flags,
+        .camera  = {
+            .pos   = (Vector){.z = 300.0f},
+            .focus = (Vector){.x =   -2.0f, .y = -4.0f},
+            .up    = (Vector){.y =   1.0f},
+            .right = (Vector){.x =   1.0f},
+        },
+        .light = VectorNormalize(&(Vector){.x = 4.0f, .y = 4.0f, .z = 3.0f}),
+    };
+
+    int status = -1;
+
+    PerfCounters perf;
+
+    if (!options->no_perf)
+    {
+        if (PerfOpen(&perf) == 0)
+            context.perf = &perf;
+        else
+        {
+            printf("%s\n", SDL_GetError());
+            SDL_ClearError();
+        }
+    }
+
+    uint64_t * const samples = malloc(
+        SizeMult(sizeof(uint64_t), SizeMult((size_t)options->frames, STAGE_COUNT))
+    );
+
+    SDL_Surface * display = NULL;
+
+    if (!samples)
+    {
+        SDL_SetError("Unable to allocate samples");
+        goto Cleanup;
+    }
+
+    context.target = SDL_CreateRGBSurfaceWithFormat(
+        0 /* flags */,
+        options->width, options->height,
+        32, SDL_PIXELFORMAT_RGBA32
+    );
+
+    display = SDL_CreateRGBSurfaceWithFormat(
+        0 /* flags */,
+        options->width, options->height,
+        32, SDL_PIXELFORMAT_ARGB8888
+    );
+
+    if (!context.target || !display)
+        goto Cleanup;
+
+    for (size_t i = 0; i < file_count; ++i)
+        if (BenchmarkMesh(options, files[i], &context, display, samples, results))
+            goto Cleanup;
+
+    status = 0;
+
+Cleanup:
+    if (context.perf)
+        PerfClose(context.perf);
+
+    SDL_FreeSurface(display);
+    SDL_FreeSurface(context.target);
+    context.target = NULL;
+    RenderContextFree(&context);
+    free(samples);
+    FreeFileList(found, found_count);
+
+    return status;
+}
+
+static inline int
+WriteResults(
+    const BenchmarkOptions * const options,
+    const BenchmarkResults * const results)
+{
+    SDL_assert(options);
+    SDL_assert(results);
+
+    FILE * const file = fopen(options->output, "w");
+
+    if (!file)
+        return SDL_SetError("Unable to open %s: %s", options->output, strerror(errno));
+
+    // One result per line, which is what ReadResults expects
+    fprintf(
+        file,
+        "{\n"
+        "  \"width\": %d,\n"
+        "  \"height\": %d,\n"
+        "  \"samples\": %d,\n"
+        "  \"frames\": %d,\n"
+        "  \"units\": \"ns\",\n"
+        "  \"results\": [\n",
+        options->width, options->height, options->samples, options->frames
+    );
+
+    for (size_t i = 0; i < results->size; ++i)
+    {
+        const BenchmarkResult * const result = &results->data[i];
+
+        fprintf(
+            file,
+            "    {\"mesh\": \"%s\", \"mode\": \"%s\", \"path\": \"%s\", "
+            "\"load\": {\"p50\": %llu, \"p95\": %llu, \"p99\": %llu}",
+            result->mesh, result->mode, result->path,
+            (unsigned long long)result->load.p50,
+            (unsigned long long)result->load.p95,
+            (unsigned long long)result->load.p99
+        );
+
+        for (size_t stage = 0; stage < STAGE_COUNT; ++stage)
+            fprintf(
+                file,
+                ", \"%s\": {\"p50\": %llu, \"p95\": %llu, \"p99\": %llu}",
+                STAGE_NAMES[stage],
+                (unsigned long long)result->stages[stage].p50,
+                (unsigned long long)result->stages[stage].p95,
+                (unsigned long long)result->stages[stage].p99
+            );
+
+        // Means per load and per frame, after the percentiles so that those
+        // are found first when reading the line back
+        if (result->counted)
+        {
+            fprintf(file, ", \"counters\": {");
+
+            for (size_t stage = 0; stage <= STAGE_COUNT; ++stage)
+            {
+                const PerfValues * const counts = (stage == STAGE_COUNT)
+                    ? &result->load_counts
+                    : &result->stage_counts[stage];
+
+                fprintf(
+                    file,
+                    "%s\"%s\": {",
+                    (stage) ? ", " : "",
+                    (stage == STAGE_COUNT) ? "load" : STAGE_NAMES[stage]
+                );
+
+                for (size_t i = 0; i < PERF_COUNTERS; ++i)
+                {
+                    fprintf(file, "%s\"%s\": ", (i) ? ", " : "", PERF_COUNTER_NAMES[i]);
+
+                    if (result->counted & (1u << i))
+                        fprintf(file, "%llu", (unsigned long long)counts->counts[i]);
+                    else
+                        fprintf(file, "null");
+                }
+
+                fprintf(file, "}");
+            }
+
+            fprintf(file, "}");
+        }
+
+        fprintf(file, "}%s\n", (i + 1 < results->size) ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    if (fclose(file) != 0)
+        return SDL_SetError("Unable to write %s", options->output);
+
+    return 0;
+}
+
+static inline bool
+JsonString(
+    const char   * const line,
+    const char   * const key,
+          char   * const value,
+    const size_t         size)
+{
+    const char * ptr = strstr(line, key);
+
+    if (!ptr || !(ptr = strchr(ptr + strlen(key), '"')))
+        return false;
+
+    const char * const end = strchr(++ptr, '"');
+
+    if (!end)
+        return false;
+
+    SDL_snprintf(value, size, "%.*s", (int)SDL_min((size_t)(end - ptr), size - 1), ptr);
+    return true;
+}
+
+static inline bool
+JsonPercentiles(
+    const char        * const line,
+    const char        * const key,
+          Percentiles * const value)
+{
+    const char * object = strstr(line, key);
+
+    if (!object || !(object = strchr(object, '{')))
+        return false;
+
+    uint64_t * const fields[3] = {&value->p50, &value->p95, &value->p99};
+    const char * const names[3] = {"\"p50\":", "\"p95\":", "\"p99\":"};
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const char * const field = strstr(object, names[i]);
+
+        if (!field)
+            return false;
+
+        *fields[i] = strtoull(field + strlen(names[i]), NULL, 10);
+    }
+
+    return true;
+}
+
+// Reads results written by WriteResults, not arbitrary JSON
+static inline int
+ReadResults(
+    const char             * const filepath,
+          BenchmarkResults * const results)
+{
+    SDL_assert(filepath);
+    SDL_assert(results);
+
+    const File source = LoadFile(filepath);
+
+    if (!source.data)
+        return SDL_SetError("Unable to read %s", filepath);
+
+    char * ptr = source.data;
+    while (ptr < source.data + source.size)
+    {
+        char * const newline = memchr(ptr, '\n', (size_t)(source.data + source.size - ptr));
+
+        if (newline)
+            *newline = '\0';
+
+        const char * const line = ptr;
+        ptr = (newline) ? newline + 1 : source.data + source.size;
+
+        if (!strstr(line, "\"mesh\""))
+            continue;
+
+        BenchmarkResult result = {.load = {0}};
+
+        bool valid = JsonString(line, "\"mesh\":", result.mesh, sizeof(result.mesh))
+                  && JsonString(line, "\"mode\":", result.mode, sizeof(result.mode))
+                  && JsonString(line, "\"path\":", result.path, sizeof(result.path))
+                  && JsonPercentiles(line, "\"load\":", &result.load);
+
+        for (size_t stage = 0; valid && stage < STAGE_COUNT; ++stage)
+        {
+            char key[32];
+            SDL_snprintf(key, sizeof(key), "\"%s\":", STAGE_NAMES[stage]);
+            valid = JsonPercentiles(line, key, &result.stages[stage]);
+        }
+
+        if (!valid)
+        {
+            free(source.data);
+            return SDL_SetError("%s: Malformed result", filepath);
+        }
+
+        BenchmarkResult * const resized = realloc(
+            results->data,
+            SizeMult(sizeof(BenchmarkResult), SizeAdd(results->size, 1))
+        );
+
+        if (!resized)
+        {
+            free(source.data);
+            return SDL_SetError("Unable to allocate results");
+        }
+
+        results->data = resized;
+        results->data[results->size++] = result;
+    }
+
+    free(source.data);
+    return 0;
+}
+
+static inline double
+PercentChange(
+    const uint64_t baseline,
+    const uint64_t current)
+{
+    if (!baseline)
+        return 0.0;
+
+    return ((double)current - (double)baseline) * 100.0 / (double)baseline;
+}
+
+// Returns the number of results whose p50 or p95 frame time regressed by
+// more than the threshold
+static inline size_t
+CompareResults(
+    const BenchmarkOptions * const options,
+    const BenchmarkResults * const baseline,
+    const BenchmarkResults * const current)
+{
+    SDL_assert(options);
+    SDL_assert(baseline);
+    SDL_assert(current);
+
+    size_t regressions = 0;
+
+    for (size_t i = 0; i < current->size; ++i)
+    {
+        const BenchmarkResult * const result = &current->data[i];
+        const BenchmarkResult *       base   = NULL;
+
+        for (size_t j = 0; j < baseline->size && !base; ++j)
+            if (!strcmp(baseline->data[j].mesh, result->mesh)
+             && !strcmp(baseline->data[j].mode, result->mode)
+             && !strcmp(baseline->data[j].path, result->path))
+                base = &baseline->data[j];
+
+        if (!base)
+        {
+            printf("%-12s %-10s %-10s not in baseline\n", result->mesh, result->mode, result->path);
+            continue;
+        }
+
+        const double p50 = PercentChange(
+            base->stages[STAGE_FRAME].p50, result->stages[STAGE_FRAME].p50
+        );
+
+        const double p95 = PercentChange(
+            base->stages[STAGE_FRAME].p95, result->stages[STAGE_FRAME].p95
+        );
+
+        const bool regressed = p50 > options->threshold || p95 > options->threshold;
+
+        if (regressed)
+            regressions++;
+
+        printf(
+            "%-12s %-10s %-10s p50 %+7.1f%%  p95 %+7.1f%%%s\n",
+            result->mesh, result->mode, result->path,
+            p50, p95,
+            (regressed) ? "  REGRESSION" : ""
+        );
+    }
+
+    return regressions;
+}
+
+int
+main(
+    int    argc,
+    char * argv[])
+{
+    BenchmarkOptions options;
+    if (ParseBenchmarkOptions(argc, (const char * const *)argv, &options))
+    {
+        printf("%s\n\n", SDL_GetError());
+        PrintBenchmarkUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (options.help)
+    {
+        PrintBenchmarkUsage();
+        return EXIT_SUCCESS;
+    }
+
+    BenchmarkResults current  = {0};
+    BenchmarkResults baseline = {0};
+
+    int status = EXIT_FAILURE;
+
+    if (options.input)
+    {
+        if (ReadResults(options.input, &current))
+            goto Error;
+    }
+    else
+    {
+        if (RunBenchmark(&options, &current))
+            goto Error;
+
+        if (WriteResults(&options, &current))
+            goto Error;
+
+        printf("results: %s\n", options.output);
+    }
+
+    if (options.compare)
+    {
+        if (ReadResults(options.compare, &baseline))
+            goto Error;
+
+        const size_t regressions = CompareResults(&options, &baseline, &current);
+
+        if (regressions)
+        {
+            SDL_SetError(
+                "%zu results regressed by more than %d%%",
+                regressions, options.threshold
+            );
+
+            goto Error;
+        }
+    }
+
+    status = EXIT_SUCCESS;
+
+Error:
+    if (status != EXIT_SUCCESS)
+        puts(SDL_GetError());
+
+    free(baseline.data);
+    free(current.data);
+
+    return status;
+}
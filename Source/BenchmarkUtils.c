@@ -0,0 +1,140 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Shared by the benchmark executables, which include <dirent.h>
+
+typedef struct Percentiles {
+    uint64_t p50;
+    uint64_t p95;
+    uint64_t p99;
+} Percentiles;
+
+static int
+CompareU64(
+    const void * const a,
+    const void * const b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+CompareStrings(
+    const void * const a,
+    const void * const b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Nearest rank percentiles, sorts the samples in place
+static inline Percentiles
+GetPercentiles(
+          uint64_t * const samples,
+    const size_t           count)
+{
+    SDL_assert(samples);
+    SDL_assert(count > 0);
+
+    qsort(samples, count, sizeof(uint64_t), CompareU64);
+
+    const size_t ranks[3] = {
+        (count * 50 + 99) / 100,
+        (count * 95 + 99) / 100,
+        (count * 99 + 99) / 100,
+    };
+
+    return (Percentiles){
+        .p50 = samples[SDL_max(ranks[0], 1) - 1],
+        .p95 = samples[SDL_max(ranks[1], 1) - 1],
+        .p99 = samples[SDL_max(ranks[2], 1) - 1],
+    };
+}
+
+static inline void
+FreeFileList(
+    char   ** const files,
+    const size_t    count)
+{
+    if (!files)
+        return;
+
+    for (size_t i = 0; i < count; ++i)
+        free(files[i]);
+
+    free(files);
+}
+
+// Every .obj in a directory, sorted so that runs are comparable
+static inline int
+FindMeshes(
+    const char   *  const directory,
+          char   *** const files,
+          size_t *  const count)
+{
+    SDL_assert(directory);
+    SDL_assert(files);
+    SDL_assert(count);
+
+    *files = NULL;
+    *count = 0;
+
+    DIR * const dir = opendir(directory);
+
+    if (!dir)
+        return SDL_SetError("Unable to open %s: %s", directory, strerror(errno));
+
+    for (const struct dirent * entry; (entry = readdir(dir)); )
+    {
+        const size_t length = strlen(entry->d_name);
+
+        if (length < 5 || strcmp(entry->d_name + length - 4, ".obj"))
+            continue;
+
+        const size_t path_size = strlen(directory) + length + 2;
+
+        char ** const resized = realloc(
+            *files, SizeMult(sizeof(char *), SizeAdd(*count, 1))
+        );
+
+        char * const path = malloc(path_size);
+
+        if (!resized || !path)
+        {
+            free(path);
+
+            if (resized)
+                *files = resized;
+
+            closedir(dir);
+            FreeFileList(*files, *count);
+            return SDL_SetError("Unable to allocate file list");
+        }
+
+        SDL_snprintf(path, path_size, "%s/%s", directory, entry->d_name);
+
+        *files = resized;
+        (*files)[(*count)++] = path;
+    }
+
+    closedir(dir);
+
+    if (!*count)
+        return SDL_SetError("No meshes found in %s", directory);
+
+    qsort(*files, *count, sizeof(char *), CompareStrings);
+    return 0;
+}
@@ -0,0 +1,198 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Renders frames into offscreen buffers without initializing SDL video, and
+// as fast as the renderer allows. Frames are written on a thread of their
+// own, while the next ones render.
+static int
+RunHeadless(
+    const Options     * const options,
+          JobSystem   * const jobs,
+    const Mesh        * const mesh,
+    const Camera      * const camera,
+    const Vector      * const light,
+    const Lights      * const lights,
+          SDL_Surface * const texture,
+          Trace       * const trace)
+{
+    SDL_assert(options);
+    SDL_assert(mesh);
+    SDL_assert(camera);
+    SDL_assert(light);
+    SDL_assert(lights);
+
+    RenderContext context = {
+        .jobs    = jobs,
+        .mesh    = mesh,
+        .camera  = *camera,
+        .light   = *light,
+        .mode    = options->mode,
+        .flags   = options->flags,
+        .samples = options->samples,
+        .lights  = *lights,
+
+        .texture_source = texture,
+    };
+
+    context.target = SDL_CreateRGBSurfaceWithFormat(
+        0 /* flags */,
+        options->width, options->height,
+        32, SDL_PIXELFORMAT_RGBA32
+    );
+
+    if (!context.target)
+        return -1;
+
+    OutputSink sink = {.thread = NULL};
+
+    if (!options->no_output)
+    {
+        const int status = OutputSinkOpen(
+            &sink,
+            options->output_format, options->output,
+            options->width, options->height,
+            options->fps, options->output_drop
+        );
+
+        if (status)
+        {
+            SDL_FreeSurface(context.target);
+            return -1;
+        }
+    }
+
+    PerfCounters perf;
+    PerfValues   perf_total = {{0}};
+
+    if (options->perf)
+    {
+        if (PerfOpen(&perf) == 0)
+            context.perf = &perf;
+        else
+        {
+            printf("%s\n", SDL_GetError());
+            SDL_ClearError();
+        }
+    }
+
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+
+    uint64_t render_time = 0;
+    uint64_t output_time = 0;
+
+    int frame = 0;
+    for (; frame < options->frames; ++frame)
+    {
+        const Angles angles = {
+            .yaw   = options->rotation.yaw   + options->step.yaw   * (float)frame,
+            .pitch = options->rotation.pitch + options->step.pitch * (float)frame,
+            .roll  = options->rotation.roll  + options->step.roll  * (float)frame,
+        };
+
+        context.rotation = AnglesToRotation(&angles);
+
+        const uint64_t render_start = SDL_GetPerformanceCounter();
+
+        if (Render(&context) != 0)
+            goto Error;
+
+        const uint64_t render_end = SDL_GetPerformanceCounter();
+        render_time += render_end - render_start;
+
+        if (context.perf)
+        {
+            const PerfValues zero        = {{0}};
+            const PerfValues frame_total = RenderCountersTotal(&context.counters);
+
+            PerfAccumulate(&perf_total, &zero, &frame_total);
+        }
+
+        if (trace)
+            TraceFrame(trace, &context, 1);
+
+        if (options->flags & RENDER_HUD)
+            DrawStats(&context, context.target);
+
+        if (options->no_output)
+            continue;
+
+        if (OutputSinkPush(&sink, context.target, frame) != 0)
+            goto Error;
+
+        output_time += SDL_GetPerformanceCounter() - render_end;
+    }
+
+    // Counted as the output of the last frame
+    if (!options->no_output)
+    {
+        const uint64_t close_start = SDL_GetPerformanceCounter();
+
+        if (OutputSinkClose(&sink) != 0)
+            goto Error;
+
+        output_time += SDL_GetPerformanceCounter() - close_start;
+    }
+
+    printf(
+        "frames: %d\n"
+        "render: %.3f ms/frame, %.1f fps\n"
+        "output: %.3f ms/frame\n",
+        frame,
+        (double)render_time * 1000.0 / (double)frequency / (double)frame,
+        (double)frame * (double)frequency / (double)SDL_max(render_time, 1),
+        (double)output_time * 1000.0 / (double)frequency / (double)frame
+    );
+
+    if (!options->no_output)
+        OutputSinkReport(&sink);
+
+    if (context.perf)
+    {
+        printf("counters per frame:\n");
+
+        for (size_t i = 0; i < PERF_COUNTERS; ++i)
+            if (PerfAvailable(context.perf, (PerfCounter)i))
+                printf(
+                    "  %s: %llu\n",
+                    PERF_COUNTER_NAMES[i],
+                    (unsigned long long)(perf_total.counts[i] / (uint64_t)frame)
+                );
+
+        PerfClose(context.perf);
+    }
+
+    OutputSinkFree(&sink);
+    SDL_FreeSurface(context.target);
+    RenderContextFree(&context);
+    return 0;
+
+Error:
+    if (context.perf)
+        PerfClose(context.perf);
+
+    // Keeps the error that stopped rendering over any from the writer
+    if (sink.thread)
+    {
+        char error[256];
+        SDL_snprintf(error, sizeof(error), "%s", SDL_GetError());
+        OutputSinkClose(&sink);
+        SDL_SetError("%s", error);
+    }
+
+    OutputSinkFree(&sink);
+    SDL_FreeSurface(context.target);
+    RenderContextFree(&context);
+    return -1;
+}
@@ -0,0 +1,200 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Pipeline statistics drawn over a finished frame, using a tiny built-in
+// font so that no font library is needed
+
+#define HUD_SCALE 2
+
+// 3x5 glyphs for ' ' through 'Z', one bit per pixel from the top left
+static const uint16_t HUD_FONT['Z' - ' ' + 1] = {
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x52a5, 0x0000, 0x0000,  //  !"#$%&'
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x01c0, 0x0002, 0x12a4,  // ()*+,-./
+    0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249,  // 01234567
+    0x7bef, 0x7bcf, 0x0410, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,  // 89:;<=>?
+    0x0000, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b,  // @ABCDEFG
+    0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a,  // HIJKLMNO
+    0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd,  // PQRSTUVW
+    0x5aad, 0x5a92, 0x72a7,  // XYZ
+};
+
+static inline void
+DrawText(
+          SDL_Surface * const surface,
+          int                 x,
+    const int                 y,
+    const uint32_t            color,
+    const char        *       text)
+{
+    SDL_assert(surface);
+    SDL_assert(text);
+
+    for (; *text; ++text, x += 4 * HUD_SCALE)
+    {
+        int c = *text;
+
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+
+        if (c < ' ' || c > 'Z')
+            continue;
+
+        const unsigned glyph = HUD_FONT[c - ' '];
+
+        for (int row = 0; row < 5; ++row)
+        {
+            for (int col = 0; col < 3; ++col)
+            {
+                if (!(glyph & (1u << (14 - (row * 3 + col)))))
+                    continue;
+
+                SDL_FillRect(
+                    surface,
+                    &(SDL_Rect){
+                        x + col * HUD_SCALE,
+                        y + row * HUD_SCALE,
+                        HUD_SCALE,
+                        HUD_SCALE,
+                    },
+                    color
+                );
+            }
+        }
+    }
+}
+
+static void
+DrawStats(
+    const RenderContext * const context,
+          SDL_Surface   * const surface)
+{
+    SDL_assert(context);
+    SDL_assert(surface);
+
+    const RenderTimings * const timings = &context->timings;
+
+    char lines[10][64];
+    size_t count = 0;
+
+#if RENDER_STATS
+    const RenderStats * const stats = &context->stats;
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "faces %zu  culled %zu  clipped %zu",
+        stats->faces, stats->culled, stats->clipped
+    );
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "tested %zu  passed %zu",
+        stats->tested, stats->passed
+    );
+
+    if (context->flags & RENDER_TEMPORAL)
+    {
+        SDL_snprintf(
+            lines[count++], sizeof(lines[0]),
+            "reused %zu",
+            stats->reused
+        );
+    }
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "written %zu  overdraw %.2fx",
+        stats->written,
+        (stats->covered) ? (double)stats->written / (double)stats->covered : 0.0
+    );
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "arena %zu  peak %zu kib",
+        stats->arena / 1024, stats->arena_peak / 1024
+    );
+
+    if (context->lights.size)
+    {
+        SDL_snprintf(
+            lines[count++], sizeof(lines[0]),
+            "lights %zu/%zu  evals %zu",
+            stats->lights, context->lights.size, stats->light_evals
+        );
+    }
+#endif
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "size %dx%d",
+        context->target->w, context->target->h
+    );
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "clear %.2f  transform %.2f  lighting %.2f ms",
+        (double)timings->clear     / 1e6,
+        (double)timings->transform / 1e6,
+        (double)timings->lighting  / 1e6
+    );
+
+    SDL_snprintf(
+        lines[count++], sizeof(lines[0]),
+        "raster %.2f  resolve %.2f ms",
+        (double)timings->raster  / 1e6,
+        (double)timings->resolve / 1e6
+    );
+
+    if (context->perf)
+    {
+        const PerfValues total = RenderCountersTotal(&context->counters);
+
+        SDL_snprintf(
+            lines[count++], sizeof(lines[0]),
+            "ipc %.2f  l1d %llu  llc %llu  branch %llu",
+            (double)total.counts[PERF_INSTRUCTIONS]
+                / (double)SDL_max(total.counts[PERF_CYCLES], 1),
+            (unsigned long long)total.counts[PERF_L1D_MISSES],
+            (unsigned long long)total.counts[PERF_LLC_MISSES],
+            (unsigned long long)total.counts[PERF_BRANCH_MISSES]
+        );
+    }
+
+    const int line_height = 7 * HUD_SCALE;
+
+    size_t width = 0;
+    for (size_t i = 0; i < count; ++i)
+        width = SDL_max(width, strlen(lines[i]));
+
+    SDL_FillRect(
+        surface,
+        &(SDL_Rect){
+            0, 0,
+            (int)width * 4 * HUD_SCALE + 2 * line_height,
+            (int)count * line_height + line_height,
+        },
+        SDL_MapRGBA(surface->format, 0, 0, 0, 255)
+    );
+
+    const uint32_t color = SDL_MapRGBA(surface->format, 255, 255, 255, 255);
+
+    for (size_t i = 0; i < count; ++i)
+        DrawText(
+            surface,
+            line_height,
+            line_height / 2 + (int)i * line_height,
+            color,
+            lines[i]
+        );
+}
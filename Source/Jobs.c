@@ -0,0 +1,743 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Work-stealing job scheduler shared by everything that runs in parallel.
+// Each worker thread owns a queue of jobs: it pushes and pops at the bottom,
+// and idle workers steal from the top of the others. Threads outside the
+// system, such as the main thread, share queue and worker index 0, and help
+// run jobs while they wait on them.
+
+// Jobs each queue holds before further jobs are run immediately
+#define JOB_QUEUE_SIZE 1024
+
+// Failed steals before a waiting thread sleeps
+#define JOB_SPIN_COUNT 64
+
+// Runs [begin, end) of a range. worker is the index of the running thread,
+// stable for the life of the system, for choosing per-thread resources.
+typedef void (*JobFunc)(void * data, size_t begin, size_t end, size_t worker);
+
+// Number of jobs left to finish, which JobWait() waits to reach zero
+typedef struct JobCounter {
+    SDL_atomic_t value;
+} JobCounter;
+
+typedef struct Job {
+    JobFunc      func;
+    void       * data;
+    size_t       begin;
+    size_t       end;
+    size_t       grain;    // Never split smaller than this
+    JobCounter * counter;  // Decremented once the whole range has run
+} Job;
+
+typedef struct JobQueue {
+    SDL_SpinLock lock;
+    size_t       top;     // Oldest job, taken by thieves
+    size_t       bottom;  // One past the newest job, taken by the owner
+    Job          jobs[JOB_QUEUE_SIZE];
+} JobQueue;
+
+typedef struct JobSystem {
+    SDL_Thread ** threads;
+    size_t        thread_count;  // Workers started so far
+
+    // One per worker, after the one shared by outside threads. Fixed before
+    // any worker starts.
+    JobQueue    * queues;
+    size_t        queue_count;
+
+    // Idle threads sleep until a job is pushed, or what they wait on is done
+    SDL_mutex   * lock;
+    SDL_cond    * wake;
+    SDL_atomic_t  pending;   // Jobs in any queue
+    SDL_atomic_t  sleeping;
+    SDL_atomic_t  quit;
+
+    bool          pin;
+
+    // Counters of each worker, opened by the worker itself before the
+    // system is returned, when counting. Outside threads count themselves.
+    PerfCounters * perf;
+    SDL_sem      * started;
+} JobSystem;
+
+// Index of the calling thread within its job system, 0 outside of one
+static _Thread_local size_t job_worker = 0;
+
+static inline size_t
+JobWorker(void)
+{
+    return job_worker;
+}
+
+// Threads that run jobs, including the calling thread, one without a system
+static inline size_t
+JobThreadCount(
+    const JobSystem * const jobs)
+{
+    return (jobs) ? jobs->queue_count : 1;
+}
+
+static inline bool
+JobQueuePush(
+          JobQueue * const queue,
+    const Job      * const job)
+{
+    SDL_assert(queue);
+    SDL_assert(job);
+
+    SDL_AtomicLock(&queue->lock);
+
+    const bool result = (queue->bottom - queue->top < JOB_QUEUE_SIZE);
+
+    if (result)
+        queue->jobs[queue->bottom++ % JOB_QUEUE_SIZE] = *job;
+
+    SDL_AtomicUnlock(&queue->lock);
+    return result;
+}
+
+// Takes the newest job for the owner, or the oldest for a thief, which is
+// the largest part of a split range
+static inline bool
+JobQueueTake(
+    JobQueue * const queue,
+    Job      * const job,
+    const bool       steal)
+{
+    SDL_assert(queue);
+    SDL_assert(job);
+
+    SDL_AtomicLock(&queue->lock);
+
+    const bool result = (queue->bottom != queue->top);
+
+    if (result && steal)
+        *job = queue->jobs[queue->top++ % JOB_QUEUE_SIZE];
+    else if (result)
+        *job = queue->jobs[--queue->bottom % JOB_QUEUE_SIZE];
+
+    SDL_AtomicUnlock(&queue->lock);
+    return result;
+}
+
+static inline bool
+JobQueueEmpty(
+    JobQueue * const queue)
+{
+    SDL_assert(queue);
+
+    SDL_AtomicLock(&queue->lock);
+    const bool result = (queue->bottom == queue->top);
+    SDL_AtomicUnlock(&queue->lock);
+
+    return result;
+}
+
+// Queues a job on the calling thread's queue, or runs it immediately when
+// the queue is full
+static void JobExecute(JobSystem * const, Job * const);
+
+static inline void
+JobPush(
+          JobSystem * const jobs,
+    const Job       * const job)
+{
+    SDL_assert(jobs);
+    SDL_assert(job);
+
+    if (!JobQueuePush(&jobs->queues[JobWorker()], job))
+    {
+        Job inline_job = *job;
+        JobExecute(jobs, &inline_job);
+        return;
+    }
+
+    SDL_AtomicAdd(&jobs->pending, 1);
+
+    // Both sides write before reading the other's count, so either the
+    // sleeper sees the job or this sees the sleeper
+    if (SDL_AtomicGet(&jobs->sleeping))
+    {
+        SDL_LockMutex(jobs->lock);
+        SDL_CondSignal(jobs->wake);
+        SDL_UnlockMutex(jobs->lock);
+    }
+}
+
+// Runs a range, splitting off its upper half for other threads whenever the
+// calling thread's queue runs dry. Ranges are only split as far as there are
+// idle threads to take them, so the grain adapts to the load.
+static void
+JobExecute(
+    JobSystem * const jobs,
+    Job       * const job)
+{
+    SDL_assert(job && job->func);
+
+    const size_t worker = JobWorker();
+
+    size_t begin = job->begin;
+
+    while (begin < job->end)
+    {
+        const size_t remaining = job->end - begin;
+
+        if (jobs && remaining / 2 >= job->grain
+         && JobQueueEmpty(&jobs->queues[worker]))
+        {
+            Job split = *job;
+            split.begin = job->end - remaining / 2;
+            job->end    = split.begin;
+
+            if (split.counter)
+                SDL_AtomicAdd(&split.counter->value, 1);
+
+            JobPush(jobs, &split);
+            continue;
+        }
+
+        const size_t end = begin + SDL_min(job->grain, remaining);
+
+        job->func(job->data, begin, end, worker);
+        begin = end;
+    }
+
+    if (!job->counter || SDL_AtomicAdd(&job->counter->value, -1) != 1)
+        return;
+
+    if (jobs && SDL_AtomicGet(&jobs->sleeping))
+    {
+        SDL_LockMutex(jobs->lock);
+        SDL_CondBroadcast(jobs->wake);
+        SDL_UnlockMutex(jobs->lock);
+    }
+}
+
+// Runs one job from the calling thread's queue, or stolen from another
+static inline bool
+JobRunOne(
+    JobSystem * const jobs)
+{
+    SDL_assert(jobs);
+
+    const size_t worker = JobWorker();
+    const size_t queues = jobs->queue_count;
+
+    Job job;
+    bool found = JobQueueTake(&jobs->queues[worker], &job, false);
+
+    for (size_t i = 1; !found && i < queues; ++i)
+        found = JobQueueTake(&jobs->queues[(worker + i) % queues], &job, true);
+
+    if (!found)
+        return false;
+
+    SDL_AtomicAdd(&jobs->pending, -1);
+    JobExecute(jobs, &job);
+    return true;
+}
+
+// Sleeps until a job is pushed, or the counter reaches zero if given
+static inline void
+JobSleep(
+    JobSystem  * const jobs,
+    JobCounter * const counter)
+{
+    SDL_assert(jobs);
+
+    SDL_LockMutex(jobs->lock);
+    SDL_AtomicAdd(&jobs->sleeping, 1);
+
+    while (!SDL_AtomicGet(&jobs->pending)
+        && !SDL_AtomicGet(&jobs->quit)
+        && (!counter || SDL_AtomicGet(&counter->value) > 0))
+        SDL_CondWait(jobs->wake, jobs->lock);
+
+    SDL_AtomicAdd(&jobs->sleeping, -1);
+    SDL_UnlockMutex(jobs->lock);
+}
+
+#if defined(__linux__)
+// Restricts the calling thread to one core. syscall() avoids needing
+// _GNU_SOURCE for the glibc wrapper.
+static inline void
+JobPinThread(
+    const size_t core)
+{
+    unsigned long mask[16] = {0};
+    const size_t  bits     = sizeof(mask[0]) * CHAR_BIT;
+
+    if (core >= SDL_arraysize(mask) * bits)
+        return;
+
+    mask[core / bits] = 1ul << (core % bits);
+
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0)
+        printf("Unable to pin worker to core %zu\n", core);
+}
+#else
+static inline void
+JobPinThread(
+    const size_t core)
+{
+    (void)core;
+}
+#endif
+
+typedef struct JobWorkerStart {
+    JobSystem * jobs;
+    size_t      index;
+} JobWorkerStart;
+
+static int
+JobWorkerMain(
+    void * const data)
+{
+    JobWorkerStart * const start = data;
+    SDL_assert(start && start->jobs);
+
+    JobSystem * const jobs = start->jobs;
+    job_worker = start->index;
+    free(start);
+
+    // Workers take the cores after the first, which is left to the threads
+    // outside the system
+    if (jobs->pin)
+        JobPinThread(job_worker % (size_t)SDL_GetCPUCount());
+
+    // Workers without counters count nothing
+    if (jobs->perf)
+    {
+        PerfOpen(&jobs->perf[job_worker]);
+        SDL_SemPost(jobs->started);
+    }
+
+    while (!SDL_AtomicGet(&jobs->quit))
+    {
+        if (!JobRunOne(jobs))
+            JobSleep(jobs, NULL);
+    }
+
+    return 0;
+}
+
+static inline void
+JobSystemDestroy(
+    JobSystem * const jobs)
+{
+    if (!jobs)
+        return;
+
+    SDL_AtomicSet(&jobs->quit, 1);
+
+    if (jobs->lock)
+    {
+        SDL_LockMutex(jobs->lock);
+        SDL_CondBroadcast(jobs->wake);
+        SDL_UnlockMutex(jobs->lock);
+    }
+
+    for (size_t i = 0; i < jobs->thread_count; ++i)
+        SDL_WaitThread(jobs->threads[i], NULL);
+
+    if (jobs->perf)
+    {
+        for (size_t i = 1; i < jobs->queue_count; ++i)
+            PerfClose(&jobs->perf[i]);
+    }
+
+    free(jobs->perf);
+    SDL_DestroySemaphore(jobs->started);
+
+    SDL_DestroyCond(jobs->wake);
+    SDL_DestroyMutex(jobs->lock);
+    free(jobs->threads);
+    free(jobs->queues);
+    free(jobs);
+}
+
+// Starts threads - 1 workers, so that the calling thread makes up the rest.
+// Returns NULL with no error set for a single thread, which runs every job
+// on the calling thread. Pinning gives each worker a core of its own, and
+// perf has each worker open performance counters, see JobPerfRead().
+static inline JobSystem *
+JobSystemCreate(
+    const size_t threads,
+    const bool   pin,
+    const bool   perf)
+{
+    SDL_assert(threads > 0);
+
+    if (threads <= 1)
+        return NULL;
+
+    JobSystem * const jobs = calloc(1, sizeof(JobSystem));
+
+    if (!jobs)
+    {
+        SDL_SetError("Unable to allocate job system");
+        return NULL;
+    }
+
+    jobs->pin     = pin;
+    jobs->threads = calloc(threads - 1, sizeof(SDL_Thread *));
+    jobs->queues  = calloc(threads, sizeof(JobQueue));
+    jobs->queue_count = threads;
+    jobs->lock    = SDL_CreateMutex();
+    jobs->wake    = SDL_CreateCond();
+
+    if (!jobs->threads || !jobs->queues)
+    {
+        SDL_SetError("Unable to allocate job queues");
+        goto Error;
+    }
+
+    if (!jobs->lock || !jobs->wake)
+        goto Error;
+
+    if (perf)
+    {
+        jobs->perf    = malloc(SizeMult(sizeof(PerfCounters), threads));
+        jobs->started = SDL_CreateSemaphore(0);
+
+        if (!jobs->perf || !jobs->started)
+        {
+            free(jobs->perf);
+            jobs->perf = NULL;
+            SDL_SetError("Unable to allocate worker counters");
+            goto Error;
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+            for (size_t j = 0; j < PERF_COUNTERS; ++j)
+                jobs->perf[i].fds[j] = -1;
+    }
+
+    for (; jobs->thread_count < threads - 1; jobs->thread_count++)
+    {
+        JobWorkerStart * const start = malloc(sizeof(JobWorkerStart));
+
+        if (!start)
+        {
+            SDL_SetError("Unable to allocate job worker");
+            goto Error;
+        }
+
+        *start = (JobWorkerStart){jobs, jobs->thread_count + 1};
+
+        jobs->threads[jobs->thread_count] = SDL_CreateThread(JobWorkerMain, "Worker", start);
+
+        if (!jobs->threads[jobs->thread_count])
+        {
+            free(start);
+            goto Error;
+        }
+    }
+
+    // Counters are read from other threads once opened
+    if (jobs->perf)
+    {
+        for (size_t i = 0; i < jobs->thread_count; ++i)
+            SDL_SemWait(jobs->started);
+    }
+
+    return jobs;
+
+Error:
+    JobSystemDestroy(jobs);
+    return NULL;
+}
+
+// Adds the counts of every worker to values, not those of outside threads.
+// Counters cover whatever the workers run, and nothing without a system or
+// without counting.
+static inline void
+JobPerfRead(
+    const JobSystem  * const jobs,
+          PerfValues * const values)
+{
+    SDL_assert(values);
+
+    if (!jobs || !jobs->perf)
+        return;
+
+    for (size_t i = 1; i < jobs->queue_count; ++i)
+    {
+        PerfValues worker;
+        PerfRead(&jobs->perf[i], &worker);
+
+        for (size_t j = 0; j < PERF_COUNTERS; ++j)
+            values->counts[j] += worker.counts[j];
+    }
+}
+
+// Queues a range to run in parallel, counted by the counter until it has
+// finished. Runs the whole range immediately without a system.
+static inline void
+JobRun(
+          JobSystem  * const jobs,
+    const JobFunc            func,
+          void       * const data,
+    const size_t             count,
+    const size_t             grain,
+          JobCounter * const counter)
+{
+    SDL_assert(func);
+    SDL_assert(grain > 0);
+
+    if (!count)
+        return;
+
+    Job job = {
+        .func    = func,
+        .data    = data,
+        .begin   = 0,
+        .end     = count,
+        .grain   = grain,
+        .counter = counter,
+    };
+
+    if (counter)
+        SDL_AtomicAdd(&counter->value, 1);
+
+    if (!jobs)
+        JobExecute(NULL, &job);
+    else
+        JobPush(jobs, &job);
+}
+
+// Helps run jobs until the counter reaches zero
+static inline void
+JobWait(
+    JobSystem  * const jobs,
+    JobCounter * const counter)
+{
+    SDL_assert(counter);
+
+    int spins = 0;
+
+    while (SDL_AtomicGet(&counter->value) > 0)
+    {
+        SDL_assert(jobs);
+
+        if (JobRunOne(jobs))
+            spins = 0;
+        else if (++spins >= JOB_SPIN_COUNT)
+        {
+            JobSleep(jobs, counter);
+            spins = 0;
+        }
+    }
+}
+
+// Runs func over [0, count) in parallel and returns once all of it has run.
+// Ranges are handed out no smaller than grain items at a time.
+static inline void
+JobParallelFor(
+          JobSystem * const jobs,
+    const size_t            count,
+    const size_t            grain,
+    const JobFunc           func,
+          void      * const data)
+{
+    SDL_assert(func);
+    SDL_assert(grain > 0);
+
+    if (!jobs || count <= grain)
+    {
+        if (count)
+            func(data, 0, count, JobWorker());
+
+        return;
+    }
+
+    JobCounter counter = {{0}};
+
+    Job job = {
+        .func    = func,
+        .data    = data,
+        .begin   = 0,
+        .end     = count,
+        .grain   = grain,
+        .counter = &counter,
+    };
+
+    // The calling thread starts on the range itself, so other threads only
+    // get what they steal
+    SDL_AtomicAdd(&counter.value, 1);
+    JobExecute(jobs, &job);
+    JobWait(jobs, &counter);
+}
+
+// Bits of the key sorted per pass of JobRadixSort()
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+// Fewest keys in each block counted and scattered by one thread
+#define RADIX_BLOCK_MIN 16384
+
+// Blocks per thread, so that threads that start late still get a share
+#define RADIX_BLOCKS_PER_THREAD 2
+
+typedef struct RadixSort {
+    uint64_t * source;
+    uint64_t * dest;
+    size_t     count;
+    size_t     block_size;
+    unsigned   shift;
+
+    // Keys of each digit in each block, then where the block's keys of each
+    // digit go
+    size_t  (* offsets)[RADIX_SIZE];
+} RadixSort;
+
+static void
+RadixCountJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    RadixSort * const sort = data;
+
+    (void)worker;
+
+    for (size_t b = begin; b < end; ++b)
+    {
+        size_t * const counts = sort->offsets[b];
+        memset(counts, 0, sizeof(size_t) * RADIX_SIZE);
+
+        const size_t first = b * sort->block_size;
+        const size_t last  = SDL_min(first + sort->block_size, sort->count);
+
+        for (size_t i = first; i < last; ++i)
+            counts[(sort->source[i] >> sort->shift) & (RADIX_SIZE - 1)]++;
+    }
+}
+
+static void
+RadixScatterJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    RadixSort * const sort = data;
+
+    (void)worker;
+
+    for (size_t b = begin; b < end; ++b)
+    {
+        size_t * const offsets = sort->offsets[b];
+
+        const size_t first = b * sort->block_size;
+        const size_t last  = SDL_min(first + sort->block_size, sort->count);
+
+        for (size_t i = first; i < last; ++i)
+        {
+            const uint64_t key = sort->source[i];
+            sort->dest[offsets[(key >> sort->shift) & (RADIX_SIZE - 1)]++] = key;
+        }
+    }
+}
+
+// Stable sorts keys by bits [first_bit, last_bit), least significant digit
+// first. Each pass counts the digits of blocks of keys in parallel, then
+// scatters each block to where the counts of all the blocks put it, so the
+// result doesn't depend on the threads. Passes where every key has the same
+// digit are skipped. Scratch memory is taken from the arena.
+static inline int
+JobRadixSort(
+          JobSystem * const jobs,
+          Arena     * const arena,
+          uint64_t  * const keys,
+    const size_t            count,
+    const unsigned          first_bit,
+    const unsigned          last_bit)
+{
+    SDL_assert(arena);
+    SDL_assert(keys || !count);
+    SDL_assert(first_bit <= last_bit && last_bit <= 64);
+    SDL_assert((last_bit - first_bit) % RADIX_BITS == 0);
+
+    if (count < 2)
+        return 0;
+
+    const size_t threads = JobThreadCount(jobs);
+
+    const size_t blocks = SDL_max(
+        SDL_min(
+            threads * RADIX_BLOCKS_PER_THREAD,
+            count / RADIX_BLOCK_MIN
+        ),
+        (size_t)1
+    );
+
+    uint64_t * const scratch = ArenaAllocArray(arena, count, sizeof(uint64_t));
+    void     * const offsets = ArenaAllocArray(arena, blocks, sizeof(size_t[RADIX_SIZE]));
+
+    if (!scratch || !offsets)
+        return SDL_SetError("Unable to allocate sorting memory");
+
+    RadixSort sort = {
+        .source     = keys,
+        .dest       = scratch,
+        .count      = count,
+        .block_size = (count + blocks - 1) / blocks,
+        .offsets    = offsets,
+    };
+
+    for (unsigned shift = first_bit; shift < last_bit; shift += RADIX_BITS)
+    {
+        sort.shift = shift;
+
+        JobParallelFor(jobs, blocks, 1, RadixCountJob, &sort);
+
+        // Digits in order, and blocks in order within each digit
+        size_t total  = 0;
+        bool   single = false;
+
+        for (size_t d = 0; d < RADIX_SIZE; ++d)
+        {
+            const size_t start = total;
+
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                const size_t keys_in_block = sort.offsets[b][d];
+
+                sort.offsets[b][d] = total;
+                total += keys_in_block;
+            }
+
+            single |= (total - start == count);
+        }
+
+        if (single)
+            continue;
+
+        JobParallelFor(jobs, blocks, 1, RadixScatterJob, &sort);
+
+        uint64_t * const sorted = sort.dest;
+        sort.dest   = sort.source;
+        sort.source = sorted;
+    }
+
+    if (sort.source != keys)
+        memcpy(keys, sort.source, sizeof(uint64_t) * count);
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Lighting is precomputed into a table indexed by octahedral encoded normal,
+// so that per-pixel shading is an encode and a lookup regardless of the
+// complexity of the lighting model.
+//
+// https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+
+#define LIGHTING_TABLE_SIZE 128
+
+typedef enum LightingModel {
+    LIGHTING_DIFFUSE,
+    LIGHTING_TOON,
+} LightingModel;
+
+typedef struct LightingTable {
+    LightingModel model;
+    bool          specular;
+    Vector        light;
+    Vector        view;
+    uint32_t      format;
+
+    uint32_t      colors[LIGHTING_TABLE_SIZE * LIGHTING_TABLE_SIZE];
+} LightingTable;
+
+static inline Vector
+OctahedralDecode(
+    const float u,
+    const float v)
+{
+    Vector normal = {
+        .x = u,
+        .y = v,
+        .z = 1.0f - fabsf(u) - fabsf(v),
+    };
+
+    // Lower hemisphere is folded over the diagonals of the square
+    if (normal.z < 0.0f)
+    {
+        normal.x = (1.0f - fabsf(v)) * copysignf(1.0f, u);
+        normal.y = (1.0f - fabsf(u)) * copysignf(1.0f, v);
+    }
+
+    return VectorNormalize(&normal);
+}
+
+static inline size_t
+OctahedralIndex(
+    const Vector * const normal)
+{
+    SDL_assert(normal);
+
+    // Projecting onto the octahedron only needs the L1 norm, so unlike
+    // normalizing this is a single reciprocal and no square root. The bias
+    // keeps degenerate normals in the table.
+    const float scale = 1.0f / (
+        fabsf(normal->x) + fabsf(normal->y) + fabsf(normal->z) + 1e-20f
+    );
+
+    float u = normal->x * scale;
+    float v = normal->y * scale;
+
+    if (normal->z < 0.0f)
+    {
+        const float fold_u = (1.0f - fabsf(v)) * copysignf(1.0f, u);
+        const float fold_v = (1.0f - fabsf(u)) * copysignf(1.0f, v);
+        u = fold_u;
+        v = fold_v;
+    }
+
+    const float half = (float)(LIGHTING_TABLE_SIZE - 1) * 0.5f;
+
+    const size_t x = (size_t)(u * half + half + 0.5f);
+    const size_t y = (size_t)(v * half + half + 0.5f);
+
+    SDL_assert(x < LIGHTING_TABLE_SIZE);
+    SDL_assert(y < LIGHTING_TABLE_SIZE);
+
+    return y * LIGHTING_TABLE_SIZE + x;
+}
+
+static inline uint32_t
+LightingLookup(
+    const LightingTable * const table,
+    const Vector        * const normal)
+{
+    SDL_assert(table);
+
+    return table->colors[OctahedralIndex(normal)];
+}
+
+static inline uint32_t
+LightingEvaluate(
+    const LightingTable   * const table,
+    const SDL_PixelFormat * const format,
+    const Vector          * const normal)
+{
+    SDL_assert(table);
+    SDL_assert(format);
+    SDL_assert(normal);
+
+    float intensity = VectorDot(normal, &table->light);
+
+    // Blinn-Phong highlight, from the half vector of the light and the view
+    float specular = 0.0f;
+    if (table->specular && intensity > 0.0f)
+    {
+        Vector half = VectorAdd(&table->light, &table->view);
+               half = VectorNormalize(&half);
+
+        specular = powf(fmaxf(VectorDot(normal, &half), 0.0f), 32.0f) * 0.5f;
+    }
+
+    switch (table->model)
+    {
+        case LIGHTING_DIFFUSE:
+        {
+            intensity = fmaxf(fminf(intensity + specular, 1.0f), 0.0f) * 255.0f;
+
+            return SDL_MapRGBA(
+                format,
+                (uint8_t)intensity,
+                (uint8_t)intensity,
+                (uint8_t)intensity,
+                255
+            );
+        }
+
+        case LIGHTING_TOON:
+        {
+            for (float band = 1.0f; band > 0.0f; band -= 0.25f)
+            {
+                if (intensity > band - 0.25f)
+                {
+                    intensity = band;
+                    break;
+                }
+            }
+
+            intensity = fmaxf(fminf(intensity, 1.0f), 0.0f) * 255.0f;
+
+            // Highlights are a single hard band on top of the ramp
+            if (specular > 0.25f)
+                return SDL_MapRGBA(format, 255, 255, 255, 255);
+
+            return SDL_MapRGBA(
+                format,
+                (uint8_t)intensity,
+                (uint8_t)intensity / 2,
+                (uint8_t)intensity / 3,
+                255
+            );
+        }
+    }
+
+    SDL_assert(0);
+    return 0;
+}
+
+// Rebuilds the table if any of its inputs changed since it was last built.
+// The view direction only matters to the specular term, so without it
+// rotating the camera never invalidates the table.
+static inline int
+LightingTableUpdate(
+          LightingTable   **      table,
+    const SDL_PixelFormat * const format,
+    const LightingModel           model,
+    const bool                    specular,
+    const Vector          * const light,
+    const Vector          * const view)
+{
+    SDL_assert(table);
+    SDL_assert(format);
+    SDL_assert(light);
+    SDL_assert(view);
+
+    if (*table
+     && (*table)->model    == model
+     && (*table)->specular == specular
+     && (*table)->format   == format->format
+     && !memcmp(&(*table)->light, light, sizeof(Vector))
+     && (!specular || !memcmp(&(*table)->view, view, sizeof(Vector))))
+        return 0;
+
+    if (!*table)
+    {
+        *table = malloc(sizeof(LightingTable));
+
+        if (!*table)
+            return SDL_SetError("Unable to allocate lighting table");
+    }
+
+    LightingTable * const result = *table;
+    result->model    = model;
+    result->specular = specular;
+    result->light    = *light;
+    result->view     = *view;
+    result->format   = format->format;
+
+    const float scale = 2.0f / (float)(LIGHTING_TABLE_SIZE - 1);
+
+    for (size_t y = 0; y < LIGHTING_TABLE_SIZE; ++y)
+    {
+        for (size_t x = 0; x < LIGHTING_TABLE_SIZE; ++x)
+        {
+            const Vector normal = OctahedralDecode(
+                (float)x * scale - 1.0f,
+                (float)y * scale - 1.0f
+            );
+
+            result->colors[y * LIGHTING_TABLE_SIZE + x] = LightingEvaluate(
+                result, format, &normal
+            );
+        }
+    }
+
+    return 0;
+}
+
+// Point and spot lights, in model space like the directional light, added
+// on top of it by the shading modes
+
+typedef enum LightType {
+    LIGHT_POINT,
+    LIGHT_SPOT,
+} LightType;
+
+typedef struct Light {
+    LightType type;
+    Vector    position;
+    Vector    direction;  // Spot lights only, normalized
+    Vector    color;      // Zero to one per channel
+    float     radius;     // Falls off to nothing at this distance
+    float     cos_outer;  // Spot cone, nothing outside
+    float     cos_inner;  // Spot cone, full intensity inside
+} Light;
+
+// Lights are indexed with 16 bits in the tile lists
+#define LIGHTS_MAX 1024
+
+typedef struct Lights {
+    Light * data;
+    size_t  size;
+} Lights;
+
+// Colors of each light, cycled through
+static const Vector LIGHT_COLORS[6] = {
+    {{1.0f, 0.3f, 0.2f}},
+    {{0.2f, 0.9f, 0.3f}},
+    {{0.3f, 0.4f, 1.0f}},
+    {{1.0f, 0.8f, 0.2f}},
+    {{0.9f, 0.3f, 1.0f}},
+    {{0.2f, 0.9f, 1.0f}},
+};
+
+// Places lights just off the surface of the mesh, at vertices spread through
+// it by a golden ratio stride, so that each lights a patch of it. Every
+// third light is a spot aimed back at the surface.
+static inline int
+LightsScatter(
+          Lights * const lights,
+    const size_t         count,
+    const Mesh   * const mesh)
+{
+    SDL_assert(lights);
+    SDL_assert(mesh && mesh->vertices.size);
+
+    lights->data = malloc(SizeMult(sizeof(Light), SDL_max(count, (size_t)1)));
+    lights->size = 0;
+
+    if (!lights->data)
+        return SDL_SetError("Unable to allocate lights");
+
+    Vector min = mesh->vertices.data[0];
+    Vector max = mesh->vertices.data[0];
+
+    for (size_t i = 1; i < mesh->vertices.size; ++i)
+    {
+        for (size_t j = 0; j < 3; ++j)
+        {
+            min.xyz[j] = fminf(min.xyz[j], mesh->vertices.data[i].xyz[j]);
+            max.xyz[j] = fmaxf(max.xyz[j], mesh->vertices.data[i].xyz[j]);
+        }
+    }
+
+    Vector center = VectorAdd(&min, &max);
+           center = VectorMultf(&center, 0.5f);
+
+    const Vector half   = VectorSub(&max, &center);
+    const float  extent = fmaxf(VectorMag(&half), 1e-6f);
+
+    const double golden = (sqrt(5.0) - 1.0) / 2.0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t vertex = (size_t)(
+            fmod((double)i * golden, 1.0) * (double)mesh->vertices.size
+        );
+
+        const Vector * const surface = &mesh->vertices.data[vertex];
+
+        // Outward from the center, for lack of a per-vertex normal
+        Vector outward = VectorSub(surface, &center);
+        outward = (VectorMag(&outward) > 1e-6f)
+            ? VectorNormalize(&outward)
+            : (Vector){.y = 1.0f};
+
+        const bool spot = (i % 3 == 2);
+
+        const Vector offset = VectorMultf(&outward, extent * ((spot) ? 0.15f : 0.05f));
+
+        lights->data[i] = (Light){
+            .type      = (spot) ? LIGHT_SPOT : LIGHT_POINT,
+            .position  = VectorAdd(surface, &offset),
+            .direction = VectorMultf(&outward, -1.0f),
+            .color     = LIGHT_COLORS[i % SDL_arraysize(LIGHT_COLORS)],
+            .radius    = extent * ((spot) ? 0.3f : 0.15f),
+            .cos_outer = cosf(0.5f),
+            .cos_inner = cosf(0.35f),
+        };
+    }
+
+    lights->size = count;
+
+    return 0;
+}
+
+// Adds the light reaching a surface point to a sum of colors. The normal
+// must be normalized.
+static inline void
+LightAccumulate(
+    const Light  * const light,
+    const Vector * const position,
+    const Vector * const normal,
+          Vector * const sum)
+{
+    SDL_assert(light);
+    SDL_assert(position);
+    SDL_assert(normal);
+    SDL_assert(sum);
+
+    const Vector to_light = VectorSub(&light->position, position);
+    const float  distance = VectorDot(&to_light, &to_light);
+
+    if (distance >= light->radius * light->radius)
+        return;
+
+    const float inv_distance = 1.0f / sqrtf(fmaxf(distance, 1e-20f));
+
+    const float intensity = VectorDot(normal, &to_light) * inv_distance;
+
+    if (intensity <= 0.0f)
+        return;
+
+    // Smooth falloff to zero at the radius
+    const float falloff = 1.0f - distance * inv_distance / light->radius;
+
+    float scale = intensity * falloff * falloff;
+
+    if (light->type == LIGHT_SPOT)
+    {
+        const float cos_angle = -VectorDot(&to_light, &light->direction) * inv_distance;
+
+        if (cos_angle <= light->cos_outer)
+            return;
+
+        scale *= fminf(
+            (cos_angle - light->cos_outer) / (light->cos_inner - light->cos_outer),
+            1.0f
+        );
+    }
+
+    const Vector color = VectorMultf(&light->color, scale);
+    *sum = VectorAdd(sum, &color);
+}
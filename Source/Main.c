@@ -13,72 +13,214 @@
 // You should have received a copy of the GNU General Public License along
 // with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-const int WINDOW_WIDTH  = 400;
-const int WINDOW_HEIGHT = 400;
+// Frame rate while the camera is moving, idle frames are only rendered when
+// something changed
+const int FRAME_RATE = 60;
+
+// Longest time to block waiting for events while idle
+const int IDLE_TIMEOUT_MS = 1000;
+
+// syscall() for the performance counters and thread pinning, fdopen() for
+// streaming frames, and sockets and shared memory for serving them
+#define _DEFAULT_SOURCE
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+#endif
 
 #include <SDL2/SDL.h>
 
 #include "Utils.c"
+#include "Arena.c"
+#include "PerfCounters.c"
+#include "Jobs.c"
+#include "TripleBuffer.c"
 #include "Vector.c"
 #include "Matrix.c"
 #include "Quaternion.c"
 #include "Mesh.c"
 #include "Wavefront.c"
+#include "Lighting.c"
+#include "Shadow.c"
+#include "Texture.c"
+#include "Temporal.c"
 #include "Render.c"
 #include "Render/Wireframe.c"
 #include "Render/Flat.c"
 #include "Render/Gouraud.c"
 #include "Render/Phong.c"
 #include "Render/Toon.c"
+#include "Hud.c"
+#include "Trace.c"
+#include "Output.c"
+#include "Resolution.c"
+#include "Refine.c"
+#include "RenderThread.c"
+#include "Options.c"
+#include "Headless.c"
+#include "Batch.c"
+#include "Server.c"
 
 int main(int argc, const char** argv)
 {
-    if (argc != 2)
+    Options options;
+    if (ParseOptions(argc, argv, &options))
     {
-        printf("Usage: QuickRender <file>\n");
+        printf("%s\n\n", SDL_GetError());
+        PrintUsage();
         return EXIT_FAILURE;
     }
 
+    if (options.help)
+    {
+        PrintUsage();
+        return EXIT_SUCCESS;
+    }
+
+    // Frames streamed to stdout need it to themselves, so everything else
+    // printed goes to stderr from here on
+    if (options.headless && !options.no_output && OutputIsStdout(options.output))
+    {
+        if (!OutputStdout())
+        {
+            printf("%s\n", SDL_GetError());
+            return EXIT_FAILURE;
+        }
+    }
+
     {
         SDL_version version;
         SDL_VERSION(&version);
         printf("SDL %d.%d.%d\n", version.major, version.minor, version.patch);
     }
 
-    RenderContext context;
-    context.mode     = RENDER_WIREFRAME;
-    context.rotation = (Quaternion){{.w = 1.0f}};
-    context.light    = VectorNormalize(&(Vector){.x = 4.0f, .y = 4.0f, .z = 3.0f});
-    context.camera   = (Camera){
+    RenderState state = {
+        .mode     = options.mode,
+        .flags    = options.flags,
+        .samples  = options.samples,
+        .rotation = (Quaternion){{.w = 1.0f}},
+        .light    = VectorNormalize(&(Vector){.x = 4.0f, .y = 4.0f, .z = 3.0f}),
+        .refine   = (options.refine) ? 0 : REFINE_FULL,
+    };
+
+    const Camera camera = {
         .pos   = (Vector){.z = 300.0f},
         .focus = (Vector){.x =   -2.0f, .y = -4.0f},
         .up    = (Vector){.y =   1.0f},
         .right = (Vector){.x =   1.0f},
     };
 
-    context.mesh = LoadObj(argv[1]);
+    RenderThread renderer = {0};
+    SDL_Window * window = NULL;
+
+    JobSystem * jobs = NULL;
+
+    Mesh * mesh = NULL;
+
+    Lights lights = {.data = NULL};
 
-    if (!context.mesh)
+    SDL_Surface * texture = NULL;
+
+    Trace trace = {.file = NULL};
+
+    int status = EXIT_SUCCESS;
+
+    if (options.trace && TraceOpen(&trace, options.trace))
+    {
+        status = EXIT_FAILURE;
         goto Error_Init;
+    }
 
-    SDL_assert(context.mesh->vertices.size > 0);
-    SDL_assert(context.mesh->faces.size    > 0);
-    SDL_assert(context.mesh->normals.size  > 0);
+    Trace * const tracing = (options.trace) ? &trace : NULL;
+
+    if (options.texture)
+    {
+        texture = SDL_LoadBMP(options.texture);
+
+        if (!texture)
+        {
+            status = EXIT_FAILURE;
+            goto Error_Init;
+        }
+    }
+
+    // One scheduler for loading and rendering, with the calling thread as
+    // one of its threads
+    const int threads = (options.threads > 0) ? options.threads : SDL_GetCPUCount();
+
+    jobs = JobSystemCreate((size_t)threads, options.pin, options.perf);
+
+    if (!jobs && threads > 1)
+    {
+        status = EXIT_FAILURE;
+        goto Error_Init;
+    }
+
+    if (options.batch)
+    {
+        if (RunBatch(&options, jobs, &camera, &state.light, texture, tracing))
+            status = EXIT_FAILURE;
+
+        goto Error_Init;
+    }
+
+    if (options.serve)
+    {
+        if (RunServer(&options, jobs, &camera, &state.light, texture, tracing))
+            status = EXIT_FAILURE;
+
+        goto Error_Init;
+    }
+
+    mesh = LoadObj(options.file, jobs, true);
+
+    if (!mesh)
+        goto Error_Init;
+
+    SDL_assert(mesh->vertices.size > 0);
+    SDL_assert(mesh->faces.size    > 0);
+    SDL_assert(mesh->normals.size  > 0);
+
+    if (options.lights && LightsScatter(&lights, (size_t)options.lights, mesh))
+    {
+        status = EXIT_FAILURE;
+        goto Error_Init;
+    }
+
+    if (options.headless)
+    {
+        if (RunHeadless(&options, jobs, mesh, &camera, &state.light, &lights, texture, tracing))
+            status = EXIT_FAILURE;
+
+        goto Error_Init;
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO))
         goto Error_Init;
 
-    SDL_Window * const window = SDL_CreateWindow(
-        argv[1],
+    window = SDL_CreateWindow(
+        options.file,
         SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-        WINDOW_WIDTH, WINDOW_HEIGHT,
+        options.width, options.height,
         SDL_WINDOW_SHOWN
             | SDL_WINDOW_ALLOW_HIGHDPI
+            | SDL_WINDOW_RESIZABLE
             | SDL_WINDOW_INPUT_FOCUS
             | SDL_WINDOW_MOUSE_FOCUS
     );
@@ -86,17 +228,10 @@ int main(int argc, const char** argv)
     if (!window)
         goto Error_Window;
 
-    context.depth = SDL_CreateRGBSurfaceWithFormat(
-        0 /* flags */,
-        WINDOW_WIDTH, WINDOW_HEIGHT,
-        32, SDL_PIXELFORMAT_RGBA32
-    );
-
-    if (!context.depth)
-        goto Error_DepthBuffer;
+    const uint64_t budget = (uint64_t)options.budget * 1000000;
 
-    uint32_t clock = SDL_GetTicks();
-    uint32_t delta = 0;
+    if (RenderThreadStart(&renderer, jobs, mesh, &camera, &lights, texture, tracing, options.perf, budget))
+        goto Error_Thread;
 
     typedef struct InputState {
         bool w, a, s, d, q, e;
@@ -104,17 +239,107 @@ int main(int argc, const char** argv)
 
     InputState input = {false};
 
-    while (!SDL_QuitRequested())
+    // Last state handed to the render thread, nothing is submitted until
+    // something changes
+    RenderState submitted = {.width = -1};
+
+    // Frame currently in the window surface
+    const RenderFrame * frame = NULL;
+
+    const uint64_t frequency    = SDL_GetPerformanceFrequency();
+    const uint64_t frame_period = frequency / (uint64_t)FRAME_RATE;
+
+    const uint64_t refine_delay = frequency * REFINE_DELAY_MS / 1000;
+
+    uint64_t clock = SDL_GetPerformanceCounter();
+
+    // Time of the last change to the state, refinement starts once it has
+    // been still for the refine delay
+    uint64_t still = clock;
+
+    // Input to present latency, reported once a second
+    struct {
+        uint64_t total;
+        uint64_t max;
+        uint32_t frames;
+        uint64_t reported;
+    } latency = {.reported = clock};
+
+    bool running = true;
+    while (running)
     {
-        const uint32_t time = SDL_GetTicks();
-        delta = time - clock;
-        clock = time;
+        const bool moving = input.w || input.a || input.s
+                         || input.d || input.q || input.e;
+
+        // Block until the next paced frame while moving, or until anything
+        // at all happens while idle
+        int timeout = IDLE_TIMEOUT_MS;
+        if (moving)
+        {
+            const uint64_t now      = SDL_GetPerformanceCounter();
+            const uint64_t deadline = clock + frame_period;
+
+            timeout = (now < deadline)
+                ? (int)(((deadline - now) * 1000 + frequency - 1) / frequency)
+                : 0;
+        }
+        // Wake to start refining, after which each refined frame wakes
+        // the loop by being published
+        else if (state.refine < REFINE_FULL)
+        {
+            const uint64_t now      = SDL_GetPerformanceCounter();
+            const uint64_t deadline = still + refine_delay;
+
+            if (now < deadline)
+                timeout = (int)(((deadline - now) * 1000 + frequency - 1) / frequency);
+        }
+
+        bool present = false;
+        bool fresh   = false;
 
         SDL_Event event;
-        while (SDL_PollEvent(&event))
+        bool pending = (timeout > 0)
+            ? SDL_WaitEventTimeout(&event, timeout)
+            : SDL_PollEvent(&event);
+
+        const uint64_t input_time = SDL_GetPerformanceCounter();
+
+        for (; pending; pending = SDL_PollEvent(&event))
         {
+            // Render thread published a frame, or failed
+            if (event.type == renderer.event)
+            {
+                if (SDL_AtomicGet(&renderer.failed))
+                {
+                    SDL_SetError("%s", renderer.error);
+                    goto Error_Render;
+                }
+
+                const RenderFrame * const latest = RenderThreadAcquire(&renderer);
+
+                if (latest)
+                {
+                    frame   = latest;
+                    fresh   = true;
+                    present = true;
+                }
+
+                continue;
+            }
+
             switch (event.type)
             {
+                case SDL_QUIT:
+                    running = false;
+                    break;
+
+                // Window contents were lost, but the last frame is still
+                // held by this thread
+                case SDL_WINDOWEVENT:
+                    if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                        present = (frame != NULL);
+                    break;
+
                 // Trigger keys
                 case SDL_KEYDOWN:
                 {
@@ -123,23 +348,63 @@ int main(int argc, const char** argv)
                     switch (event.key.keysym.sym)
                     {
                         case SDLK_1:
-                            context.mode = RENDER_WIREFRAME;
+                            state.mode = RENDER_WIREFRAME;
                             break;
 
                         case SDLK_2:
-                            context.mode = RENDER_FLAT;
+                            state.mode = RENDER_FLAT;
                             break;
 
                         case SDLK_3:
-                            context.mode = RENDER_GOURAUD;
+                            state.mode = RENDER_GOURAUD;
                             break;
 
                         case SDLK_4:
-                            context.mode = RENDER_PHONG;
+                            state.mode = RENDER_PHONG;
                             break;
 
                         case SDLK_5:
-                            context.mode = RENDER_TOON;
+                            state.mode = RENDER_TOON;
+                            break;
+
+                        case SDLK_h:
+                            state.flags ^= RENDER_HIDDEN_LINES;
+                            break;
+
+                        case SDLK_b:
+                            state.flags ^= RENDER_SPECULAR;
+                            break;
+
+                        case SDLK_o:
+                            state.flags ^= RENDER_OVERDRAW;
+                            break;
+
+                        case SDLK_i:
+                            state.flags ^= RENDER_HUD;
+                            break;
+
+                        case SDLK_t:
+                            state.flags ^= RENDER_TEXTURES;
+                            break;
+
+                        // Off, hard, filtered
+                        case SDLK_l:
+                            if (!(state.flags & RENDER_SHADOWS))
+                                state.flags |= RENDER_SHADOWS;
+                            else if (!(state.flags & RENDER_SHADOW_PCF))
+                                state.flags |= RENDER_SHADOW_PCF;
+                            else
+                                state.flags &= ~(RENDER_SHADOWS | RENDER_SHADOW_PCF);
+                            break;
+
+                        case SDLK_r:
+                            state.flags ^= RENDER_TEMPORAL;
+                            break;
+
+                        case SDLK_m:
+                            state.samples = (state.samples < 4)
+                                ? state.samples * 2
+                                : 1;
                             break;
 
                         default:
@@ -150,6 +415,7 @@ int main(int argc, const char** argv)
                     if (!fallthrough)
                         break;
                 }
+                // fallthrough
 
                 // Stateful keys
                 case SDL_KEYUP:
@@ -189,9 +455,15 @@ int main(int argc, const char** argv)
             }
         }
 
-        // Camera transformation
+        const uint64_t time = SDL_GetPerformanceCounter();
+
+        // Camera transformation, at a rate independent of the frame rate
+        if (moving && time >= clock + frame_period)
         {
-            const float rotation = (float)M_PI / 64.0f;
+            // Matches the original fixed step of pi/64 per frame at 20 fps,
+            // and limits the step after a long stall
+            const float seconds  = fminf((float)(time - clock) / (float)frequency, 0.1f);
+            const float rotation = (float)M_PI / 64.0f * 20.0f * seconds;
 
             float qx  = (input.w) ? -1.0f : 0.0f;
                   qx += (input.s) ?  1.0f : 0.0f;
@@ -208,44 +480,118 @@ int main(int argc, const char** argv)
 
             Quaternion quaternion = AnglesToQuaternion(qz, qy, qx);
             quaternion = QuaternionNormalize(&quaternion);
-            context.rotation = QuaternionMult(&quaternion, &context.rotation);
-            context.rotation = QuaternionNormalize(&context.rotation);
+            state.rotation = QuaternionMult(&quaternion, &state.rotation);
+            state.rotation = QuaternionNormalize(&state.rotation);
+
+            clock = time;
+        }
+        else if (!moving)
+        {
+            clock = time;
         }
 
-        context.target = SDL_GetWindowSurface(window);
+        SDL_Surface * const surface = SDL_GetWindowSurface(window);
 
-        if (!context.target)
+        if (!surface)
             goto Error_Surface;
 
-        if (Render(&context) != 0)
-            goto Error_Render;
+        state.width  = surface->w;
+        state.height = surface->h;
+        state.format = surface->format->format;
+        state.moving = moving;
 
-        if (SDL_UpdateWindowSurface(window) != 0)
-            goto Error_Render;
+        // Any change drops back to the cheapest tier, and a still frame is
+        // raised one tier at a time, each once the last is on screen
+        if (options.refine)
+        {
+            RenderState unrefined = state;
+            unrefined.refine = submitted.refine;
+
+            if (moving || !RenderStateEqual(&unrefined, &submitted))
+            {
+                state.refine = 0;
+                still        = time;
+            }
+            else if (state.refine < REFINE_FULL
+                  && time - still >= refine_delay
+                  && frame
+                  && RenderStateEqual(&frame->state, &submitted))
+            {
+                state.refine = RefineNext(state.mode, state.flags, state.samples, state.refine);
+            }
+        }
 
-        if (delta < (1000 / 20))
-            SDL_Delay((1000 / 20) - delta);
+        if (!RenderStateEqual(&state, &submitted))
+        {
+            state.input_time = input_time;
+            RenderThreadSubmit(&renderer, &state);
+            submitted = state;
+        }
+
+        if (present)
+        {
+            if (RenderFramePresent(jobs, frame->surface, surface) != 0)
+                goto Error_Render;
+
+            if (SDL_UpdateWindowSurface(window) != 0)
+                goto Error_Render;
+
+            if (fresh)
+            {
+                const uint64_t delay = SDL_GetPerformanceCounter()
+                                     - frame->state.input_time;
+
+                latency.total += delay;
+                latency.max    = (delay > latency.max) ? delay : latency.max;
+                latency.frames++;
+            }
+        }
+
+        if (latency.frames && time - latency.reported >= frequency)
+        {
+            printf(
+                "latency: %.2f ms avg, %.2f ms max, %u frames\n",
+                (double)latency.total / (double)latency.frames
+                    * 1000.0 / (double)frequency,
+                (double)latency.max * 1000.0 / (double)frequency,
+                latency.frames
+            );
+
+            latency.total    = 0;
+            latency.max      = 0;
+            latency.frames   = 0;
+            latency.reported = time;
+        }
     }
 
 Error_Render:
 Error_Surface:
-Error_DepthBuffer:
-    SDL_FreeSurface(context.depth);
+    RenderThreadStop(&renderer);
 
+Error_Thread:
 Error_Window:
     SDL_DestroyWindow(window);
 
 Error_Init:
+    if (TraceClose(&trace))
+        status = EXIT_FAILURE;
+
     puts(SDL_GetError());
     SDL_ClearError();
 
+    SDL_FreeSurface(texture);
+
+    JobSystemDestroy(jobs);
+
     SDL_Quit();
 
-    if (context.mesh)
+    free(lights.data);
+
+    if (mesh)
     {
-        MeshFree(context.mesh);
-        free(context.mesh);
+        MeshFree(mesh);
+        free(mesh);
     }
 
-    return EXIT_SUCCESS;
+    return status;
 }
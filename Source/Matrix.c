@@ -81,7 +81,20 @@ MatrixMultv(
     SDL_assert(m);
     SDL_assert(v);
 
-    const Matrix vmat = VectorToMatrix(v);
-    const Matrix tmat = MatrixMult(m, &vmat);
-    return MatrixToVector(&tmat);
+    // Equivalent to MatrixToVector(MatrixMult(m, VectorToMatrix(v))), minus
+    // the twelve products against the zero columns of the vector matrix
+    float result[4];
+    for (size_t i = 0; i < 4; ++i)
+    {
+        result[i] = m->m[i][0] * v->x
+                  + m->m[i][1] * v->y
+                  + m->m[i][2] * v->z
+                  + m->m[i][3];
+    }
+
+    return (Vector){
+        .x = result[0] / result[3],
+        .y = result[1] / result[3],
+        .z = result[2] / result[3],
+    };
 }
@@ -18,48 +18,208 @@ typedef struct Vertices {
     size_t         size;
 } Vertices;
 
-typedef union Index {
-    struct { size_t v, t /* unimplemented */ , n; };
-    size_t vtn[3];
-} Index;
+typedef struct TexCoord {
+    float u, v;
+} TexCoord;
 
-typedef struct Face {
-    Index indices[3];
-} Face;
+typedef struct TexCoords {
+    TexCoord * const data;
+    size_t           size;
+} TexCoords;
 
+// Face corners are stored as separate index streams for each attribute,
+// three consecutive indices per face. Indices are 32 bits unless the mesh
+// has more vertices, normals or texture coordinates than that can address,
+// and attributes that a mesh doesn't have take no space.
 typedef struct Faces {
-    Face   * const data;
+    void   * const v;     // Vertex indices
+    void   * const n;     // Normal indices, NULL when matching the vertices
+    void   * const t;     // Texture coordinate indices, NULL without any
+    const  bool    wide;  // 64 bit indices
     size_t         size;
 } Faces;
 
+static inline size_t
+FacesIndex(
+    const Faces * const faces,
+    const void  * const stream,
+    const size_t        index)
+{
+    SDL_assert(faces);
+    SDL_assert(stream);
+    SDL_assert(index < SizeMult(faces->size, 3));
+
+    return (faces->wide)
+        ? (size_t)((const uint64_t *)stream)[index]
+        : (size_t)((const uint32_t *)stream)[index];
+}
+
+static inline void
+FacesSetIndex(
+          Faces * const faces,
+          void  * const stream,
+    const size_t        index,
+    const size_t        value)
+{
+    SDL_assert(faces);
+    SDL_assert(stream);
+    SDL_assert(index < SizeMult(faces->size, 3));
+
+    if (faces->wide)
+        ((uint64_t *)stream)[index] = (uint64_t)value;
+    else
+    {
+        SDL_assert(value <= UINT32_MAX);
+        ((uint32_t *)stream)[index] = (uint32_t)value;
+    }
+}
+
+static inline void
+FaceVertices(
+    const Faces  * const faces,
+    const size_t         face,
+          size_t         indices[3])
+{
+    SDL_assert(indices);
+
+    for (size_t j = 0; j < 3; ++j)
+        indices[j] = FacesIndex(faces, faces->v, face * 3 + j);
+}
+
+static inline void
+FaceTexCoords(
+    const Faces  * const faces,
+    const size_t         face,
+          size_t         indices[3])
+{
+    SDL_assert(indices);
+    SDL_assert(faces->t);
+
+    for (size_t j = 0; j < 3; ++j)
+        indices[j] = FacesIndex(faces, faces->t, face * 3 + j);
+}
+
+static inline void
+FaceNormals(
+    const Faces  * const faces,
+    const size_t         face,
+          size_t         indices[3])
+{
+    SDL_assert(indices);
+
+    const void * const stream = (faces->n) ? faces->n : faces->v;
+
+    for (size_t j = 0; j < 3; ++j)
+        indices[j] = FacesIndex(faces, stream, face * 3 + j);
+}
+
+typedef struct Edge {
+    size_t a, b;
+} Edge;
+
+typedef struct Edges {
+    Edge   * data;
+    size_t   size;
+} Edges;
+
+typedef struct Material {
+    char   name[64];
+    Vector diffuse;  // Kd, multiplied with the shading
+} Material;
+
+typedef struct Materials {
+    Material * data;
+    size_t     size;
+} Materials;
+
+// Faces [start, start + count) all use one material
+typedef struct MaterialRange {
+    size_t material;
+    size_t start;
+    size_t count;
+} MaterialRange;
+
+typedef struct MaterialRanges {
+    MaterialRange * data;
+    size_t          size;
+} MaterialRanges;
+
+// Directions that faces are sorted along, every combination of -1, 0 and 1 on
+// each axis besides zero
+#define FACE_ORDERS 26
+
+// Permutations of the faces sorted front to back as seen from each direction,
+// by the depth of their centers. Faces stay within their material ranges.
+typedef struct FaceOrders {
+    Vector     directions[FACE_ORDERS];  // Toward the viewer, normalized
+    uint32_t * data;  // FACE_ORDERS permutations, one after the other
+} FaceOrders;
+
 typedef struct Mesh {
-    Vertices vertices;
-    Vertices normals;
-    Faces    faces;
+    Vertices       vertices;
+    Vertices       normals;
+    TexCoords      texcoords;
+    Faces          faces;
+    Edges          edges;
+
+    // Faces are sorted by material, so that each range is drawn as one batch
+    Materials      materials;
+    MaterialRanges ranges;
+
+    // Not built for meshes with more faces than 32 bit indices can address
+    FaceOrders     orders;
 } Mesh;
 
+// Face normal indices are only stored when face_normals is set, otherwise
+// each vertex uses the normal with the same index. Texture coordinate
+// indices are only stored when there are texture coordinates.
 static inline bool
 MeshAlloc(
     Mesh * const mesh,
     const size_t verts,
     const size_t norms,
-    const size_t faces)
+    const size_t texcoords,
+    const size_t faces,
+    const bool   face_normals)
 {
     SDL_assert(mesh);
     SDL_assert(!mesh->vertices.data);
     SDL_assert(!mesh->normals.data);
-    SDL_assert(!mesh->faces.data);
+    SDL_assert(!mesh->faces.v);
+    SDL_assert(face_normals || norms == verts);
+
+    const bool   wide  = verts     > UINT32_MAX
+                      || norms     > UINT32_MAX
+                      || texcoords > UINT32_MAX;
+    const size_t width = (wide) ? sizeof(uint64_t) : sizeof(uint32_t);
+
+    const size_t stream_size = SizeMult(width, SizeMult(faces, 3));
 
     size_t pool_size = 0;
     pool_size = SizeAdd(pool_size, SizeMult(sizeof(Vector), verts));
     pool_size = SizeAdd(pool_size, SizeMult(sizeof(Vector), norms));
-    pool_size = SizeAdd(pool_size, SizeMult(sizeof(Face  ), faces));
+    pool_size = SizeAdd(pool_size, SizeMult(sizeof(TexCoord), texcoords));
+
+    // Vectors only guarantee 32 bit alignment
+    const size_t stream_offset = SizeAdd(pool_size, width - 1) & ~(width - 1);
+
+    pool_size = SizeAdd(stream_offset, stream_size);
+    pool_size = SizeAdd(pool_size, (face_normals) ? stream_size : 0);
+    pool_size = SizeAdd(pool_size, (texcoords)    ? stream_size : 0);
 
     Vector * mesh_arena = calloc(1, pool_size);
 
     if (!mesh_arena)
         return SDL_SetError("Unable to allocate mesh memory");
 
+    uint8_t * const streams = (uint8_t *)mesh_arena + stream_offset;
+    uint8_t *       stream  = streams + stream_size;
+
+    void * const normal_stream = (face_normals) ? stream : NULL;
+    stream += (face_normals) ? stream_size : 0;
+
+    void * const texcoord_stream = (texcoords) ? stream : NULL;
+
     SDL_memcpy(
         mesh,
         &(Mesh){
@@ -71,8 +231,15 @@ MeshAlloc(
                 .data = mesh_arena + verts,
                 .size = norms,
             },
+            .texcoords = (TexCoords){
+                .data = (TexCoord *)(mesh_arena + verts + norms),
+                .size = texcoords,
+            },
             .faces = (Faces){
-                .data = (Face*)(mesh_arena + verts + norms),
+                .v    = streams,
+                .n    = normal_stream,
+                .t    = texcoord_stream,
+                .wide = wide,
                 .size = faces,
             },
         },
@@ -89,67 +256,482 @@ MeshFree(
     SDL_assert(mesh);
     SDL_assert(mesh->vertices.data);
     SDL_assert(mesh->normals.data);
-    SDL_assert(mesh->faces.data);
+    SDL_assert(mesh->faces.v);
 
     SDL_assert(
         mesh->normals.data
      == mesh->vertices.data + mesh->vertices.size
     );
 
-    SDL_assert(
-        mesh->faces.data
-     == (Face*)(mesh->normals.data + mesh->normals.size)
-    );
-
+    free(mesh->edges.data);
+    free(mesh->materials.data);
+    free(mesh->ranges.data);
+    free(mesh->orders.data);
     free(mesh->vertices.data);
     memset(mesh, 0, sizeof(Mesh));
 }
 
-static inline void
-MeshCalcNorms(
-    Mesh * const mesh)
+// Bytes held by the arrays of a mesh, for budgeting how many stay loaded
+static inline size_t
+MeshMemory(
+    const Mesh * const mesh)
 {
     SDL_assert(mesh);
 
-    // Prerequisites set by LoadObj()
-    SDL_assert(mesh->vertices.size > 0);
-    SDL_assert(mesh->faces.size > 0);
-    SDL_assert(mesh->normals.size == mesh->vertices.size);
+    const size_t width  = (mesh->faces.wide) ? sizeof(uint64_t) : sizeof(uint32_t);
+    const size_t stream = SizeMult(width, SizeMult(mesh->faces.size, 3));
 
-    for (size_t i = 0; i < mesh->faces.size; i++)
+    size_t streams = 1;
+    streams += (mesh->faces.n) ? 1 : 0;
+    streams += (mesh->faces.t) ? 1 : 0;
+
+    size_t size = 0;
+    size = SizeAdd(size, SizeMult(sizeof(Vector),   mesh->vertices.size));
+    size = SizeAdd(size, SizeMult(sizeof(Vector),   mesh->normals.size));
+    size = SizeAdd(size, SizeMult(sizeof(TexCoord), mesh->texcoords.size));
+    size = SizeAdd(size, SizeMult(stream, streams));
+    size = SizeAdd(size, SizeMult(sizeof(Edge),          mesh->edges.size));
+    size = SizeAdd(size, SizeMult(sizeof(Material),      mesh->materials.size));
+    size = SizeAdd(size, SizeMult(sizeof(MaterialRange), mesh->ranges.size));
+
+    if (mesh->orders.data)
+        size = SizeAdd(size, SizeMult(sizeof(uint32_t), SizeMult(mesh->faces.size, FACE_ORDERS)));
+
+    return size;
+}
+
+// Stable sorts the faces by material, given the material of each face, and
+// records the range of each material used
+static inline int
+MeshSortFaces(
+          Mesh     * const mesh,
+    const uint32_t * const face_materials)
+{
+    SDL_assert(mesh);
+    SDL_assert(face_materials);
+    SDL_assert(mesh->materials.size > 0);
+    SDL_assert(!mesh->ranges.data);
+
+    Faces * const faces = &mesh->faces;
+
+    const size_t materials = mesh->materials.size;
+    const size_t width     = (faces->wide) ? sizeof(uint64_t) : sizeof(uint32_t);
+    const size_t corner    = width * 3;
+
+    size_t * const offsets = calloc(materials, sizeof(size_t));
+    void   * const sorted  = malloc(SizeMult(corner, SDL_max(faces->size, (size_t)1)));
+
+    if (!offsets || !sorted)
     {
-        const Vector * verts[3];
-        for (size_t j = 0; j < 3; ++j)
+        free(offsets);
+        free(sorted);
+        return SDL_SetError("Unable to allocate material sorting memory");
+    }
+
+    for (size_t i = 0; i < faces->size; ++i)
+    {
+        SDL_assert(face_materials[i] < materials);
+        offsets[face_materials[i]]++;
+    }
+
+    size_t used = 0;
+    for (size_t m = 0; m < materials; ++m)
+        used += (offsets[m] > 0);
+
+    mesh->ranges.data = malloc(SizeMult(sizeof(MaterialRange), SDL_max(used, (size_t)1)));
+
+    if (!mesh->ranges.data)
+    {
+        free(offsets);
+        free(sorted);
+        return SDL_SetError("Unable to allocate material ranges");
+    }
+
+    // Counts become the first face of each material
+    size_t start = 0;
+    mesh->ranges.size = 0;
+
+    for (size_t m = 0; m < materials; ++m)
+    {
+        const size_t count = offsets[m];
+
+        if (count)
+        {
+            mesh->ranges.data[mesh->ranges.size++] = (MaterialRange){
+                .material = m,
+                .start    = start,
+                .count    = count,
+            };
+        }
+
+        offsets[m] = start;
+        start += count;
+    }
+
+    // Most meshes are a single range and already in order
+    if (mesh->ranges.size > 1)
+    {
+        void * const streams[] = {faces->v, faces->n, faces->t};
+
+        for (size_t s = 0; s < SDL_arraysize(streams); ++s)
         {
-            Index * const index = &mesh->faces.data[i].indices[j];
-            verts[j] = &mesh->vertices.data[index->v];
-            index->n = index->v;
+            if (!streams[s])
+                continue;
+
+            for (size_t m = 0; m < materials; ++m)
+                offsets[m] = 0;
+
+            for (size_t r = 0; r < mesh->ranges.size; ++r)
+                offsets[mesh->ranges.data[r].material] = mesh->ranges.data[r].start;
+
+            for (size_t i = 0; i < faces->size; ++i)
+            {
+                memcpy(
+                    (uint8_t *)sorted + offsets[face_materials[i]]++ * corner,
+                    (const uint8_t *)streams[s] + i * corner,
+                    corner
+                );
+            }
+
+            memcpy(streams[s], sorted, faces->size * corner);
         }
+    }
+
+    free(offsets);
+    free(sorted);
+
+    return 0;
+}
+
+typedef struct NormalsJob {
+    Mesh   * mesh;
+    Vector * face_normals;
+} NormalsJob;
+
+static void
+FaceNormalsJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    NormalsJob * const job  = data;
+    const Mesh * const mesh = job->mesh;
+
+    (void)worker;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        size_t indices[3];
+        FaceVertices(&mesh->faces, i, indices);
+
+        const Vector * verts[3];
+        for (size_t j = 0; j < 3; ++j)
+            verts[j] = &mesh->vertices.data[indices[j]];
 
         const Vector side[2] = {
             VectorSub(verts[1], verts[0]),
             VectorSub(verts[2], verts[0]),
         };
 
-        const Vector normal = VectorCross(&side[0], &side[1]);
+        job->face_normals[i] = VectorCross(&side[0], &side[1]);
+    }
+}
+
+static void
+NormalizeJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    NormalsJob * const job  = data;
+    Mesh       * const mesh = job->mesh;
+
+    (void)worker;
+
+    // Vertices without any faces are left zero
+    for (size_t i = begin; i < end; ++i)
+    {
+        const Vector * const normal = &mesh->normals.data[i];
+
+        if (normal->x != 0.0f || normal->y != 0.0f || normal->z != 0.0f)
+            mesh->normals.data[i] = VectorNormalize(normal);
+    }
+}
+
+// Face normals and the final normalization run in parallel. The sums in
+// between stay in face order, so the result doesn't depend on the threads.
+static inline int
+MeshCalcNorms(
+    Mesh      * const mesh,
+    JobSystem * const jobs)
+{
+    SDL_assert(mesh);
+
+    // Prerequisites set by LoadObj()
+    SDL_assert(mesh->vertices.size > 0);
+    SDL_assert(mesh->faces.size > 0);
+    SDL_assert(mesh->normals.size == mesh->vertices.size);
+    SDL_assert(!mesh->faces.n);
+
+    NormalsJob job = {
+        .mesh         = mesh,
+        .face_normals = malloc(SizeMult(sizeof(Vector), mesh->faces.size)),
+    };
+
+    if (!job.face_normals)
+        return SDL_SetError("Unable to allocate face normals");
+
+    JobParallelFor(jobs, mesh->faces.size, 4096, FaceNormalsJob, &job);
+
+    // Normals share the vertex indices
+    for (size_t i = 0; i < mesh->faces.size; i++)
+    {
+        size_t indices[3];
+        FaceVertices(&mesh->faces, i, indices);
 
         for (size_t j = 0; j < 3; ++j)
         {
-            Index * const index = &mesh->faces.data[i].indices[j];
-            mesh->normals.data[index->n] = VectorAdd(
-                &mesh->normals.data[index->n], &normal
+            mesh->normals.data[indices[j]] = VectorAdd(
+                &mesh->normals.data[indices[j]], &job.face_normals[i]
             );
         }
     }
 
+    JobParallelFor(jobs, mesh->normals.size, 4096, NormalizeJob, &job);
+
+    free(job.face_normals);
+    return 0;
+}
+
+static int
+EdgeCompare(
+    const void * const a,
+    const void * const b)
+{
+    const Edge * const edge_a = a;
+    const Edge * const edge_b = b;
+
+    if (edge_a->a != edge_b->a)
+        return (edge_a->a < edge_b->a) ? -1 : 1;
+
+    if (edge_a->b != edge_b->b)
+        return (edge_a->b < edge_b->b) ? -1 : 1;
+
+    return 0;
+}
+
+static inline int
+MeshCalcEdges(
+    Mesh * const mesh)
+{
+    SDL_assert(mesh);
+    SDL_assert(!mesh->edges.data);
+    SDL_assert(mesh->faces.size > 0);
+
+    Edge * const edges = malloc(SizeMult(sizeof(Edge), SizeMult(mesh->faces.size, 3)));
+
+    if (!edges)
+        return SDL_SetError("Unable to allocate edge memory");
+
+    // Store every face edge with its lowest vertex index first so that the
+    // shared edge of two neighbouring faces compares equal
+    size_t count = 0;
     for (size_t i = 0; i < mesh->faces.size; ++i)
     {
+        size_t indices[3];
+        FaceVertices(&mesh->faces, i, indices);
+
         for (size_t j = 0; j < 3; ++j)
         {
-            Index * const index = &mesh->faces.data[i].indices[j];
-            mesh->normals.data[index->n] = VectorNormalize(
-                &mesh->normals.data[index->n]
-            );
+            const size_t a = indices[j];
+            const size_t b = indices[(j + 1) % 3];
+
+            if (a == b)
+                continue;
+
+            edges[count++] = (a < b) ? (Edge){a, b} : (Edge){b, a};
         }
     }
+
+    qsort(edges, count, sizeof(Edge), EdgeCompare);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; ++i)
+        if (!unique || EdgeCompare(&edges[unique - 1], &edges[i]))
+            edges[unique++] = edges[i];
+
+    // Shrinking can't fail in practice, but keep the larger block if it does
+    Edge * const shrunk = realloc(edges, SizeMult(sizeof(Edge), unique ? unique : 1));
+
+    mesh->edges.data = shrunk ? shrunk : edges;
+    mesh->edges.size = unique;
+
+    return 0;
+}
+
+typedef struct FaceDepth {
+    float    depth;
+    uint32_t face;
+} FaceDepth;
+
+static int
+FaceDepthCompare(
+    const void * const a,
+    const void * const b)
+{
+    const FaceDepth * const face_a = a;
+    const FaceDepth * const face_b = b;
+
+    // Nearest first, then in mesh order
+    if (face_a->depth != face_b->depth)
+        return (face_a->depth > face_b->depth) ? -1 : 1;
+
+    return (face_a->face < face_b->face) ? -1 : (face_a->face > face_b->face);
+}
+
+typedef struct OrdersJob {
+    Mesh         * mesh;
+    SDL_atomic_t   failed;
+} OrdersJob;
+
+static void
+FaceOrdersJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    OrdersJob  * const job  = data;
+    Mesh       * const mesh = job->mesh;
+
+    (void)worker;
+
+    FaceDepth * const depths = malloc(SizeMult(sizeof(FaceDepth), mesh->faces.size));
+
+    if (!depths)
+    {
+        SDL_AtomicSet(&job->failed, 1);
+        return;
+    }
+
+    for (size_t o = begin; o < end; ++o)
+    {
+        const Vector * const direction = &mesh->orders.directions[o];
+
+        // Sums of the corners rather than centers, which sort the same
+        for (size_t i = 0; i < mesh->faces.size; ++i)
+        {
+            size_t indices[3];
+            FaceVertices(&mesh->faces, i, indices);
+
+            Vector center = mesh->vertices.data[indices[0]];
+            center = VectorAdd(&center, &mesh->vertices.data[indices[1]]);
+            center = VectorAdd(&center, &mesh->vertices.data[indices[2]]);
+
+            depths[i] = (FaceDepth){
+                .depth = VectorDot(&center, direction),
+                .face  = (uint32_t)i,
+            };
+        }
+
+        uint32_t * const order = &mesh->orders.data[o * mesh->faces.size];
+
+        for (size_t r = 0; r < mesh->ranges.size; ++r)
+        {
+            const MaterialRange * const range = &mesh->ranges.data[r];
+
+            qsort(&depths[range->start], range->count, sizeof(FaceDepth), FaceDepthCompare);
+
+            for (size_t i = range->start; i < range->start + range->count; ++i)
+                order[i] = depths[i].face;
+        }
+    }
+
+    free(depths);
+}
+
+// Sorts the faces along every direction in parallel, so that each frame can
+// draw them roughly front to back and reject hidden pixels before shading
+static inline int
+MeshCalcOrders(
+    Mesh      * const mesh,
+    JobSystem * const jobs)
+{
+    SDL_assert(mesh);
+    SDL_assert(!mesh->orders.data);
+    SDL_assert(mesh->faces.size > 0);
+    SDL_assert(mesh->ranges.size > 0);
+
+    if (mesh->faces.size > UINT32_MAX)
+        return 0;
+
+    size_t count = 0;
+    for (int z = -1; z <= 1; ++z)
+    {
+        for (int y = -1; y <= 1; ++y)
+        {
+            for (int x = -1; x <= 1; ++x)
+            {
+                if (!x && !y && !z)
+                    continue;
+
+                const Vector direction = {{(float)x, (float)y, (float)z}};
+                mesh->orders.directions[count++] = VectorNormalize(&direction);
+            }
+        }
+    }
+
+    SDL_assert(count == FACE_ORDERS);
+
+    mesh->orders.data = malloc(
+        SizeMult(sizeof(uint32_t), SizeMult(mesh->faces.size, FACE_ORDERS))
+    );
+
+    if (!mesh->orders.data)
+        return SDL_SetError("Unable to allocate face orders");
+
+    OrdersJob job = {.mesh = mesh};
+
+    JobParallelFor(jobs, FACE_ORDERS, 1, FaceOrdersJob, &job);
+
+    if (SDL_AtomicGet(&job.failed))
+    {
+        free(mesh->orders.data);
+        mesh->orders.data = NULL;
+        return SDL_SetError("Unable to allocate face sorting memory");
+    }
+
+    return 0;
+}
+
+// Order to draw the faces in when viewed from a direction, the one sorted
+// along the nearest direction
+static inline const uint32_t *
+MeshFaceOrder(
+    const Mesh   * const mesh,
+    const Vector * const view)
+{
+    SDL_assert(mesh);
+    SDL_assert(view);
+
+    if (!mesh->orders.data)
+        return NULL;
+
+    size_t nearest = 0;
+    float  best    = -INFINITY;
+
+    for (size_t i = 0; i < FACE_ORDERS; ++i)
+    {
+        const float dot = VectorDot(&mesh->orders.directions[i], view);
+
+        if (dot > best)
+        {
+            best    = dot;
+            nearest = i;
+        }
+    }
+
+    return &mesh->orders.data[nearest * mesh->faces.size];
 }
@@ -0,0 +1,824 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Micro-benchmarks of the math, raster and parsing kernels. Inputs are
+// captured from rendering the sample meshes from several views, so each
+// kernel sees the same distribution of values as it does in a real frame.
+
+// POSIX directories and syscall() for the performance counters and thread
+// pinning
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+#endif
+
+#include <SDL2/SDL.h>
+
+#include "Utils.c"
+#include "Arena.c"
+#include "PerfCounters.c"
+#include "Jobs.c"
+#include "Vector.c"
+#include "Matrix.c"
+#include "Quaternion.c"
+#include "Mesh.c"
+#include "Wavefront.c"
+#include "Lighting.c"
+#include "Shadow.c"
+#include "Texture.c"
+#include "Temporal.c"
+#include "Render.c"
+#include "Render/Wireframe.c"
+#include "Render/Flat.c"
+#include "Render/Gouraud.c"
+#include "Render/Phong.c"
+#include "Render/Toon.c"
+#include "Output.c"
+#include "Options.c"
+#include "BenchmarkUtils.c"
+
+#define CAPTURE_VIEWS       8
+#define POINTS_PER_TRIANGLE 4
+
+typedef struct MicroOptions {
+    bool         help;
+    int          width;
+    int          height;
+    int          samples;
+    int          warmup;
+    int          repetitions;
+    const char * filter;
+    const char * resources;
+
+    const char * const * files;
+    size_t               file_count;
+} MicroOptions;
+
+typedef struct TriangleVerts {
+    Vector verts[3];
+} TriangleVerts;
+
+typedef struct Line {
+    Vector start;
+    Vector end;
+} Line;
+
+typedef struct Array {
+    void   * data;
+    size_t   size;
+    size_t   capacity;
+} Array;
+
+// Captured kernel inputs, pooled over every mesh and view
+typedef struct Inputs {
+    RenderContext context;
+
+    Array matrices;   // Matrix, frame transforms
+    Array vertices;   // Vector, model space
+    Array normals;    // Vector, unnormalized face normals
+    Array triangles;  // TriangleVerts, visible in screen space
+    Array setups;     // Triangle, one per triangle
+    Array points;     // Vector, screen space points inside each triangle
+    Array lines;      // Line, screen space edges
+    Array vert_lines; // char *, text following "v"
+    Array face_lines; // char *, text following "f"
+    Array sources;    // char *, OBJ sources the lines point into
+} Inputs;
+
+typedef struct Kernel {
+    const char * name;
+    size_t     (*run)(Inputs * const);  // Returns the number of operations
+    bool         clears;                // Depth and target reset each run
+} Kernel;
+
+// Results are accumulated here so that the kernels can't be optimized out
+static volatile float sink;
+
+static inline int
+ArrayPush(
+          Array  * const array,
+    const void   * const value,
+    const size_t         size)
+{
+    SDL_assert(array);
+    SDL_assert(value);
+
+    if (array->size == array->capacity)
+    {
+        const size_t capacity = (array->capacity) ? SizeMult(array->capacity, 2) : 256;
+
+        void * const data = realloc(array->data, SizeMult(size, capacity));
+
+        if (!data)
+            return SDL_SetError("Unable to allocate inputs");
+
+        array->data     = data;
+        array->capacity = capacity;
+    }
+
+    memcpy((uint8_t*)array->data + array->size * size, value, size);
+    array->size++;
+    return 0;
+}
+
+#define ARRAY_AT(array, type, i) (((type*)(array).data)[i])
+
+static size_t
+KernelMatrixMult(
+    Inputs * const inputs)
+{
+    const size_t count = inputs->matrices.size;
+
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Matrix result = MatrixMult(
+            &ARRAY_AT(inputs->matrices, Matrix, i),
+            &ARRAY_AT(inputs->matrices, Matrix, (i + 1) % count)
+        );
+
+        sum += result.m[3][3];
+    }
+
+    sink = sum;
+    return count;
+}
+
+static size_t
+KernelMatrixMultv(
+    Inputs * const inputs)
+{
+    const Matrix * const matrix = &ARRAY_AT(inputs->matrices, Matrix, 0);
+
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->vertices.size; ++i)
+    {
+        const Vector result = MatrixMultv(matrix, &ARRAY_AT(inputs->vertices, Vector, i));
+        sum += result.z;
+    }
+
+    sink = sum;
+    return inputs->vertices.size;
+}
+
+static size_t
+KernelVectorNormalize(
+    Inputs * const inputs)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->normals.size; ++i)
+    {
+        const Vector result = VectorNormalize(&ARRAY_AT(inputs->normals, Vector, i));
+        sum += result.x;
+    }
+
+    sink = sum;
+    return inputs->normals.size;
+}
+
+static size_t
+KernelBarycenter(
+    Inputs * const inputs)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->points.size; ++i)
+    {
+        const TriangleVerts * const tri = &ARRAY_AT(
+            inputs->triangles, TriangleVerts, i / POINTS_PER_TRIANGLE
+        );
+
+        const Vector result = Barycenter(tri->verts, &ARRAY_AT(inputs->points, Vector, i));
+        sum += result.x;
+    }
+
+    sink = sum;
+    return inputs->points.size;
+}
+
+static size_t
+KernelTriBoundingBox(
+    Inputs * const inputs)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->triangles.size; ++i)
+    {
+        const SDL_FRect result = TriBoundingBox(ARRAY_AT(inputs->triangles, TriangleVerts, i).verts);
+        sum += result.w;
+    }
+
+    sink = sum;
+    return inputs->triangles.size;
+}
+
+static size_t
+KernelTriangleSetup(
+    Inputs * const inputs)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->triangles.size; ++i)
+    {
+        Triangle tri;
+        if (TriangleSetup(&inputs->context, &tri, ARRAY_AT(inputs->triangles, TriangleVerts, i).verts))
+            sum += tri.depth.z;
+    }
+
+    sink = sum;
+    return inputs->triangles.size;
+}
+
+static size_t
+KernelTestSamples(
+    Inputs * const inputs)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->points.size; ++i)
+    {
+        const Vector * const point = &ARRAY_AT(inputs->points, Vector, i);
+
+        Vector coord = {.x = 0.0f};
+        const unsigned mask = TestSamples(
+            &inputs->context,
+            &ARRAY_AT(inputs->setups, Triangle, i / POINTS_PER_TRIANGLE),
+            (int)point->x, (int)point->y,
+            &coord
+        );
+
+        sum += (float)mask + coord.x;
+    }
+
+    sink = sum;
+    return inputs->points.size;
+}
+
+static size_t
+KernelTestDepth(
+    Inputs * const inputs)
+{
+    size_t passed = 0;
+    for (size_t i = 0; i < inputs->points.size; ++i)
+        passed += TestDepth(&inputs->context, &ARRAY_AT(inputs->points, Vector, i));
+
+    sink = (float)passed;
+    return inputs->points.size;
+}
+
+static size_t
+KernelPutFragment(
+    Inputs * const inputs)
+{
+    for (size_t i = 0; i < inputs->points.size; ++i)
+    {
+        const Vector * const point = &ARRAY_AT(inputs->points, Vector, i);
+
+        const uint8_t shade = (uint8_t)(point->z);
+        PutFragment(&inputs->context, point, &(SDL_Color){shade, shade, shade, 255});
+    }
+
+    return inputs->points.size;
+}
+
+static size_t
+KernelDrawLine(
+    Inputs * const inputs)
+{
+    const uint32_t color = SDL_MapRGBA(inputs->context.target->format, 255, 255, 255, 255);
+
+    for (size_t i = 0; i < inputs->lines.size; ++i)
+    {
+        const Line * const line = &ARRAY_AT(inputs->lines, Line, i);
+        DrawLine(&inputs->context, &line->start, &line->end, color);
+    }
+
+    return inputs->lines.size;
+}
+
+static size_t
+KernelObjParseVertex(
+    Inputs * const inputs)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < inputs->vert_lines.size; ++i)
+    {
+        Vector result = {.x = 0.0f};
+        ObjParseVertex(ARRAY_AT(inputs->vert_lines, char *, i), &result);
+        sum += result.x;
+    }
+
+    sink = sum;
+    return inputs->vert_lines.size;
+}
+
+static size_t
+KernelObjParseFace(
+    Inputs * const inputs)
+{
+    size_t sum = 0;
+    for (size_t i = 0; i < inputs->face_lines.size; ++i)
+    {
+        ObjFace result = {{{{0}}}};
+        ObjParseFace(ARRAY_AT(inputs->face_lines, char *, i), &result);
+        sum += result.indices[2].v;
+    }
+
+    sink = (float)sum;
+    return inputs->face_lines.size;
+}
+
+static const Kernel KERNELS[] = {
+    {"MatrixMult",      KernelMatrixMult,      false},
+    {"MatrixMultv",     KernelMatrixMultv,     false},
+    {"VectorNormalize", KernelVectorNormalize, false},
+    {"Barycenter",      KernelBarycenter,      false},
+    {"TriBoundingBox",  KernelTriBoundingBox,  false},
+    {"TriangleSetup",   KernelTriangleSetup,   false},
+    {"TestSamples",     KernelTestSamples,     true},
+    {"TestDepth",       KernelTestDepth,       true},
+    {"PutFragment",     KernelPutFragment,     true},
+    {"DrawLine",        KernelDrawLine,        true},
+    {"ObjParseVertex",  KernelObjParseVertex,  false},
+    {"ObjParseFace",    KernelObjParseFace,    false},
+};
+
+static void
+PrintMicroUsage(void)
+{
+    printf(
+        "Usage: QuickRenderMicroBenchmark [options] [<file>...]\n"
+        "\n"
+        "Times each kernel over inputs captured from rendering each file,\n"
+        "or every .obj in the resources directory.\n"
+        "\n"
+        "Options:\n"
+        "  --help                    Show this message\n"
+        "  --size <w>x<h>            Frame size inputs are captured at\n"
+        "                            (default 800x600)\n"
+        "  --samples <1|2|4>         Samples per pixel\n"
+        "  --warmup <n>              Untimed runs per kernel (default 5)\n"
+        "  --repetitions <n>         Timed runs per kernel (default 31)\n"
+        "  --filter <name>           Only run kernels containing name\n"
+        "  --resources <dir>         Meshes used when no files are given\n"
+        "                            (default Resources)\n"
+    );
+}
+
+static inline int
+ParseMicroOptions(
+    const int            argc,
+    const char * const * argv,
+          MicroOptions * options)
+{
+    SDL_assert(argv);
+    SDL_assert(options);
+
+    *options = (MicroOptions){
+        .width       = 800,
+        .height      = 600,
+        .samples     = 1,
+        .warmup      = 5,
+        .repetitions = 31,
+        .resources   = "Resources",
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char * const arg   = argv[i];
+        const char * const value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        // Files are the trailing arguments
+        if (strncmp(arg, "--", 2))
+        {
+            options->files      = &argv[i];
+            options->file_count = (size_t)(argc - i);
+            break;
+        }
+
+        if (!strcmp(arg, "--help"))
+        {
+            options->help = true;
+            return 0;
+        }
+
+        if (!value)
+            return SDL_SetError("Missing value for %s", arg);
+
+        i++;
+
+        if (!strcmp(arg, "--size"))
+        {
+            if (ParseSize(value, &options->width, &options->height))
+                return -1;
+        }
+        else if (!strcmp(arg, "--samples"))
+        {
+            if (ParseInt(value, 1, 4, &options->samples))
+                return -1;
+
+            if (options->samples == 3)
+                return SDL_SetError("Samples must be 1, 2 or 4");
+        }
+        else if (!strcmp(arg, "--warmup"))
+        {
+            if (ParseInt(value, 0, 1000000, &options->warmup))
+                return -1;
+        }
+        else if (!strcmp(arg, "--repetitions"))
+        {
+            if (ParseInt(value, 1, 1000000, &options->repetitions))
+                return -1;
+        }
+        else if (!strcmp(arg, "--filter"))
+        {
+            options->filter = value;
+        }
+        else if (!strcmp(arg, "--resources"))
+        {
+            options->resources = value;
+        }
+        else
+        {
+            return SDL_SetError("Unknown option %s", arg);
+        }
+    }
+
+    return 0;
+}
+
+// Keeps the source alive so that the parser inputs can point into it
+static inline int
+CaptureLines(
+          Inputs * const inputs,
+    const char   * const file)
+{
+    SDL_assert(inputs);
+    SDL_assert(file);
+
+    const File source = LoadFile(file);
+
+    if (!source.data)
+        return SDL_SetError("Unable to read %s", file);
+
+    if (ArrayPush(&inputs->sources, &source.data, sizeof(char *)))
+    {
+        free(source.data);
+        return -1;
+    }
+
+    char * ptr = source.data;
+    while (ptr < source.data + source.size)
+    {
+        char * const newline = memchr(ptr, '\n', (size_t)(source.data + source.size - ptr));
+
+        if (newline)
+            *newline = '\0';
+
+        char * const line = ptr + strspn(ptr, " \r");
+        ptr = (newline) ? newline + 1 : source.data + source.size;
+
+        if (line[0] == 'v' && line[1] == ' ')
+        {
+            char * const text = line + 1;
+            if (ArrayPush(&inputs->vert_lines, &text, sizeof(char *)))
+                return -1;
+        }
+        else if (line[0] == 'f' && line[1] == ' ')
+        {
+            char * const text = line + 1;
+            if (ArrayPush(&inputs->face_lines, &text, sizeof(char *)))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Renders the mesh from several views, keeping what each kernel would have
+// been given along the way
+static inline int
+CaptureMesh(
+          Inputs * const inputs,
+    const Mesh   * const mesh)
+{
+    SDL_assert(inputs);
+    SDL_assert(mesh);
+
+    RenderContext * const context = &inputs->context;
+
+    context->mesh = mesh;
+
+    for (size_t i = 0; i < mesh->vertices.size; ++i)
+    {
+        Vector vert = mesh->vertices.data[i];
+               vert.y *= -1.0f;
+
+        if (ArrayPush(&inputs->vertices, &vert, sizeof(Vector)))
+            return -1;
+    }
+
+    for (size_t view = 0; view < CAPTURE_VIEWS; ++view)
+    {
+        context->rotation = AnglesToRotation(&(Angles){
+            .yaw   = 360.0f * (float)view / CAPTURE_VIEWS,
+            .pitch = 15.0f,
+        });
+
+        // Leaves the projected vertices and eye of this view in the context
+        if (Render(context) != 0)
+            return -1;
+
+        Camera camera;
+        const Matrix mvpm = FrameTransform(context, &camera);
+
+        if (ArrayPush(&inputs->matrices, &mvpm, sizeof(Matrix)))
+            return -1;
+
+        for (size_t i = 0; i < mesh->faces.size; ++i)
+        {
+            size_t vertex_index[3];
+            FaceVertices(&mesh->faces, i, vertex_index);
+
+            Vector verts[3];
+            for (size_t j = 0; j < 3; ++j)
+            {
+                verts[j] = mesh->vertices.data[vertex_index[j]];
+                verts[j].y *= -1.0f;
+            }
+
+            const Vector side[2] = {
+                VectorSub(&verts[2], &verts[0]),
+                VectorSub(&verts[1], &verts[0]),
+            };
+
+            const Vector normal = VectorCross(&side[0], &side[1]);
+
+            if (view == 0)
+                if (ArrayPush(&inputs->normals, &normal, sizeof(Vector)))
+                    return -1;
+
+            if (!TestBackface(context, verts))
+                continue;
+
+            for (size_t j = 0; j < 3; ++j)
+                verts[j] = context->projected[vertex_index[j]];
+
+            Triangle tri;
+            if (!TriangleSetup(context, &tri, verts))
+                continue;
+
+            if (ArrayPush(&inputs->triangles, verts, sizeof(TriangleVerts))
+             || ArrayPush(&inputs->setups, &tri, sizeof(Triangle)))
+                return -1;
+
+            // Fixed spread of barycentric weights, clamped to the pixels
+            // the rasterizer would visit
+            static const Vector weights[POINTS_PER_TRIANGLE] = {
+                {{1.0f / 3.0f, 1.0f / 3.0f, 1.0f / 3.0f}},
+                {{0.6f, 0.2f, 0.2f}},
+                {{0.2f, 0.6f, 0.2f}},
+                {{0.2f, 0.2f, 0.6f}},
+            };
+
+            for (size_t j = 0; j < POINTS_PER_TRIANGLE; ++j)
+            {
+                Vector point = {.x = 0.0f};
+                for (size_t k = 0; k < 3; ++k)
+                {
+                    const Vector weighted = VectorMultf(&verts[k], weights[j].xyz[k]);
+                    point = VectorAdd(&point, &weighted);
+                }
+
+                point.x = SDL_clamp(point.x, (float)tri.bounds.x, (float)(tri.bounds.x + tri.bounds.w - 1));
+                point.y = SDL_clamp(point.y, (float)tri.bounds.y, (float)(tri.bounds.y + tri.bounds.h - 1));
+
+                if (ArrayPush(&inputs->points, &point, sizeof(Vector)))
+                    return -1;
+            }
+        }
+
+        for (size_t i = 0; i < mesh->edges.size; ++i)
+        {
+            const Line line = {
+                context->projected[mesh->edges.data[i].a],
+                context->projected[mesh->edges.data[i].b],
+            };
+
+            if (ArrayPush(&inputs->lines, &line, sizeof(Line)))
+                return -1;
+        }
+    }
+
+    context->mesh = NULL;
+    return 0;
+}
+
+static inline void
+InputsFree(
+    Inputs * const inputs)
+{
+    SDL_assert(inputs);
+
+    for (size_t i = 0; i < inputs->sources.size; ++i)
+        free(ARRAY_AT(inputs->sources, char *, i));
+
+    Array * const arrays[] = {
+        &inputs->matrices, &inputs->vertices,   &inputs->normals,
+        &inputs->triangles, &inputs->setups,    &inputs->points,
+        &inputs->lines,    &inputs->vert_lines, &inputs->face_lines,
+        &inputs->sources,
+    };
+
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i)
+        free(arrays[i]->data);
+
+    SDL_FreeSurface(inputs->context.target);
+    inputs->context.target = NULL;
+    RenderContextFree(&inputs->context);
+}
+
+static inline int
+RunKernel(
+    const MicroOptions * const options,
+    const Kernel       * const kernel,
+          Inputs       * const inputs,
+          uint64_t     * const times)
+{
+    SDL_assert(options);
+    SDL_assert(kernel);
+    SDL_assert(inputs);
+    SDL_assert(times);
+
+    size_t ops = 0;
+
+    for (int i = -options->warmup; i < options->repetitions; ++i)
+    {
+        if (kernel->clears)
+        {
+            SDL_FillRect(inputs->context.depth,  NULL, 0);
+            SDL_FillRect(inputs->context.target, NULL, 0);
+        }
+
+        const uint64_t start = GetTimeNs();
+
+        ops = kernel->run(inputs);
+
+        const uint64_t end = GetTimeNs();
+
+        if (i >= 0)
+            times[i] = end - start;
+    }
+
+    if (!ops)
+    {
+        printf("%-16s %10s\n", kernel->name, "no inputs");
+        return 0;
+    }
+
+    // The median is the p50 of an odd number of runs
+    const Percentiles percentiles = GetPercentiles(times, (size_t)options->repetitions);
+
+    printf(
+        "%-16s %10zu %12.2f %12.2f\n",
+        kernel->name, ops,
+        (double)times[0] / (double)ops,
+        (double)percentiles.p50 / (double)ops
+    );
+
+    return 0;
+}
+
+int
+main(
+    int    argc,
+    char * argv[])
+{
+    MicroOptions options;
+    if (ParseMicroOptions(argc, (const char * const *)argv, &options))
+    {
+        printf("%s\n\n", SDL_GetError());
+        PrintMicroUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (options.help)
+    {
+        PrintMicroUsage();
+        return EXIT_SUCCESS;
+    }
+
+    int status = EXIT_FAILURE;
+
+    char   ** found       = NULL;
+    size_t    found_count = 0;
+
+    const char * const * files      = options.files;
+    size_t               file_count = options.file_count;
+
+    uint64_t * const times = malloc(SizeMult(sizeof(uint64_t), (size_t)options.repetitions));
+
+    // Same camera and light as the viewer, flat shading only serves to
+    // produce the buffers and projected vertices
+    Inputs inputs = {
+        .context = {
+            .samples = options.samples,
+            .mode    = RENDER_FLAT,
+            .camera  = {
+                .pos   = (Vector){.z = 300.0f},
+                .focus = (Vector){.x =   -2.0f, .y = -4.0f},
+                .up    = (Vector){.y =   1.0f},
+                .right = (Vector){.x =   1.0f},
+            },
+            .light = VectorNormalize(&(Vector){.x = 4.0f, .y = 4.0f, .z = 3.0f}),
+        },
+    };
+
+    if (!times)
+    {
+        SDL_SetError("Unable to allocate times");
+        goto Error;
+    }
+
+    if (!file_count)
+    {
+        if (FindMeshes(options.resources, &found, &found_count))
+            goto Error;
+
+        files      = (const char * const *)found;
+        file_count = found_count;
+    }
+
+    inputs.context.target = SDL_CreateRGBSurfaceWithFormat(
+        0 /* flags */,
+        options.width, options.height,
+        32, SDL_PIXELFORMAT_RGBA32
+    );
+
+    if (!inputs.context.target)
+        goto Error;
+
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        Mesh * const mesh = LoadObj(files[i], NULL, true);
+
+        if (!mesh)
+        {
+            SDL_SetError("%s: %s", files[i], SDL_GetError());
+            goto Error;
+        }
+
+        const int result = CaptureMesh(&inputs, mesh) || CaptureLines(&inputs, files[i]);
+
+        MeshFree(mesh);
+        free(mesh);
+
+        if (result)
+            goto Error;
+    }
+
+    printf(
+        "\n%-16s %10s %12s %12s\n",
+        "kernel", "ops", "min ns/op", "median ns/op"
+    );
+
+    for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); ++i)
+    {
+        if (options.filter && !strstr(KERNELS[i].name, options.filter))
+            continue;
+
+        if (RunKernel(&options, &KERNELS[i], &inputs, times))
+            goto Error;
+    }
+
+    status = EXIT_SUCCESS;
+
+Error:
+    if (status != EXIT_SUCCESS)
+        puts(SDL_GetError());
+
+    InputsFree(&inputs);
+    FreeFileList(found, found_count);
+    free(times);
+
+    return status;
+}
@@ -0,0 +1,551 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+typedef struct Options {
+    const char * file;
+    bool         help;
+
+    bool         headless;
+    int          width;
+    int          height;
+    int          samples;
+    RenderMode   mode;
+    int          flags;
+    int          budget;  // Milliseconds per moving frame, zero to disable
+    bool         refine;  // Draw cheaper frames while moving, refine when still
+    int          lights;  // Point and spot lights scattered around the mesh
+    const char * texture;
+    int          threads;  // Zero for one per core
+    bool         pin;      // Pin worker threads to cores
+
+    // Headless only, angles are in degrees
+    int          frames;
+    Angles       rotation;
+    Angles       step;
+    const char * output;  // Frame number is substituted for a %d, if given
+    OutputFormat output_format;
+    bool         output_format_given;
+    bool         output_drop;  // Drop frames the writer can't keep up with
+    int          fps;          // Of Y4M streams
+
+    // Batch only
+    const char * batch;
+    const char * output_dir;
+
+    // Server only
+    const char * serve;  // Socket path
+    int          cache;  // Megabytes of meshes kept loaded
+    int          slots;  // Frames clients can hold at once
+
+    bool         no_output;
+
+    const char * trace;
+    bool         perf;
+} Options;
+
+static void
+PrintUsage(void)
+{
+    printf(
+        "Usage: QuickRender [options] <file>\n"
+        "       QuickRender [options] --batch <manifest>\n"
+        "\n"
+        "Options:\n"
+        "  --help                    Show this message\n"
+        "  --size <w>x<h>            Window or frame size (default 400x400)\n"
+        "  --mode <mode>             wireframe, flat, gouraud, phong or toon\n"
+        "  --samples <1|2|4>         Samples per pixel\n"
+        "  --budget <ms>             Lower the resolution while moving to\n"
+        "                            keep frames within a time budget\n"
+        "  --no-refine               Draw every frame at full quality, even\n"
+        "                            while moving\n"
+        "  --hidden-lines            Hide occluded wireframe edges\n"
+        "  --specular                Add specular highlights\n"
+        "  --shadows                 Cast shadows from the light\n"
+        "  --pcf                     Cast shadows with filtered edges\n"
+        "  --lights <n>              Add point and spot lights around the mesh\n"
+        "  --screen-order            Draw faces in screen order rather than\n"
+        "                            front to back\n"
+        "  --temporal                Reproject the last frame's shading\n"
+        "                            instead of shading every pixel (phong,\n"
+        "                            toon, with 32 or more lights)\n"
+        "  --texture <file>          Apply a BMP texture to meshes with\n"
+        "                            texture coordinates\n"
+        "  --overdraw                Show overdraw as a heatmap\n"
+        "  --hud                     Show pipeline statistics\n"
+        "  --trace <file>            Write frame timings as a Chrome trace\n"
+        "  --perf                    Read hardware performance counters\n"
+        "                            for each stage over every thread\n"
+        "                            (Linux only)\n"
+        "  --threads <n>             Threads to load and render with\n"
+        "                            (default one per core)\n"
+        "  --pin                     Pin each worker thread to its own core\n"
+        "                            (Linux only)\n"
+        "\n"
+        "Headless:\n"
+        "  --headless                Render offscreen without a window\n"
+        "  --frames <n>              Number of frames to render (default 1)\n"
+        "  --rotation <y>,<p>,<r>    Initial yaw, pitch and roll in degrees\n"
+        "  --step <y>,<p>,<r>        Rotation added each frame in degrees\n"
+        "  --output <pattern>        Path for each frame, where a %%d is\n"
+        "                            replaced by the frame number\n"
+        "                            (default frame_%%04d.bmp), the path of\n"
+        "                            a .y4m video, or - to stream to stdout\n"
+        "  --output-format <format>  bmp, ppm, qoi or y4m (default from the\n"
+        "                            output extension, or y4m for stdout)\n"
+        "  --output-drop             Drop frames when writing falls behind,\n"
+        "                            rather than waiting\n"
+        "  --fps <n>                 Frame rate of y4m video (default 30)\n"
+        "  --no-output               Render without writing frames\n"
+        "\n"
+        "Batch:\n"
+        "  --batch <manifest>        Render every job in a manifest, where\n"
+        "                            each line is a job of the form\n"
+        "                            <file> <w>x<h> <mode>[,<mode>...] <view>...\n"
+        "                            and each view is either <y>,<p>,<r> or\n"
+        "                            turntable:<count>[@<pitch>]\n"
+        "  --output-dir <dir>        Directory for batch frames (default .)\n"
+        "\n"
+        "Server:\n"
+        "  --serve <socket>          Render requests from clients connecting\n"
+        "                            to a Unix domain socket, into frames in\n"
+        "                            shared memory no larger than --size\n"
+        "  --cache <mb>              Megabytes of meshes kept loaded between\n"
+        "                            requests (default 1024)\n"
+        "  --slots <n>               Frames rendering or held by clients at\n"
+        "                            once (default 8)\n"
+    );
+}
+
+static inline int
+ParseRenderMode(
+    const char * const str,
+    RenderMode * const mode)
+{
+    SDL_assert(str);
+    SDL_assert(mode);
+
+    static const struct {
+        const char * name;
+        RenderMode   mode;
+    } modes[] = {
+        {"wireframe", RENDER_WIREFRAME},
+        {"flat",      RENDER_FLAT},
+        {"gouraud",   RENDER_GOURAUD},
+        {"phong",     RENDER_PHONG},
+        {"toon",      RENDER_TOON},
+    };
+
+    for (size_t i = 0; i < SDL_arraysize(modes); ++i)
+    {
+        if (!strcmp(str, modes[i].name))
+        {
+            *mode = modes[i].mode;
+            return 0;
+        }
+    }
+
+    return SDL_SetError("Unknown render mode '%s'", str);
+}
+
+static inline const char *
+RenderModeName(
+    const RenderMode mode)
+{
+    switch (mode)
+    {
+        case RENDER_WIREFRAME: return "wireframe";
+        case RENDER_FLAT:      return "flat";
+        case RENDER_GOURAUD:   return "gouraud";
+        case RENDER_PHONG:     return "phong";
+        case RENDER_TOON:      return "toon";
+    }
+
+    return "unknown";
+}
+
+static inline int
+ParseInt(
+    const char * const str,
+    const int          min,
+    const int          max,
+          int  * const result)
+{
+    SDL_assert(str);
+    SDL_assert(result);
+
+    char * end;
+    errno = 0;
+
+    const long value = strtol(str, &end, 10);
+
+    if (end == str || *end || errno || value < min || value > max)
+        return SDL_SetError("Invalid number '%s'", str);
+
+    *result = (int)value;
+    return 0;
+}
+
+static inline int
+ParseSize(
+    const char * const str,
+          int  * const width,
+          int  * const height)
+{
+    SDL_assert(str);
+    SDL_assert(width);
+    SDL_assert(height);
+
+    char * end;
+    errno = 0;
+
+    const long w = strtol(str, &end, 10);
+    const long h = (*end == 'x') ? strtol(end + 1, &end, 10) : 0;
+
+    if (*end || errno || w < 1 || w > 16384 || h < 1 || h > 16384)
+        return SDL_SetError("Invalid size '%s'", str);
+
+    *width  = (int)w;
+    *height = (int)h;
+    return 0;
+}
+
+static inline int
+ParseAngles(
+    const char   * const str,
+          Angles * const result)
+{
+    SDL_assert(str);
+    SDL_assert(result);
+
+    float * const angles[3] = {&result->yaw, &result->pitch, &result->roll};
+
+    const char * start = str;
+          char * end;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        errno = 0;
+        *angles[i] = strtof(start, &end);
+
+        if (end == start || errno || !isfinite(*angles[i]))
+            return SDL_SetError("Invalid angles '%s'", str);
+
+        if (i < 2 && *end++ != ',')
+            return SDL_SetError("Expected three angles in '%s'", str);
+
+        start = end;
+    }
+
+    if (*end)
+        return SDL_SetError("Invalid angles '%s'", str);
+
+    return 0;
+}
+
+// Output paths are formatted with the frame number, so only allow a single
+// integer conversion
+static inline int
+ValidateOutputPattern(
+    const char * const pattern)
+{
+    SDL_assert(pattern);
+
+    size_t conversions = 0;
+
+    for (const char * c = pattern; *c; ++c)
+    {
+        if (*c != '%')
+            continue;
+
+        if (*++c == '%')
+            continue;
+
+        c += strspn(c, "0123456789");
+
+        if (*c != 'd')
+            return SDL_SetError("Output pattern only supports %%d");
+
+        conversions++;
+    }
+
+    if (conversions > 1)
+        return SDL_SetError("Output pattern has more than one %%d");
+
+    return 0;
+}
+
+static inline int
+ParseOutputFormat(
+    const char   * const str,
+    OutputFormat * const format)
+{
+    SDL_assert(str);
+    SDL_assert(format);
+
+    for (size_t i = 0; i < SDL_arraysize(OUTPUT_FORMAT_NAMES); ++i)
+    {
+        if (!strcmp(str, OUTPUT_FORMAT_NAMES[i]))
+        {
+            *format = (OutputFormat)i;
+            return 0;
+        }
+    }
+
+    return SDL_SetError("Unknown output format '%s'", str);
+}
+
+static inline int
+ParseOptions(
+    const int            argc,
+    const char * const * argv,
+          Options      * options)
+{
+    SDL_assert(argv);
+    SDL_assert(options);
+
+    *options = (Options){
+        .width   = 400,
+        .height  = 400,
+        .samples = 1,
+        .mode    = RENDER_WIREFRAME,
+        .refine  = true,
+        .frames     = 1,
+        .fps        = OUTPUT_DEFAULT_FPS,
+        .output     = "frame_%04d.bmp",
+        .output_dir = ".",
+        .cache      = 1024,
+        .slots      = 8,
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char * const arg   = argv[i];
+        const char * const value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strncmp(arg, "--", 2))
+        {
+            if (options->file)
+                return SDL_SetError("Only one file may be given");
+
+            options->file = arg;
+            continue;
+        }
+
+        // Flags
+        if (!strcmp(arg, "--help"))
+        {
+            options->help = true;
+            return 0;
+        }
+        else if (!strcmp(arg, "--headless"))
+        {
+            options->headless = true;
+            continue;
+        }
+        else if (!strcmp(arg, "--hidden-lines"))
+        {
+            options->flags |= RENDER_HIDDEN_LINES;
+            continue;
+        }
+        else if (!strcmp(arg, "--specular"))
+        {
+            options->flags |= RENDER_SPECULAR;
+            continue;
+        }
+        else if (!strcmp(arg, "--shadows"))
+        {
+            options->flags |= RENDER_SHADOWS;
+            continue;
+        }
+        else if (!strcmp(arg, "--pcf"))
+        {
+            options->flags |= RENDER_SHADOWS | RENDER_SHADOW_PCF;
+            continue;
+        }
+        else if (!strcmp(arg, "--screen-order"))
+        {
+            options->flags |= RENDER_SCREEN_ORDER;
+            continue;
+        }
+        else if (!strcmp(arg, "--temporal"))
+        {
+            options->flags |= RENDER_TEMPORAL;
+            continue;
+        }
+        else if (!strcmp(arg, "--overdraw"))
+        {
+            options->flags |= RENDER_OVERDRAW;
+            continue;
+        }
+        else if (!strcmp(arg, "--hud"))
+        {
+            options->flags |= RENDER_HUD;
+            continue;
+        }
+        else if (!strcmp(arg, "--perf"))
+        {
+            options->perf = true;
+            continue;
+        }
+        else if (!strcmp(arg, "--no-output"))
+        {
+            options->no_output = true;
+            continue;
+        }
+        else if (!strcmp(arg, "--output-drop"))
+        {
+            options->output_drop = true;
+            continue;
+        }
+        else if (!strcmp(arg, "--no-refine"))
+        {
+            options->refine = false;
+            continue;
+        }
+        else if (!strcmp(arg, "--pin"))
+        {
+            options->pin = true;
+            continue;
+        }
+
+        // Options with values
+        if (!value)
+            return SDL_SetError("Missing value for %s", arg);
+
+        i++;
+
+        if (!strcmp(arg, "--size"))
+        {
+            if (ParseSize(value, &options->width, &options->height))
+                return -1;
+        }
+        else if (!strcmp(arg, "--mode"))
+        {
+            if (ParseRenderMode(value, &options->mode))
+                return -1;
+        }
+        else if (!strcmp(arg, "--samples"))
+        {
+            if (ParseInt(value, 1, 4, &options->samples))
+                return -1;
+
+            if (options->samples == 3)
+                return SDL_SetError("Samples must be 1, 2 or 4");
+        }
+        else if (!strcmp(arg, "--budget"))
+        {
+            if (ParseInt(value, 1, 1000, &options->budget))
+                return -1;
+        }
+        else if (!strcmp(arg, "--lights"))
+        {
+            if (ParseInt(value, 0, LIGHTS_MAX, &options->lights))
+                return -1;
+        }
+        else if (!strcmp(arg, "--frames"))
+        {
+            if (ParseInt(value, 1, INT_MAX, &options->frames))
+                return -1;
+        }
+        else if (!strcmp(arg, "--rotation"))
+        {
+            if (ParseAngles(value, &options->rotation))
+                return -1;
+        }
+        else if (!strcmp(arg, "--step"))
+        {
+            if (ParseAngles(value, &options->step))
+                return -1;
+        }
+        else if (!strcmp(arg, "--output"))
+        {
+            if (ValidateOutputPattern(value))
+                return -1;
+
+            options->output = value;
+        }
+        else if (!strcmp(arg, "--output-format"))
+        {
+            if (ParseOutputFormat(value, &options->output_format))
+                return -1;
+
+            options->output_format_given = true;
+        }
+        else if (!strcmp(arg, "--fps"))
+        {
+            if (ParseInt(value, 1, 1000, &options->fps))
+                return -1;
+        }
+        else if (!strcmp(arg, "--texture"))
+        {
+            options->texture = value;
+            options->flags  |= RENDER_TEXTURES;
+        }
+        else if (!strcmp(arg, "--trace"))
+        {
+            options->trace = value;
+        }
+        else if (!strcmp(arg, "--batch"))
+        {
+            options->batch = value;
+        }
+        else if (!strcmp(arg, "--output-dir"))
+        {
+            options->output_dir = value;
+        }
+        else if (!strcmp(arg, "--serve"))
+        {
+            options->serve = value;
+        }
+        else if (!strcmp(arg, "--cache"))
+        {
+            if (ParseInt(value, 1, INT_MAX, &options->cache))
+                return -1;
+        }
+        else if (!strcmp(arg, "--slots"))
+        {
+            if (ParseInt(value, 1, 1024, &options->slots))
+                return -1;
+        }
+        else if (!strcmp(arg, "--threads"))
+        {
+            if (ParseInt(value, 1, 1024, &options->threads))
+                return -1;
+        }
+        else
+        {
+            return SDL_SetError("Unknown option %s", arg);
+        }
+    }
+
+    // Batch manifests and server requests name their own files
+    if (!options->file && !options->batch && !options->serve)
+        return SDL_SetError("No file given");
+
+    if (options->file && options->batch)
+        return SDL_SetError("Files are given by the batch manifest");
+
+    if (options->file && options->serve)
+        return SDL_SetError("Files are given by each request");
+
+    if (options->batch && options->serve)
+        return SDL_SetError("Batches can't be served");
+
+    if (!options->output_format_given)
+        options->output_format = OutputFormatFromPath(options->output);
+
+    return 0;
+}
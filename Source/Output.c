@@ -0,0 +1,744 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Frames queued for the writer thread, beyond which rendering waits for it
+// or drops frames
+#define OUTPUT_SLOTS 4
+
+// Frame rate written into Y4M streams when none is given
+#define OUTPUT_DEFAULT_FPS 30
+
+typedef enum OutputFormat {
+    OUTPUT_BMP,
+    OUTPUT_PPM,
+    OUTPUT_QOI,
+    OUTPUT_Y4M,
+} OutputFormat;
+
+static const char * const OUTPUT_FORMAT_NAMES[] = {
+    "bmp",
+    "ppm",
+    "qoi",
+    "y4m",
+};
+
+// Output path that streams frames to stdout
+static inline bool
+OutputIsStdout(
+    const char * const path)
+{
+    SDL_assert(path);
+    return !strcmp(path, "-");
+}
+
+// Format written for an output path, from its extension. Frames streamed to
+// stdout default to Y4M, and anything unknown to BMP.
+static inline OutputFormat
+OutputFormatFromPath(
+    const char * const path)
+{
+    SDL_assert(path);
+
+    if (OutputIsStdout(path))
+        return OUTPUT_Y4M;
+
+    const char * const extension = strrchr(path, '.');
+
+    if (extension)
+        for (size_t i = 0; i < SDL_arraysize(OUTPUT_FORMAT_NAMES); ++i)
+            if (!strcmp(extension + 1, OUTPUT_FORMAT_NAMES[i]))
+                return (OutputFormat)i;
+
+    return OUTPUT_BMP;
+}
+
+// Takes stdout for a stream of frames. Everything printed afterwards goes
+// to stderr instead, so that it can't interleave with the frames.
+static inline FILE *
+OutputStdout(void)
+{
+    static FILE * stream = NULL;
+
+    if (stream)
+        return stream;
+
+    fflush(stdout);
+
+    const int fd = dup(STDOUT_FILENO);
+
+    if (fd < 0)
+    {
+        SDL_SetError("Unable to duplicate stdout: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+        SDL_SetError("Unable to redirect stdout: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    stream = fdopen(fd, "wb");
+
+    if (!stream)
+    {
+        SDL_SetError("Unable to open stdout: %s", strerror(errno));
+        close(fd);
+    }
+
+    return stream;
+}
+
+// Bytes needed to encode one frame in the given format, at most
+static inline size_t
+OutputFrameSize(
+    const OutputFormat format,
+    const int          width,
+    const int          height)
+{
+    SDL_assert(width > 0 && height > 0);
+
+    const size_t pixels = SizeMult((size_t)width, (size_t)height);
+
+    switch (format)
+    {
+        // Header and RGB
+        case OUTPUT_PPM:
+            return SizeAdd(SizeMult(pixels, 3), 64);
+
+        // Header, five bytes for a pixel with new alpha, and end marker
+        case OUTPUT_QOI:
+            return SizeAdd(SizeMult(pixels, 5), 14 + 8);
+
+        // Frame marker, full Y plane and quarter U and V planes
+        case OUTPUT_Y4M:
+            return SizeAdd(
+                pixels,
+                SizeAdd(
+                    SizeMult(
+                        SizeMult((size_t)(width + 1) / 2, (size_t)(height + 1) / 2),
+                        2
+                    ),
+                    6
+                )
+            );
+
+        default:
+            return 0;
+    }
+}
+
+static inline size_t
+EncodePPM(
+    const SDL_Surface * const surface,
+          uint8_t     * const out)
+{
+    SDL_assert(surface && surface->format->format == SDL_PIXELFORMAT_RGBA32);
+    SDL_assert(out);
+
+    uint8_t * ptr = out;
+    ptr += sprintf((char *)ptr, "P6\n%d %d\n255\n", surface->w, surface->h);
+
+    for (int y = 0; y < surface->h; ++y)
+    {
+        const uint8_t * const row = (const uint8_t *)surface->pixels
+                                  + (size_t)y * (size_t)surface->pitch;
+
+        for (int x = 0; x < surface->w; ++x)
+        {
+            *ptr++ = row[x * 4 + 0];
+            *ptr++ = row[x * 4 + 1];
+            *ptr++ = row[x * 4 + 2];
+        }
+    }
+
+    return (size_t)(ptr - out);
+}
+
+static inline uint8_t *
+PutBigEndian32(
+          uint8_t * const ptr,
+    const uint32_t        value)
+{
+    ptr[0] = (uint8_t)(value >> 24);
+    ptr[1] = (uint8_t)(value >> 16);
+    ptr[2] = (uint8_t)(value >>  8);
+    ptr[3] = (uint8_t)(value);
+    return ptr + 4;
+}
+
+// Lossless "Quite OK Image" encoding, see https://qoiformat.org
+static inline size_t
+EncodeQOI(
+    const SDL_Surface * const surface,
+          uint8_t     * const out)
+{
+    SDL_assert(surface && surface->format->format == SDL_PIXELFORMAT_RGBA32);
+    SDL_assert(out);
+
+    uint8_t * ptr = out;
+
+    memcpy(ptr, "qoif", 4);
+    ptr = PutBigEndian32(ptr + 4, (uint32_t)surface->w);
+    ptr = PutBigEndian32(ptr,     (uint32_t)surface->h);
+    *ptr++ = 4;  // RGBA
+    *ptr++ = 0;  // sRGB with linear alpha
+
+    uint8_t seen[64][4] = {{0}};
+    uint8_t prev[4]     = {0, 0, 0, 255};
+    int     run         = 0;
+
+    for (int y = 0; y < surface->h; ++y)
+    {
+        const uint8_t * const row = (const uint8_t *)surface->pixels
+                                  + (size_t)y * (size_t)surface->pitch;
+
+        for (int x = 0; x < surface->w; ++x)
+        {
+            const uint8_t * const px = &row[x * 4];
+
+            if (!memcmp(px, prev, 4))
+            {
+                if (++run == 62)
+                {
+                    *ptr++ = (uint8_t)(0xC0 | (run - 1));
+                    run = 0;
+                }
+
+                continue;
+            }
+
+            if (run)
+            {
+                *ptr++ = (uint8_t)(0xC0 | (run - 1));
+                run = 0;
+            }
+
+            const int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+
+            if (!memcmp(seen[hash], px, 4))
+            {
+                *ptr++ = (uint8_t)hash;
+            }
+            else if (px[3] == prev[3])
+            {
+                memcpy(seen[hash], px, 4);
+
+                // Differences wrap around, as in the decoder
+                const int dr = (int8_t)(uint8_t)(px[0] - prev[0]);
+                const int dg = (int8_t)(uint8_t)(px[1] - prev[1]);
+                const int db = (int8_t)(uint8_t)(px[2] - prev[2]);
+
+                const int dr_dg = dr - dg;
+                const int db_dg = db - dg;
+
+                if (dr >= -2 && dr <= 1
+                 && dg >= -2 && dg <= 1
+                 && db >= -2 && db <= 1)
+                {
+                    *ptr++ = (uint8_t)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                }
+                else if (dg    >= -32 && dg    <= 31
+                      && dr_dg >=  -8 && dr_dg <=  7
+                      && db_dg >=  -8 && db_dg <=  7)
+                {
+                    *ptr++ = (uint8_t)(0x80 | (dg + 32));
+                    *ptr++ = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+                }
+                else
+                {
+                    *ptr++ = 0xFE;
+                    *ptr++ = px[0];
+                    *ptr++ = px[1];
+                    *ptr++ = px[2];
+                }
+            }
+            else
+            {
+                memcpy(seen[hash], px, 4);
+
+                *ptr++ = 0xFF;
+                memcpy(ptr, px, 4);
+                ptr += 4;
+            }
+
+            memcpy(prev, px, 4);
+        }
+    }
+
+    if (run)
+        *ptr++ = (uint8_t)(0xC0 | (run - 1));
+
+    static const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    memcpy(ptr, end, sizeof(end));
+
+    return (size_t)(ptr + sizeof(end) - out);
+}
+
+// Header of a Y4M stream of frames of the given size, in 4:2:0 with the
+// chroma sited as in JPEG
+static inline int
+WriteY4MHeader(
+          FILE * const stream,
+    const int          width,
+    const int          height,
+    const int          fps)
+{
+    SDL_assert(stream);
+
+    if (fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps) < 0)
+        return SDL_SetError("Unable to write Y4M header");
+
+    return 0;
+}
+
+// One Y4M frame, converted to BT.601 limited range YUV with chroma averaged
+// over each 2x2 block
+static inline size_t
+EncodeY4M(
+    const SDL_Surface * const surface,
+          uint8_t     * const out)
+{
+    SDL_assert(surface && surface->format->format == SDL_PIXELFORMAT_RGBA32);
+    SDL_assert(out);
+
+    const int w = surface->w;
+    const int h = surface->h;
+
+    const size_t chroma_w = (size_t)(w + 1) / 2;
+    const size_t chroma_h = (size_t)(h + 1) / 2;
+
+    memcpy(out, "FRAME\n", 6);
+
+    uint8_t * const plane_y = out + 6;
+    uint8_t * const plane_u = plane_y + (size_t)w * (size_t)h;
+    uint8_t * const plane_v = plane_u + chroma_w * chroma_h;
+
+    for (int y = 0; y < h; ++y)
+    {
+        const uint8_t * const row = (const uint8_t *)surface->pixels
+                                  + (size_t)y * (size_t)surface->pitch;
+
+        uint8_t * const luma = plane_y + (size_t)y * (size_t)w;
+
+        for (int x = 0; x < w; ++x)
+        {
+            const int r = row[x * 4 + 0];
+            const int g = row[x * 4 + 1];
+            const int b = row[x * 4 + 2];
+
+            luma[x] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+    }
+
+    for (size_t cy = 0; cy < chroma_h; ++cy)
+    {
+        // The last row and column are repeated for odd sizes
+        const int y0 = (int)cy * 2;
+        const int y1 = SDL_min(y0 + 1, h - 1);
+
+        const uint8_t * const row0 = (const uint8_t *)surface->pixels
+                                   + (size_t)y0 * (size_t)surface->pitch;
+
+        const uint8_t * const row1 = (const uint8_t *)surface->pixels
+                                   + (size_t)y1 * (size_t)surface->pitch;
+
+        for (size_t cx = 0; cx < chroma_w; ++cx)
+        {
+            const int x0 = (int)cx * 2 * 4;
+            const int x1 = SDL_min((int)cx * 2 + 1, w - 1) * 4;
+
+            const int r = row0[x0 + 0] + row0[x1 + 0] + row1[x0 + 0] + row1[x1 + 0];
+            const int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+            const int b = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+
+            // Sums of four pixels, so two more bits are shifted out
+            const size_t i = cy * chroma_w + cx;
+
+            plane_u[i] = (uint8_t)(((-38 * r -  74 * g + 112 * b + 512) >> 10) + 128);
+            plane_v[i] = (uint8_t)(((112 * r -  94 * g -  18 * b + 512) >> 10) + 128);
+        }
+    }
+
+    return 6 + (size_t)w * (size_t)h + 2 * chroma_w * chroma_h;
+}
+
+typedef struct OutputSlot {
+    SDL_Surface * surface;
+    int           frame;  // Negative to end the stream
+} OutputSlot;
+
+// Writes frames on a thread of its own, so that rendering never waits on
+// encoding or the disk. Frames are copied into a ring of slots, and once
+// every slot is queued the renderer either waits for the writer or drops
+// the frame.
+typedef struct OutputSink {
+    OutputFormat   format;
+    const char   * pattern;  // Path of each frame, where a %d is the frame
+    FILE         * stream;   // Y4M file or stdout, NULL for a file per frame
+    bool           owned;    // Stream is closed with the sink
+    bool           drop;     // Drop frames rather than wait for the writer
+
+    SDL_Thread   * thread;
+    SDL_sem      * free;     // Slots that can be filled
+    SDL_sem      * filled;   // Slots waiting to be written
+    OutputSlot     slots[OUTPUT_SLOTS];
+    size_t         head;     // Next slot filled, only used by the renderer
+    size_t         tail;     // Next slot written, only used by the writer
+
+    // Encoded frame, only used by the writer
+    uint8_t      * encoded;
+
+    SDL_atomic_t   failed;
+    char           error[256];
+
+    // Counted by the renderer
+    uint64_t       pushed;
+    uint64_t       dropped;
+    uint64_t       queued;      // Frames already queued, summed over pushes
+    uint64_t       max_queued;
+    uint64_t       wait_time;   // Nanoseconds spent waiting for a slot
+
+    // Counted by the writer, read once it has stopped
+    uint64_t       written;
+    uint64_t       write_time;  // Nanoseconds spent encoding and writing
+} OutputSink;
+
+static inline int
+WriteFrame(
+          OutputSink * const sink,
+    const OutputSlot * const slot)
+{
+    SDL_assert(sink);
+    SDL_assert(slot && slot->surface);
+
+    char path[4096];
+
+    if (!sink->stream)
+    {
+        const int length = SDL_snprintf(path, sizeof(path), sink->pattern, slot->frame);
+
+        if (length < 0 || (size_t)length >= sizeof(path))
+            return SDL_SetError("Output path is too long");
+    }
+
+    size_t size = 0;
+
+    switch (sink->format)
+    {
+        case OUTPUT_BMP:
+            SDL_assert(!sink->stream);
+            return SDL_SaveBMP(slot->surface, path);
+
+        case OUTPUT_PPM:
+            size = EncodePPM(slot->surface, sink->encoded);
+            break;
+
+        case OUTPUT_QOI:
+            size = EncodeQOI(slot->surface, sink->encoded);
+            break;
+
+        case OUTPUT_Y4M:
+            size = EncodeY4M(slot->surface, sink->encoded);
+            break;
+    }
+
+    SDL_assert(size <= OutputFrameSize(sink->format, slot->surface->w, slot->surface->h));
+
+    FILE * const file = (sink->stream) ? sink->stream : fopen(path, "wb");
+
+    if (!file)
+        return SDL_SetError("Unable to open %s: %s", path, strerror(errno));
+
+    const bool written = fwrite(sink->encoded, 1, size, file) == size;
+
+    if (!sink->stream && fclose(file) != 0)
+        return SDL_SetError("Unable to write %s: %s", path, strerror(errno));
+
+    if (!written)
+        return SDL_SetError("Unable to write frame %d: %s", slot->frame, strerror(errno));
+
+    return 0;
+}
+
+static int
+OutputThreadMain(
+    void * const data)
+{
+    OutputSink * const sink = data;
+    SDL_assert(sink);
+
+    while (true)
+    {
+        SDL_SemWait(sink->filled);
+
+        const OutputSlot * const slot = &sink->slots[sink->tail++ % OUTPUT_SLOTS];
+
+        if (slot->frame < 0)
+            break;
+
+        // Frames are still taken after a failure, so that the renderer
+        // never waits on a slot that won't be freed
+        if (!SDL_AtomicGet(&sink->failed))
+        {
+            const uint64_t start = GetTimeNs();
+
+            if (WriteFrame(sink, slot) == 0)
+            {
+                sink->written++;
+                sink->write_time += GetTimeNs() - start;
+            }
+            else
+            {
+                SDL_snprintf(sink->error, sizeof(sink->error), "%s", SDL_GetError());
+                SDL_AtomicSet(&sink->failed, 1);
+            }
+        }
+
+        SDL_SemPost(sink->free);
+    }
+
+    return 0;
+}
+
+static inline void OutputSinkFree(OutputSink * const sink);
+
+// Starts writing frames of the given size, to a file per frame named by
+// the pattern, or to a single Y4M file. A pattern of "-" streams every
+// format but BMP to stdout, which must be taken before anything else is
+// printed.
+static inline int
+OutputSinkOpen(
+          OutputSink   * const sink,
+    const OutputFormat         format,
+    const char         * const pattern,
+    const int                  width,
+    const int                  height,
+    const int                  fps,
+    const bool                 drop)
+{
+    SDL_assert(sink);
+    SDL_assert(pattern);
+    SDL_assert(width > 0 && height > 0);
+    SDL_assert(fps > 0);
+
+    memset(sink, 0, sizeof(OutputSink));
+
+    sink->format  = format;
+    sink->pattern = pattern;
+    sink->drop    = drop;
+
+    if (OutputIsStdout(pattern))
+    {
+        if (format == OUTPUT_BMP)
+            return SDL_SetError("BMP frames can't be streamed to stdout");
+
+        sink->stream = OutputStdout();
+
+        if (!sink->stream)
+            return -1;
+    }
+    else if (format == OUTPUT_Y4M)
+    {
+        if (strchr(pattern, '%'))
+            return SDL_SetError("Y4M frames are written to one file, without a %%d");
+
+        sink->stream = fopen(pattern, "wb");
+        sink->owned  = true;
+
+        if (!sink->stream)
+            return SDL_SetError("Unable to open %s: %s", pattern, strerror(errno));
+    }
+
+    if (format == OUTPUT_Y4M && WriteY4MHeader(sink->stream, width, height, fps))
+        goto Error;
+
+    for (size_t i = 0; i < OUTPUT_SLOTS; ++i)
+    {
+        sink->slots[i].surface = SDL_CreateRGBSurfaceWithFormat(
+            0 /* flags */,
+            width, height,
+            32, SDL_PIXELFORMAT_RGBA32
+        );
+
+        if (!sink->slots[i].surface)
+            goto Error;
+    }
+
+    if (format != OUTPUT_BMP)
+    {
+        sink->encoded = malloc(OutputFrameSize(format, width, height));
+
+        if (!sink->encoded)
+        {
+            SDL_SetError("Unable to allocate output buffer");
+            goto Error;
+        }
+    }
+
+    sink->free   = SDL_CreateSemaphore(OUTPUT_SLOTS);
+    sink->filled = SDL_CreateSemaphore(0);
+
+    if (!sink->free || !sink->filled)
+        goto Error;
+
+    sink->thread = SDL_CreateThread(OutputThreadMain, "Output", sink);
+
+    if (!sink->thread)
+        goto Error;
+
+    return 0;
+
+Error:
+    OutputSinkFree(sink);
+    return -1;
+}
+
+// Queues a copy of a frame to be written. Waits for a free slot when every
+// slot is queued, unless the sink drops frames.
+static inline int
+OutputSinkPush(
+          OutputSink  * const sink,
+    const SDL_Surface * const surface,
+    const int                 frame)
+{
+    SDL_assert(sink && sink->thread);
+    SDL_assert(surface && surface->format->format == SDL_PIXELFORMAT_RGBA32);
+    SDL_assert(frame >= 0);
+
+    if (SDL_AtomicGet(&sink->failed))
+        return SDL_SetError("%s", sink->error);
+
+    const uint64_t queued = OUTPUT_SLOTS - SDL_SemValue(sink->free);
+
+    sink->queued    += queued;
+    sink->max_queued = SDL_max(sink->max_queued, queued);
+
+    if (SDL_SemTryWait(sink->free) != 0)
+    {
+        if (sink->drop)
+        {
+            sink->dropped++;
+            return 0;
+        }
+
+        const uint64_t start = GetTimeNs();
+
+        if (SDL_SemWait(sink->free) != 0)
+            return -1;
+
+        sink->wait_time += GetTimeNs() - start;
+    }
+
+    OutputSlot * const slot = &sink->slots[sink->head++ % OUTPUT_SLOTS];
+
+    SDL_assert(slot->surface->w == surface->w);
+    SDL_assert(slot->surface->h == surface->h);
+
+    const size_t row = (size_t)surface->w * sizeof(uint32_t);
+
+    for (int y = 0; y < surface->h; ++y)
+        memcpy(
+            (uint8_t *)slot->surface->pixels + (size_t)y * (size_t)slot->surface->pitch,
+            (const uint8_t *)surface->pixels + (size_t)y * (size_t)surface->pitch,
+            row
+        );
+
+    slot->frame = frame;
+    sink->pushed++;
+
+    SDL_SemPost(sink->filled);
+    return 0;
+}
+
+static inline void
+OutputSinkFree(
+    OutputSink * const sink)
+{
+    SDL_assert(sink);
+
+    SDL_DestroySemaphore(sink->free);
+    SDL_DestroySemaphore(sink->filled);
+
+    for (size_t i = 0; i < OUTPUT_SLOTS; ++i)
+        SDL_FreeSurface(sink->slots[i].surface);
+
+    free(sink->encoded);
+
+    if (sink->owned)
+        fclose(sink->stream);
+
+    memset(sink, 0, sizeof(OutputSink));
+}
+
+// Waits for every queued frame to be written and stops the writer, failing
+// if any frame couldn't be written
+static inline int
+OutputSinkClose(
+    OutputSink * const sink)
+{
+    SDL_assert(sink);
+
+    if (sink->thread)
+    {
+        SDL_SemWait(sink->free);
+
+        sink->slots[sink->head++ % OUTPUT_SLOTS].frame = -1;
+        SDL_SemPost(sink->filled);
+
+        SDL_WaitThread(sink->thread, NULL);
+        sink->thread = NULL;
+    }
+
+    int status = 0;
+
+    if (SDL_AtomicGet(&sink->failed))
+        status = SDL_SetError("%s", sink->error);
+    else if (sink->stream && fflush(sink->stream) != 0)
+        status = SDL_SetError("Unable to write frames: %s", strerror(errno));
+
+    if (sink->owned)
+    {
+        if (fclose(sink->stream) != 0 && !status)
+            status = SDL_SetError("Unable to write frames: %s", strerror(errno));
+
+        sink->owned = false;
+    }
+
+    return status;
+}
+
+// Prints how far the writer kept up with the renderer
+static inline void
+OutputSinkReport(
+    const OutputSink * const sink)
+{
+    SDL_assert(sink && !sink->thread);
+
+    const uint64_t pushes = sink->pushed + sink->dropped;
+
+    printf(
+        "written: %llu frames, %llu dropped, %.2f queued on average, %llu at most\n"
+        "writer: %.3f ms/frame, waited on %.3f ms/frame\n",
+        (unsigned long long)sink->written,
+        (unsigned long long)sink->dropped,
+        (double)sink->queued / (double)SDL_max(pushes, 1),
+        (unsigned long long)sink->max_queued,
+        (double)sink->write_time / 1e6 / (double)SDL_max(sink->written, 1),
+        (double)sink->wait_time / 1e6 / (double)SDL_max(pushes, 1)
+    );
+}
@@ -0,0 +1,182 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Hardware performance counters through perf_event_open(2). Counters only
+// measure the thread that opened them, and are optional everywhere: when the
+// platform, kernel or sandbox doesn't allow them, nothing is counted.
+
+typedef enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTERS,
+} PerfCounter;
+
+static const char * const PERF_COUNTER_NAMES[PERF_COUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+};
+
+typedef struct PerfValues {
+    uint64_t counts[PERF_COUNTERS];
+} PerfValues;
+
+typedef struct PerfCounters {
+    int fds[PERF_COUNTERS];  // -1 for counters the CPU or kernel lacks
+} PerfCounters;
+
+#if defined(__linux__)
+
+static inline int
+PerfOpen(
+    PerfCounters * const perf)
+{
+    SDL_assert(perf);
+
+    static const struct { uint32_t type; uint64_t config; } events[PERF_COUNTERS] = {
+        [PERF_CYCLES]        = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [PERF_INSTRUCTIONS]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        [PERF_L1D_MISSES]    = {
+            PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        },
+        [PERF_LLC_MISSES]    = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    size_t opened = 0;
+    int    error  = 0;
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size           = sizeof(attr);
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        // This thread only, on any CPU. Each counter is opened on its own so
+        // that one missing event doesn't take the rest with it.
+        perf->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+        if (perf->fds[i] < 0)
+            error = errno;
+        else
+            opened++;
+    }
+
+    if (!opened)
+        return SDL_SetError("Performance counters unavailable: %s", strerror(error));
+
+    return 0;
+}
+
+static inline void
+PerfRead(
+    const PerfCounters * const perf,
+          PerfValues   * const values)
+{
+    SDL_assert(perf);
+    SDL_assert(values);
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i)
+    {
+        uint64_t count = 0;
+
+        if (perf->fds[i] >= 0)
+            if (read(perf->fds[i], &count, sizeof(count)) != (ssize_t)sizeof(count))
+                count = 0;
+
+        values->counts[i] = count;
+    }
+}
+
+static inline void
+PerfClose(
+    PerfCounters * const perf)
+{
+    SDL_assert(perf);
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i)
+    {
+        if (perf->fds[i] >= 0)
+            close(perf->fds[i]);
+
+        perf->fds[i] = -1;
+    }
+}
+
+#else
+
+static inline int
+PerfOpen(
+    PerfCounters * const perf)
+{
+    SDL_assert(perf);
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i)
+        perf->fds[i] = -1;
+
+    return SDL_SetError("Performance counters are only supported on Linux");
+}
+
+static inline void
+PerfRead(
+    const PerfCounters * const perf,
+          PerfValues   * const values)
+{
+    SDL_assert(perf);
+    SDL_assert(values);
+
+    memset(values, 0, sizeof(PerfValues));
+}
+
+static inline void
+PerfClose(
+    PerfCounters * const perf)
+{
+    SDL_assert(perf);
+}
+
+#endif
+
+static inline bool
+PerfAvailable(
+    const PerfCounters * const perf,
+    const PerfCounter          counter)
+{
+    return perf && perf->fds[counter] >= 0;
+}
+
+// Adds the counts between two reads to a running total
+static inline void
+PerfAccumulate(
+          PerfValues * const total,
+    const PerfValues * const start,
+    const PerfValues * const end)
+{
+    SDL_assert(total);
+    SDL_assert(start);
+    SDL_assert(end);
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i)
+        total->counts[i] += end->counts[i] - start->counts[i];
+}
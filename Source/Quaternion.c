@@ -120,3 +120,25 @@ QuaternionRotatev(
     result = VectorAdd(&result, &temp);
     return result;
 }
+
+// Euler angles in degrees
+typedef struct Angles {
+    float yaw, pitch, roll;
+} Angles;
+
+static inline Quaternion
+AnglesToRotation(
+    const Angles * const angles)
+{
+    SDL_assert(angles);
+
+    const float scale = (float)M_PI / 180.0f;
+
+    const Quaternion result = AnglesToQuaternion(
+        angles->yaw   * scale,
+        angles->pitch * scale,
+        angles->roll  * scale
+    );
+
+    return QuaternionNormalize(&result);
+}
@@ -0,0 +1,103 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Time the camera must be still for before frames are refined
+const uint64_t REFINE_DELAY_MS = 150;
+
+// Quality of a frame, from the cheapest drawn while moving to the full
+// quality left on screen. Each tier is only drawn once the previous one has
+// been presented, so a still camera sharpens over a few frames.
+typedef struct RefineTier {
+    float scale;    // Linear fraction of the window size
+    bool  shading;  // Selected shading, rather than gouraud for phong and toon
+    bool  quality;  // Selected samples and filtered shadows
+} RefineTier;
+
+static const RefineTier REFINE_TIERS[] = {
+    {0.5f, false, false},
+    {1.0f, false, false},
+    {1.0f, true,  false},
+    {1.0f, true,  true},
+};
+
+#define REFINE_FULL ((int)SDL_arraysize(REFINE_TIERS) - 1)
+
+static inline const RefineTier *
+RefineGetTier(
+    const int tier)
+{
+    SDL_assert(tier >= 0 && tier <= REFINE_FULL);
+    return &REFINE_TIERS[tier];
+}
+
+static inline RenderMode
+RefineMode(
+    const RenderMode mode,
+    const int        tier)
+{
+    if (RefineGetTier(tier)->shading)
+        return mode;
+
+    return (mode == RENDER_PHONG || mode == RENDER_TOON)
+        ? RENDER_GOURAUD
+        : mode;
+}
+
+static inline int
+RefineFlags(
+    const int flags,
+    const int tier)
+{
+    return (RefineGetTier(tier)->quality)
+        ? flags
+        : flags & ~RENDER_SHADOW_PCF;
+}
+
+static inline int
+RefineSamples(
+    const int samples,
+    const int tier)
+{
+    return (RefineGetTier(tier)->quality) ? samples : 1;
+}
+
+// Next tier to draw after the given one, skipping tiers that would draw the
+// same frame as the tier after them
+static inline int
+RefineNext(
+    const RenderMode mode,
+    const int        flags,
+    const int        samples,
+    const int        tier)
+{
+    SDL_assert(tier >= 0 && tier < REFINE_FULL);
+
+    int next = tier + 1;
+
+    for (; next < REFINE_FULL; ++next)
+    {
+        const RefineTier * const a = RefineGetTier(next);
+        const RefineTier * const b = RefineGetTier(next + 1);
+
+        if (a->scale != b->scale
+         || RefineMode   (mode,    next) != RefineMode   (mode,    next + 1)
+         || RefineFlags  (flags,   next) != RefineFlags  (flags,   next + 1)
+         || RefineSamples(samples, next) != RefineSamples(samples, next + 1))
+            break;
+    }
+
+    return next;
+}
@@ -22,8 +22,16 @@ typedef enum RenderMode {
 } RenderMode;
 
 typedef enum RenderFlags {
-    RENDER_TEXTURES = 1 << 0,
-    RENDER_LIGHTING = 1 << 1,
+    RENDER_TEXTURES     = 1 << 0,
+    RENDER_LIGHTING     = 1 << 1,
+    RENDER_HIDDEN_LINES = 1 << 2,
+    RENDER_SPECULAR     = 1 << 3,
+    RENDER_OVERDRAW     = 1 << 4,  // Heatmap of pixel writes instead of shading
+    RENDER_HUD          = 1 << 5,  // Drawn by the caller, after Render()
+    RENDER_SHADOWS      = 1 << 6,
+    RENDER_SHADOW_PCF   = 1 << 7,  // Filter shadow edges over 3x3 texels
+    RENDER_TEMPORAL     = 1 << 8,  // Reuse the last frame's shading
+    RENDER_SCREEN_ORDER = 1 << 9,  // Draw faces in screen order, not depth
 } RenderFlags;
 
 typedef struct Camera {
@@ -33,11 +41,113 @@ typedef struct Camera {
     Vector right;
 } Camera;
 
+// Pipeline counters and the overdraw heatmap cost a few increments per
+// pixel, build with -DRENDER_STATS=0 to compile them out
+#ifndef RENDER_STATS
+    #define RENDER_STATS 1
+#endif
+
+#if RENDER_STATS
+    #define RENDER_COUNT(context, counter, n) ((context)->stats.counter += (n))
+#else
+    #define RENDER_COUNT(context, counter, n) ((void)0)
+#endif
+
+// Counters of the last frame, zero when compiled out
+typedef struct RenderStats {
+    size_t faces;    // Submitted to backface culling
+    size_t culled;   // Facing away from the camera
+    size_t clipped;  // Degenerate, or entirely outside the target
+    size_t tested;   // Pixels depth tested
+    size_t passed;   // Pixels with at least one visible sample
+    size_t written;  // Pixel writes, including lines
+    size_t covered;  // Distinct pixels written
+
+    size_t arena;       // Frame arena bytes used
+    size_t arena_peak;  // Most used by any frame
+
+    size_t reused;  // Pixels shaded by reprojecting the last frame
+
+    size_t lights;       // Point and spot lights on screen
+    // Lights evaluated, over all shaded points. Vertices and faces spanning
+    // several bands are shaded once in each.
+    size_t light_evals;
+} RenderStats;
+
+// Stage durations of the last frame, in nanoseconds. Triangle setup,
+// coverage and shading are interleaved per pixel so are timed together.
+typedef struct RenderTimings {
+    uint64_t start;  // GetTimeNs() at the start of the frame
+    uint64_t clear;
+    uint64_t transform;
+    uint64_t lighting;
+    uint64_t raster;
+    uint64_t resolve;
+} RenderTimings;
+
+// Hardware counters of each stage of the last frame, when counting
+typedef struct RenderCounters {
+    PerfValues clear;
+    PerfValues transform;
+    PerfValues lighting;
+    PerfValues raster;
+    PerfValues resolve;
+} RenderCounters;
+
+static inline PerfValues
+RenderCountersTotal(
+    const RenderCounters * const counters)
+{
+    SDL_assert(counters);
+
+    const PerfValues zero = {{0}};
+    PerfValues total = zero;
+
+    PerfAccumulate(&total, &zero, &counters->clear);
+    PerfAccumulate(&total, &zero, &counters->transform);
+    PerfAccumulate(&total, &zero, &counters->lighting);
+    PerfAccumulate(&total, &zero, &counters->raster);
+    PerfAccumulate(&total, &zero, &counters->resolve);
+
+    return total;
+}
+
+// Screen tiles each light list covers, in pixels per side
+#define LIGHT_TILE_SIZE 16
+
+// Light indices of every tile, one list after another. An extra tile past
+// the last holds every light, for points off screen.
+typedef struct LightTiles {
+    int        columns;
+    int        rows;
+    uint32_t * offsets;  // Start of each tile's list, plus the end of the last
+    uint16_t * indices;
+} LightTiles;
+
+// Rows a face may cover, found once per frame for every band to test
+typedef struct FaceRows {
+    int top;     // First row, which the face is counted by
+    int bottom;  // Last row, or one past it, -1 for faces that can't be drawn
+} FaceRows;
+
+// Faces sorted by their screen centers for one view, see OrderFaces()
+typedef struct ScreenOrder {
+    uint32_t   * faces;
+    size_t       size;
+    const Mesh * mesh;
+    Quaternion   rotation;
+    int          width;
+    int          height;
+} ScreenOrder;
+
 typedef struct RenderContext {
     SDL_Surface * target;
-    SDL_Surface * depth;
+    SDL_Surface * depth;  // One float per sample
+    SDL_Surface * color;  // One pixel per sample, resolved into target
+
+    int           samples;
 
-    Mesh        * mesh;
+    const Mesh  * mesh;
 
     RenderMode    mode;
     int           flags;
@@ -45,9 +155,264 @@ typedef struct RenderContext {
     Camera        camera;
     Vector        light;
 
+    // Camera position of the frame being rendered, after rotation. Render()
+    // never modifies the camera itself.
+    Vector        eye;
+
     Quaternion    rotation;
+
+    // Scratch memory for the frame being rendered, reset by Render()
+    Arena         arena;
+
+    // Per-frame screen space vertices, in the frame arena
+    Vector      * projected;
+
+    // Faces in the order to draw them this frame, or NULL for mesh order
+    const uint32_t * order;
+
+    // Kept between frames, and only sorted again once the view has turned
+    // far enough
+    ScreenOrder   screen_order;
+
+    // Point and spot lights, not owned by the context
+    Lights        lights;
+
+    // Lights that can reach each screen tile, built each frame in the frame
+    // arena
+    LightTiles    light_tiles;
+
+    // Per-pixel lighting, rebuilt when the light or shading model changes
+    LightingTable * lighting;
+
+    // Depth from the light, rebuilt when the light or mesh changes
+    ShadowMap     * shadow;
+
+    // Optional texture image, not owned by the context, applied when the
+    // mesh has texture coordinates and RENDER_TEXTURES is set
+    SDL_Surface   * texture_source;
+
+    // Mip chain of the texture image, rebuilt when the image or target
+    // format changes
+    Texture       * texture;
+
+    // Shading of the last frame, reallocated when the target size changes
+    TemporalCache * temporal;
+
+    RenderTimings timings;
+    RenderStats   stats;
+
+    // Optional, must have been opened on the thread calling Render(). Adds
+    // the counters of the scheduler's workers, if they were opened.
+    PerfCounters   * perf;
+    RenderCounters   counters;
+
+    // Optional scheduler that faces and samples are drawn on, not owned by
+    // the context
+    JobSystem   * jobs;
+
+    // Optional, the frame is abandoned once this is set, and cancelled is
+    // set instead of finishing the target
+    SDL_atomic_t * cancel;
+    bool           cancelled;
+
+    // Rows drawn by this context, all of them when band_h is zero. Render()
+    // draws faces in bands of rows in parallel, each with a copy of the
+    // context.
+    int           band_y;
+    int           band_h;
+
+    // Per-frame rows of each face, in the frame arena, when drawing in bands
+    FaceRows    * face_rows;
+
+    // Set for a face that another band counts in the stats
+    bool          uncounted;
+
+    // Writes per pixel, for the overdraw ratio and heatmap
+    uint16_t    * overdraw;
+    size_t        overdraw_size;
 } RenderContext;
 
+static inline void
+RenderContextFree(
+    RenderContext * const context)
+{
+    SDL_assert(context);
+
+    SDL_FreeSurface(context->depth);
+    SDL_FreeSurface(context->color);
+    context->depth = NULL;
+    context->color = NULL;
+
+    context->projected = NULL;
+
+    ArenaFree(&context->arena);
+
+    free(context->lighting);
+    context->lighting = NULL;
+
+    free(context->texture);
+    context->texture = NULL;
+
+    free(context->shadow);
+    context->shadow = NULL;
+
+    free(context->temporal);
+    context->temporal = NULL;
+
+    free(context->screen_order.faces);
+    context->screen_order = (ScreenOrder){.faces = NULL};
+
+    free(context->overdraw);
+    context->overdraw      = NULL;
+    context->overdraw_size = 0;
+}
+
+// Drops everything kept between frames that was built from the current mesh.
+// Meshes are recognized by address, so this must be called before rendering
+// a mesh allocated after the last one was freed.
+static inline void
+RenderContextForgetMesh(
+    RenderContext * const context)
+{
+    SDL_assert(context);
+
+    free(context->shadow);
+    context->shadow = NULL;
+
+    free(context->temporal);
+    context->temporal = NULL;
+
+    free(context->screen_order.faces);
+    context->screen_order = (ScreenOrder){.faces = NULL};
+}
+
+static inline int
+ResetArena(
+    RenderContext * const context)
+{
+    SDL_assert(context);
+
+    const int status = ArenaReset(&context->arena);
+
+    context->projected   = NULL;
+    context->order       = NULL;
+    context->face_rows   = NULL;
+    context->light_tiles = (LightTiles){.offsets = NULL};
+
+    return status;
+}
+
+#if RENDER_STATS
+static inline void
+CountArena(
+    RenderContext * const context)
+{
+    SDL_assert(context);
+
+    context->stats.arena      = context->arena.used;
+    context->stats.arena_peak = SDL_max(context->arena.high_water, context->arena.used);
+}
+#endif
+
+// Sample positions within a pixel for each supported sample count, using a
+// rotated grid for 4x so that near-horizontal and near-vertical edges still
+// get four distinct coverage steps
+static const SDL_FPoint SAMPLES_1X[1] = {
+    {0.5f, 0.5f},
+};
+
+static const SDL_FPoint SAMPLES_2X[2] = {
+    {0.25f, 0.25f}, {0.75f, 0.75f},
+};
+
+static const SDL_FPoint SAMPLES_4X[4] = {
+    {0.375f, 0.125f}, {0.875f, 0.375f}, {0.125f, 0.625f}, {0.625f, 0.875f},
+};
+
+static inline const SDL_FPoint *
+SampleOffsets(
+    const int samples)
+{
+    switch (samples)
+    {
+        case 2:  return SAMPLES_2X;
+        case 4:  return SAMPLES_4X;
+
+        default:
+            SDL_assert(samples == 1);
+            return SAMPLES_1X;
+    }
+}
+
+static inline int
+PrepareBuffers(
+    RenderContext * const context)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(context->samples == 1
+            || context->samples == 2
+            || context->samples == 4);
+
+    const int width  = context->target->w * context->samples;
+    const int height = context->target->h;
+
+    if (!context->depth
+     || context->depth->w != width
+     || context->depth->h != height)
+    {
+        SDL_FreeSurface(context->depth);
+
+        context->depth = SDL_CreateRGBSurfaceWithFormat(
+            0 /* flags */,
+            width, height,
+            32, SDL_PIXELFORMAT_RGBA32
+        );
+
+        if (!context->depth)
+            return -1;
+    }
+
+#if RENDER_STATS
+    const size_t pixels = SizeMult((size_t)context->target->w, (size_t)height);
+
+    if (context->overdraw_size != pixels)
+    {
+        free(context->overdraw);
+        context->overdraw      = malloc(SizeMult(sizeof(uint16_t), pixels));
+        context->overdraw_size = (context->overdraw) ? pixels : 0;
+
+        if (!context->overdraw)
+            return SDL_SetError("Unable to allocate overdraw counts");
+    }
+#endif
+
+    if (context->samples == 1)
+    {
+        SDL_FreeSurface(context->color);
+        context->color = NULL;
+        return 0;
+    }
+
+    if (!context->color
+     || context->color->w != width
+     || context->color->h != height
+     || context->color->format->format != context->target->format->format)
+    {
+        SDL_FreeSurface(context->color);
+
+        context->color = SDL_CreateRGBSurfaceWithFormat(
+            0 /* flags */,
+            width, height,
+            32, context->target->format->format
+        );
+
+        if (!context->color)
+            return -1;
+    }
+
+    return 0;
+}
+
 static inline bool
 TestDepth(
           RenderContext * const context,
@@ -59,16 +424,17 @@ TestDepth(
 
     const SDL_Point point = {(int)coord->x, (int)coord->y};
 
-    if (point.x < 0 || point.x >= context->depth->w)
+    if (point.x < 0 || point.x >= context->depth->w / context->samples)
         return false;
 
     if (point.y < 0 || point.y >= context->depth->h)
         return false;
 
+    // Tests the first sample of the pixel
     float * depth = (float*)(
         (uint8_t*)context->depth->pixels
       + (point.y * context->depth->pitch)
-      + (point.x * context->depth->format->BytesPerPixel)
+      + (point.x * context->depth->format->BytesPerPixel * context->samples)
     );
 
     if (*depth > coord->z)
@@ -95,10 +461,37 @@ TestBackface(
            normal = VectorNormalize(&normal);
 
     const Vector cam_to_tri = VectorSub(
-        &tri[0], &context->camera.pos
+        &tri[0], &context->eye
     );
 
-    return (VectorDot(&normal, &cam_to_tri) < 0.0f);
+    const bool front = (VectorDot(&normal, &cam_to_tri) < 0.0f);
+
+    RENDER_COUNT(context, faces,  !context->uncounted);
+    RENDER_COUNT(context, culled, !front && !context->uncounted);
+
+    return front;
+}
+
+// Counts a pixel write, for the overdraw ratio and heatmap
+static inline void
+CountWrite(
+          RenderContext * const context,
+    const int                   x,
+    const int                   y)
+{
+#if RENDER_STATS
+    SDL_assert(context && context->overdraw);
+
+    RENDER_COUNT(context, written, 1);
+
+    uint16_t * const count = &context->overdraw[y * context->target->w + x];
+    if (*count < UINT16_MAX)
+        (*count)++;
+#else
+    (void)context;
+    (void)x;
+    (void)y;
+#endif
 }
 
 static inline void
@@ -139,171 +532,1774 @@ DrawLine(
           RenderContext * const context,
     const Vector        * const start,
     const Vector        * const end,
-    const SDL_Color     * const color)
+    const uint32_t              color)
 {
-    SDL_assert(context);
+    SDL_assert(context && context->target && context->depth);
     SDL_assert(start);
     SDL_assert(end);
-    SDL_assert(color);
+    SDL_assert(context->target->format->BytesPerPixel == (int)sizeof(uint32_t));
+    SDL_assert(context->target->pitch % (int)sizeof(uint32_t) == 0);
 
-    const Vector delta = {
-        .x =  fabsf(end->x - start->x),
-        .y = -fabsf(end->y - start->y),
-    };
+    if (!isfinite(start->x) || !isfinite(start->y) || !isfinite(start->z))
+        return;
 
-    const Vector step = {
-        .x = (start->x < end->x) ? 1 : -1,
-        .y = (start->y < end->y) ? 1 : -1,
-    };
+    if (!isfinite(end->x) || !isfinite(end->y) || !isfinite(end->z))
+        return;
+
+    SDL_Surface * const target = context->target;
+
+    // Liang-Barsky clip against the target bounds, so that the raster loop
+    // below never needs to test a pixel coordinate
+    const Vector delta = VectorSub(end, start);
+
+    float t0 = 0.0f;
+    float t1 = 1.0f;
+    {
+        const float p[4] = {-delta.x, delta.x, -delta.y, delta.y};
+        const float q[4] = {
+            start->x,
+            (float)(target->w - 1) - start->x,
+            start->y,
+            (float)(target->h - 1) - start->y,
+        };
+
+        for (size_t i = 0; i < 4; ++i)
+        {
+            if (p[i] == 0.0f)
+            {
+                if (q[i] < 0.0f)
+                    return;
+
+                continue;
+            }
+
+            const float t = q[i] / p[i];
+
+            if (p[i] < 0.0f)
+            {
+                if (t > t1)
+                    return;
+
+                t0 = fmaxf(t0, t);
+            }
+            else
+            {
+                if (t < t0)
+                    return;
+
+                t1 = fminf(t1, t);
+            }
+        }
+    }
+
+    int x0 = (int)roundf(start->x + delta.x * t0);
+    int y0 = (int)roundf(start->y + delta.y * t0);
+
+    const int x1 = (int)roundf(start->x + delta.x * t1);
+    const int y1 = (int)roundf(start->y + delta.y * t1);
+
+    SDL_assert(x0 >= 0 && x0 < target->w && y0 >= 0 && y0 < target->h);
+    SDL_assert(x1 >= 0 && x1 < target->w && y1 >= 0 && y1 < target->h);
+
+    // Integer Bresenham, writing straight into the target surface
+    const int dx =  abs(x1 - x0);
+    const int dy = -abs(y1 - y0);
 
-    Vector pos = *start;
-    float  err = delta.x + delta.y;
+    const int step_x = (x0 < x1) ? 1 : -1;
+    const int step_y = (y0 < y1) ? 1 : -1;
+
+    const int pitch = target->pitch / (int)sizeof(uint32_t);
+
+    uint32_t * pixel = (uint32_t*)target->pixels + (y0 * pitch) + x0;
+
+    // Optional depth test against a prior depth-only pass of the faces
+    const float * depth       = NULL;
+          int     depth_pitch = 0;
+
+    if (context->flags & RENDER_HIDDEN_LINES)
+    {
+        SDL_assert(context->depth->w == target->w * context->samples);
+        SDL_assert(context->depth->h == target->h);
+
+        // Tests the first sample of each pixel
+        depth_pitch = context->depth->pitch / (int)sizeof(float);
+        depth = (const float*)context->depth->pixels
+              + (y0 * depth_pitch)
+              + (x0 * context->samples);
+    }
+
+    const int depth_step_x = step_x * context->samples;
+
+    // Edges lie on the surface they bound, so only reject them when they are
+    // clearly behind it
+    const float depth_bias = 2.0f;
+
+    const int steps = (dx > -dy) ? dx : -dy;
+
+    float       z      = start->z + delta.z * t0;
+    const float z_step = (steps > 0) ? (delta.z * (t1 - t0)) / (float)steps : 0.0f;
+
+    int err = dx + dy;
 
     while (true)
     {
-        PutFragment(context, &pos, color);
+        if (!depth || z + depth_bias >= *depth)
+        {
+            *pixel = color;
+            CountWrite(context, x0, y0);
+        }
+
+        if (x0 == x1 && y0 == y1)
+            break;
 
-        if ((err * 2) >= delta.y)
+        const int err2 = err * 2;
+
+        if (err2 >= dy)
         {
-            if (fabsf(pos.x - end->x) < 1.0f)
-                break;
+            err   += dy;
+            x0    += step_x;
+            pixel += step_x;
 
-            err += delta.y;
-            pos.x += step.x;
+            if (depth)
+                depth += depth_step_x;
         }
 
-        if ((err * 2) <= delta.x)
+        if (err2 <= dx)
         {
-            if (fabsf(pos.y - end->y) < 1.0f)
-                break;
+            err   += dx;
+            y0    += step_y;
+            pixel += step_y * pitch;
 
-            err += delta.x;
-            pos.y += step.y;
+            if (depth)
+                depth += step_y * depth_pitch;
         }
+
+        z += z_step;
     }
 }
 
-static inline Matrix
-GetViewport(
-    const SDL_FRect * const bounds,
-    const float             depth)
+static void
+FaceRowsJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
 {
-    SDL_assert(bounds);
+    RenderContext * const context = data;
+    SDL_assert(context && context->target && context->projected && context->face_rows);
 
-    Matrix matrix = MatrixIdentity();
-    matrix.m[0][0] = bounds->w / 2.0f;
-    matrix.m[0][3] = bounds->x + bounds->w / 2.0f;
+    (void)worker;
 
-    matrix.m[1][1] = bounds->h / 2.0f;
-    matrix.m[1][3] = bounds->y + bounds->h / 2.0f;
+    const Mesh  * const mesh = context->mesh;
+    const float         last = (float)(context->target->h - 1);
 
-    matrix.m[2][2] = depth / 2.0f;
-    matrix.m[2][3] = depth * 2.0f;
+    for (size_t i = begin; i < end; ++i)
+    {
+        size_t vertex_index[3];
+        FaceVertices(&mesh->faces, i, vertex_index);
 
-    return matrix;
+        bool  finite = true;
+        float min_y  =  INFINITY;
+        float max_y  = -INFINITY;
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            const Vector * const vert = &context->projected[vertex_index[j]];
+
+            finite &= isfinite(vert->x) && isfinite(vert->y) && isfinite(vert->z);
+            min_y   = fminf(min_y, vert->y);
+            max_y   = fmaxf(max_y, vert->y);
+        }
+
+        // The same first row as TriangleSetup(), and a row past the last
+        // to allow for its rounding. Faces it rejects outright are counted
+        // by the first band.
+        context->face_rows[i] = (finite)
+            ? (FaceRows){
+                .top    = (int)fminf(fmaxf(floorf(min_y), 0.0f), last),
+                .bottom = (int)fminf(fmaxf(ceilf(max_y) + 1.0f, -1.0f), last),
+            }
+            : (FaceRows){.top = 0, .bottom = -1};
+    }
 }
 
-static inline Matrix
-LookAt(
-    const Camera * const camera)
+// Face drawn at a position in this frame's order
+static inline size_t
+FrameFace(
+    const RenderContext * const context,
+    const size_t                position)
 {
-    SDL_assert(camera);
+    SDL_assert(context);
 
-    Vector z = VectorSub(&camera->pos, &camera->focus);
-           z = VectorNormalize(&z);
+    return (context->order) ? (size_t)context->order[position] : position;
+}
 
-    Vector x = VectorCross(&camera->up, &z);
-           x = VectorNormalize(&x);
+// Whether a face may cover any row of the context's band. Faces spanning
+// several bands are drawn by each, but only counted by the band holding
+// their top row, so that the stats match drawing in one piece.
+static inline bool
+FaceInBand(
+          RenderContext * const context,
+    const size_t                face)
+{
+    SDL_assert(context);
 
-    Vector y = VectorCross(&z, &x);
-           y = VectorNormalize(&y);
+    if (!context->band_h)
+        return true;
 
-    Matrix minv      = MatrixIdentity();
-    Matrix transform = MatrixIdentity();
-    for (size_t i = 0; i < 3; ++i)
-    {
-        minv.m[0][i] = x.xyz[i];
-        minv.m[1][i] = y.xyz[i];
-        minv.m[2][i] = z.xyz[i];
-        transform.m[i][3] = -camera->focus.xyz[i];
-    }
+    SDL_assert(context->face_rows);
 
-    return MatrixMult(&minv, &transform);
+    const FaceRows * const rows = &context->face_rows[face];
+    const int              end  = context->band_y + context->band_h;
+
+    context->uncounted = (rows->top < context->band_y || rows->top >= end);
+
+    return !context->uncounted
+        || (rows->bottom >= context->band_y && rows->top < end);
 }
 
-static void RenderWireframe(RenderContext * const, const Matrix * const);
-static void RenderFlat     (RenderContext * const, const Matrix * const);
-static void RenderGouraud  (RenderContext * const, const Matrix * const);
-static void RenderPhong    (RenderContext * const, const Matrix * const);
-static void RenderToon     (RenderContext * const, const Matrix * const);
+typedef struct Triangle {
+    Vector   verts[3];
+    Vector   weights[3];  // Barycentric planes, w = x * p.x + y * p.y + p.z
+    Vector   depth;       // Depth plane, in the same form
+    SDL_Rect bounds;      // Covered pixels, clipped to the target
+} Triangle;
 
-static inline int
-Render(
-    RenderContext * const context)
+static inline bool
+TriangleSetup(
+          RenderContext * const context,
+          Triangle      * const tri,
+    const Vector        * const verts)
 {
-    SDL_assert(context);
-    SDL_assert(context->target);
-    SDL_assert(context->mesh);
-    SDL_assert(context->depth);
+    SDL_assert(context && context->target);
+    SDL_assert(tri);
+    SDL_assert(verts);
 
-    SDL_FillRect(context->target, NULL, 0);
-    SDL_FillRect(context->depth,  NULL, 0);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (!isfinite(verts[i].x) || !isfinite(verts[i].y) || !isfinite(verts[i].z))
+        {
+            RENDER_COUNT(context, clipped, !context->uncounted);
+            return false;
+        }
 
-    if (SDL_MUSTLOCK(context->target))
-        if (SDL_LockSurface(context->target) != 0)
-            goto Error_SurfaceLocking;
+        tri->verts[i] = verts[i];
+    }
 
-    if (SDL_MUSTLOCK(context->depth))
-        if (SDL_LockSurface(context->depth) != 0)
-            goto Error_SurfaceLocking;
+    const float area = (verts[1].x - verts[0].x) * (verts[2].y - verts[0].y)
+                     - (verts[1].y - verts[0].y) * (verts[2].x - verts[0].x);
 
-    Matrix projection = MatrixIdentity();
+    // Triangle is degenerate
+    if (fabsf(area) < 1e-6f)
     {
-        const Vector camera = VectorSub(
-            &context->camera.pos, &context->camera.focus
-        );
-
-        projection.m[3][2] = 1.0f / VectorMag(&camera);
+        RENDER_COUNT(context, clipped, !context->uncounted);
+        return false;
     }
 
-    const Matrix viewport = GetViewport(
-        &(SDL_FRect){
-            .x = (float)WINDOW_WIDTH  / 8.0f,
-            .y = (float)WINDOW_HEIGHT / 8.0f,
-            .w = (float)WINDOW_WIDTH  * 0.25f,
-            .h = (float)WINDOW_HEIGHT * 0.25f,
-        },
-        255.0f /* depth */
-    );
+    const float inv_area = 1.0f / area;
 
-    const Camera camera_old = context->camera;
+    // Edge function opposite each vertex, pre-scaled by the area so that it
+    // evaluates directly to that vertex's barycentric weight
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector * const a = &verts[(i + 1) % 3];
+        const Vector * const b = &verts[(i + 2) % 3];
+
+        tri->weights[i] = (Vector){
+            .x = (a->y - b->y) * inv_area,
+            .y = (b->x - a->x) * inv_area,
+            .z = (a->x * b->y - a->y * b->x) * inv_area,
+        };
+    }
 
-    context->camera.pos = QuaternionRotatev(
-        &context->rotation, &context->camera.pos
-    );
+    tri->depth = (Vector){.x = 0.0f};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector plane = VectorMultf(&tri->weights[i], verts[i].z);
+        tri->depth = VectorAdd(&tri->depth, &plane);
+    }
 
-    const Matrix model = LookAt(&context->camera);
+    const SDL_FRect bounds = TriBoundingBox(verts);
 
-    Matrix mvpm = MatrixMult(&viewport, &projection);
-           mvpm = MatrixMult(&mvpm, &model);
+    const int min_x = SDL_max((int)floorf(bounds.x), 0);
+    const int max_x = SDL_min((int)ceilf(bounds.x + bounds.w), context->target->w - 1);
+          int min_y = SDL_max((int)floorf(bounds.y), 0);
+          int max_y = SDL_min((int)ceilf(bounds.y + bounds.h), context->target->h - 1);
 
-    void (*render_func)(RenderContext * const, const Matrix * const) = NULL;
-    switch (context->mode)
+    if (min_x > max_x || min_y > max_y)
     {
-        case RENDER_WIREFRAME: render_func = RenderWireframe; break;
-        case RENDER_FLAT:      render_func = RenderFlat;      break;
-        case RENDER_GOURAUD:   render_func = RenderGouraud;   break;
-        case RENDER_PHONG:     render_func = RenderPhong;     break;
-        case RENDER_TOON:      render_func = RenderToon;      break;
+        RENDER_COUNT(context, clipped, !context->uncounted);
+        return false;
+    }
 
-        default:
-            SDL_assert(0);
+    // Partly drawn by other bands, which isn't clipping
+    if (context->band_h)
+    {
+        min_y = SDL_max(min_y, context->band_y);
+        max_y = SDL_min(max_y, context->band_y + context->band_h - 1);
+
+        if (min_y > max_y)
+            return false;
     }
 
-    if (render_func)
-        render_func(context, &mvpm);
+    tri->bounds = (SDL_Rect){
+        .x = min_x,
+        .y = min_y,
+        .w = max_x - min_x + 1,
+        .h = max_y - min_y + 1,
+    };
+
+    return true;
+}
+
+// Depth tests every sample of a pixel against the triangle, returning a mask
+// of the samples that are covered and visible. The barycentric coordinate of
+// the first such sample is written to coord for shading, or zero if none.
+static inline unsigned
+TestSamples(
+          RenderContext * const context,
+    const Triangle      * const tri,
+    const int                   x,
+    const int                   y,
+          Vector        * const coord)
+{
+    SDL_assert(context && context->depth);
+    SDL_assert(tri);
+    SDL_assert(coord);
+    SDL_assert(x >= 0 && x < context->depth->w / context->samples);
+    SDL_assert(y >= 0 && y < context->depth->h);
+
+    const SDL_FPoint * const offsets = SampleOffsets(context->samples);
+
+    float * const depth = (float*)(
+        (uint8_t*)context->depth->pixels
+      + (y * context->depth->pitch)
+    ) + (x * context->samples);
+
+    *coord = (Vector){.x = 0.0f};
+
+    unsigned mask = 0;
+    for (int i = 0; i < context->samples; ++i)
+    {
+        const float px = (float)x + offsets[i].x;
+        const float py = (float)y + offsets[i].y;
+
+        const Vector weight = {
+            .x = tri->weights[0].x * px + tri->weights[0].y * py + tri->weights[0].z,
+            .y = tri->weights[1].x * px + tri->weights[1].y * py + tri->weights[1].z,
+            .z = tri->weights[2].x * px + tri->weights[2].y * py + tri->weights[2].z,
+        };
+
+        if (weight.x < 0.0f || weight.y < 0.0f || weight.z < 0.0f)
+            continue;
+
+        const float z = tri->depth.x * px + tri->depth.y * py + tri->depth.z;
+
+        if (depth[i] > z)
+            continue;
+
+        depth[i] = z;
+
+        if (!mask)
+            *coord = weight;
+
+        mask |= 1u << i;
+    }
+
+    RENDER_COUNT(context, tested, 1);
+    RENDER_COUNT(context, passed, mask != 0);
+
+    return mask;
+}
+
+static inline void
+PutSamples(
+          RenderContext * const context,
+    const int                   x,
+    const int                   y,
+    const unsigned              mask,
+    const uint32_t              color)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(mask);
+
+    CountWrite(context, x, y);
+
+    if (context->samples == 1)
+    {
+        uint32_t * const pixel = (uint32_t*)(
+            (uint8_t*)context->target->pixels
+          + (y * context->target->pitch)
+        ) + x;
+
+        *pixel = color;
+        return;
+    }
+
+    SDL_assert(context->color);
+
+    uint32_t * const samples = (uint32_t*)(
+        (uint8_t*)context->color->pixels
+      + (y * context->color->pitch)
+    ) + (x * context->samples);
+
+    for (int i = 0; i < context->samples; ++i)
+        if (mask & (1u << i))
+            samples[i] = color;
+}
+
+// Averages the samples of each pixel into the target. Channels are summed two
+// at a time in 16 bit lanes, which can't overflow for up to 256 samples.
+static void
+ResolveRows(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    RenderContext * const context = data;
+
+    SDL_assert(context && context->target && context->color);
+    SDL_assert(context->target->format->BytesPerPixel == (int)sizeof(uint32_t));
+    SDL_assert(context->color->w == context->target->w * context->samples);
+    SDL_assert(end <= (size_t)context->target->h);
+
+    (void)worker;
+
+    const int samples = context->samples;
+    const int shift   = (samples == 4) ? 2 : 1;
+
+    for (int y = (int)begin; y < (int)end; ++y)
+    {
+        const uint32_t * source = (const uint32_t*)(
+            (const uint8_t*)context->color->pixels
+          + (y * context->color->pitch)
+        );
+
+        uint32_t * dest = (uint32_t*)(
+            (uint8_t*)context->target->pixels
+          + (y * context->target->pitch)
+        );
+
+        for (int x = 0; x < context->target->w; ++x)
+        {
+            uint32_t even = 0;
+            uint32_t odd  = 0;
+
+            for (int i = 0; i < samples; ++i)
+            {
+                even += source[i]        & 0x00ff00ffu;
+                odd  += (source[i] >> 8) & 0x00ff00ffu;
+            }
+
+            dest[x] = ((even >> shift) & 0x00ff00ffu)
+                    | (((odd >> shift) & 0x00ff00ffu) << 8);
+
+            source += samples;
+        }
+    }
+}
+
+// Rows resolved at a time
+#define RESOLVE_GRAIN 16
+
+static inline void
+ResolveSamples(
+    RenderContext * const context)
+{
+    SDL_assert(context && context->target);
+
+    JobParallelFor(
+        context->jobs, (size_t)context->target->h, RESOLVE_GRAIN,
+        ResolveRows, context
+    );
+}
+
+// Texture to apply this frame, if any
+static inline const Texture *
+FrameTexture(
+    const RenderContext * const context)
+{
+    SDL_assert(context && context->mesh);
+
+    if (!(context->flags & RENDER_TEXTURES)
+     || !context->texture_source
+     || !context->mesh->faces.t)
+        return NULL;
+
+    return context->texture;
+}
+
+// Diffuse color of a material to modulate its faces with, or zero when the
+// material leaves them unchanged
+static inline uint32_t
+MaterialTint(
+    const RenderContext * const context,
+    const size_t                material)
+{
+    SDL_assert(context && context->mesh);
+    SDL_assert(material < context->mesh->materials.size);
+
+    const Vector * const diffuse = &context->mesh->materials.data[material].diffuse;
+
+    if (diffuse->x >= 1.0f && diffuse->y >= 1.0f && diffuse->z >= 1.0f)
+        return 0;
+
+    return SDL_MapRGBA(
+        context->target->format,
+        (uint8_t)(fmaxf(fminf(diffuse->x, 1.0f), 0.0f) * 255.0f),
+        (uint8_t)(fmaxf(fminf(diffuse->y, 1.0f), 0.0f) * 255.0f),
+        (uint8_t)(fmaxf(fminf(diffuse->z, 1.0f), 0.0f) * 255.0f),
+        255
+    );
+}
+
+static inline uint32_t
+MaterialShade(
+    const uint32_t tint,
+    const uint32_t color)
+{
+    return (tint) ? ModulatePixel(color, tint) : color;
+}
+
+// Shadow map to test against this frame, if any
+static inline const ShadowMap *
+FrameShadow(
+    const RenderContext * const context)
+{
+    SDL_assert(context);
+
+    if (!(context->flags & RENDER_SHADOWS) || context->mode == RENDER_WIREFRAME)
+        return NULL;
+
+    return context->shadow;
+}
+
+// Only per pixel shading with many lights is worth reprojecting, and specular
+// highlights move with the camera so can't be
+static inline bool
+TemporalEnabled(
+    const RenderContext * const context)
+{
+    SDL_assert(context);
+
+    return (context->flags & RENDER_TEMPORAL)
+        && !(context->flags & RENDER_SPECULAR)
+        && (context->mode == RENDER_PHONG || context->mode == RENDER_TOON)
+        && context->lights.size >= TEMPORAL_MIN_LIGHTS;
+}
+
+// Shading to reproject and store this frame, if any
+static inline TemporalCache *
+FrameTemporal(
+    const RenderContext * const context)
+{
+    SDL_assert(context);
+
+    if (!TemporalEnabled(context))
+        return NULL;
+
+    return context->temporal;
+}
+
+// Shadow map coordinates divided by w, and 1 / w, at each vertex, so that
+// they can be interpolated linearly like texture coordinates. Only set for
+// faces that are partially shadowed.
+typedef struct ShadowPlanes {
+    Vector      x;
+    Vector      y;
+    Vector      z;
+    Vector      q;
+    float       bias;
+    ShadowState state;
+} ShadowPlanes;
+
+// Takes the face vertices before projection, as w is lost after
+static inline void
+ShadowPlanesInit(
+          ShadowPlanes * const planes,
+    const ShadowMap    * const shadow,
+    const size_t               face,
+    const size_t       * const vertex_index,
+    const Vector       * const verts,
+    const Matrix       * const model_view_projection)
+{
+    SDL_assert(planes);
+    SDL_assert(shadow);
+    SDL_assert(face < shadow->face_count);
+    SDL_assert(vertex_index);
+    SDL_assert(verts);
+    SDL_assert(model_view_projection);
+
+    planes->bias  = shadow->faces[face].bias;
+    planes->state = shadow->faces[face].state;
+
+    if (planes->state != SHADOW_PARTIAL)
+        return;
+
+    const Matrix * const m = model_view_projection;
+
+    for (size_t j = 0; j < 3; ++j)
+    {
+        const float w = m->m[3][0] * verts[j].x
+                      + m->m[3][1] * verts[j].y
+                      + m->m[3][2] * verts[j].z
+                      + m->m[3][3];
+
+        const Vector * const coord = &shadow->coords[vertex_index[j]];
+
+        planes->q.xyz[j] = 1.0f / w;
+        planes->x.xyz[j] = coord->x * planes->q.xyz[j];
+        planes->y.xyz[j] = coord->y * planes->q.xyz[j];
+        planes->z.xyz[j] = coord->z * planes->q.xyz[j];
+    }
+}
+
+// Darkens a shaded color by how much of it the shadow map hides from the
+// light
+static inline uint32_t
+ShadowShade(
+    const RenderContext * const context,
+    const ShadowPlanes  * const planes,
+    const Vector        * const coord,
+    const uint32_t              color)
+{
+    SDL_assert(context && context->shadow);
+    SDL_assert(planes);
+    SDL_assert(coord);
+
+    const ShadowMap * const shadow = context->shadow;
+
+    if (planes->state != SHADOW_PARTIAL)
+        return (planes->state == SHADOW_LIT)
+            ? color
+            : ModulatePixel(color, shadow->levels[0]);
+
+    const float w = 1.0f / VectorDot(coord, &planes->q);
+
+    const Vector light_coord = {
+        .x = VectorDot(coord, &planes->x) * w,
+        .y = VectorDot(coord, &planes->y) * w,
+        .z = VectorDot(coord, &planes->z) * w,
+    };
+
+    const int lit = ShadowMapTest(
+        shadow,
+        &light_coord,
+        planes->bias,
+        (context->flags & RENDER_SHADOW_PCF) != 0
+    );
+
+    return (lit == 9) ? color : ModulatePixel(color, shadow->levels[lit]);
+}
+
+// Texture coordinates divided by w, and 1 / w, at each vertex and as their
+// screen space derivatives, so that they can be interpolated linearly and
+// divided back per pixel
+typedef struct TexturePlanes {
+    Vector u;
+    Vector v;
+    Vector q;
+    Vector dx;  // Of u / w, v / w and 1 / w
+    Vector dy;
+} TexturePlanes;
+
+// Takes the face vertices before projection, as w is lost after
+static inline void
+TexturePlanesInit(
+          TexturePlanes * const planes,
+    const Mesh          * const mesh,
+    const size_t                face,
+    const Vector        * const verts,
+    const Matrix        * const model_view_projection)
+{
+    SDL_assert(planes);
+    SDL_assert(mesh && mesh->faces.t);
+    SDL_assert(verts);
+    SDL_assert(model_view_projection);
+
+    const Matrix * const m = model_view_projection;
+
+    size_t texcoord_index[3];
+    FaceTexCoords(&mesh->faces, face, texcoord_index);
+
+    for (size_t j = 0; j < 3; ++j)
+    {
+        const float w = m->m[3][0] * verts[j].x
+                      + m->m[3][1] * verts[j].y
+                      + m->m[3][2] * verts[j].z
+                      + m->m[3][3];
+
+        const TexCoord * const uv = &mesh->texcoords.data[texcoord_index[j]];
+
+        planes->q.xyz[j] = 1.0f / w;
+        planes->u.xyz[j] = uv->u * planes->q.xyz[j];
+        // Images are stored top down, texture coordinates are bottom up
+        planes->v.xyz[j] = (1.0f - uv->v) * planes->q.xyz[j];
+    }
+}
+
+static inline void
+TexturePlanesDerive(
+          TexturePlanes * const planes,
+    const Triangle      * const tri)
+{
+    SDL_assert(planes);
+    SDL_assert(tri);
+
+    const Vector dwx = {
+        .x = tri->weights[0].x, .y = tri->weights[1].x, .z = tri->weights[2].x,
+    };
+
+    const Vector dwy = {
+        .x = tri->weights[0].y, .y = tri->weights[1].y, .z = tri->weights[2].y,
+    };
+
+    planes->dx = (Vector){
+        .x = VectorDot(&dwx, &planes->u),
+        .y = VectorDot(&dwx, &planes->v),
+        .z = VectorDot(&dwx, &planes->q),
+    };
+
+    planes->dy = (Vector){
+        .x = VectorDot(&dwy, &planes->u),
+        .y = VectorDot(&dwy, &planes->v),
+        .z = VectorDot(&dwy, &planes->q),
+    };
+}
+
+// Modulates a shaded color by the texture at a sample, with the mip level
+// chosen from the screen space derivatives of the texture coordinates
+static inline uint32_t
+TextureShade(
+    const Texture       * const texture,
+    const TexturePlanes * const planes,
+    const Vector        * const coord,
+    const uint32_t              color)
+{
+    SDL_assert(texture);
+    SDL_assert(planes);
+    SDL_assert(coord);
+
+    const float w = 1.0f / VectorDot(coord, &planes->q);
+    const float u = VectorDot(coord, &planes->u) * w;
+    const float v = VectorDot(coord, &planes->v) * w;
+
+    const float dudx = (planes->dx.x - u * planes->dx.z) * w;
+    const float dvdx = (planes->dx.y - v * planes->dx.z) * w;
+    const float dudy = (planes->dy.x - u * planes->dy.z) * w;
+    const float dvdy = (planes->dy.y - v * planes->dy.z) * w;
+
+    const float footprint = fmaxf(
+        dudx * dudx + dvdx * dvdx,
+        dudy * dudy + dvdy * dvdy
+    ) * (float)(1u << (texture->size_log2 * 2));
+
+    return ModulatePixel(TextureSample(texture, u, v, footprint), color);
+}
+
+static inline int
+ProjectVertices(
+          RenderContext * const context,
+    const Matrix        * const model_view_projection)
+{
+    SDL_assert(context && context->mesh);
+    SDL_assert(model_view_projection);
+
+    const Mesh * const mesh = context->mesh;
+
+    context->projected = ArenaAllocArray(
+        &context->arena, mesh->vertices.size, sizeof(Vector)
+    );
+
+    if (!context->projected)
+        return -1;
+
+    for (size_t i = 0; i < mesh->vertices.size; ++i)
+    {
+        Vector vert = mesh->vertices.data[i];
+               vert.y *= -1.0f;
+
+        context->projected[i] = MatrixMultv(model_view_projection, &vert);
+    }
+
+    return 0;
+}
+
+// Spreads the low 16 bits of a value out to the even bits
+static inline uint32_t
+MortonSpread(
+    uint32_t value)
+{
+    value &= 0xffffu;
+    value  = (value | (value << 8)) & 0x00ff00ffu;
+    value  = (value | (value << 4)) & 0x0f0f0f0fu;
+    value  = (value | (value << 2)) & 0x33333333u;
+    value  = (value | (value << 1)) & 0x55555555u;
+
+    return value;
+}
+
+// Screen coordinate as a Morton code input, with off screen and non-finite
+// coordinates clamped to the edges
+static inline uint32_t
+MortonCoord(
+    const float value)
+{
+    if (!(value > 0.0f))
+        return 0;
+
+    return (value < 65535.0f) ? (uint32_t)value : 65535u;
+}
+
+// Faces keyed at a time
+#define SCREEN_ORDER_GRAIN 4096
+
+// Furthest the view turns before faces are sorted again. Nearby views put
+// faces close to where they were on screen, which keeps most of the
+// locality for a fraction of the sorting.
+#define SCREEN_ORDER_DEGREES 8.0f
+
+typedef struct ScreenKeys {
+    const RenderContext * context;
+          uint64_t      * keys;
+          uint32_t      * order;
+} ScreenKeys;
+
+// Keys each face by the Morton code of its screen center above its index, so
+// that sorting by the upper half walks the screen in Z-order
+static void
+ScreenKeysJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    const ScreenKeys    * const screen  = data;
+    const RenderContext * const context = screen->context;
+
+    (void)worker;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        size_t vertex_index[3];
+        FaceVertices(&context->mesh->faces, i, vertex_index);
+
+        float x = 0.0f;
+        float y = 0.0f;
+        for (size_t j = 0; j < 3; ++j)
+        {
+            x += context->projected[vertex_index[j]].x;
+            y += context->projected[vertex_index[j]].y;
+        }
+
+        const uint32_t code = MortonSpread(MortonCoord(x / 3.0f))
+                            | MortonSpread(MortonCoord(y / 3.0f)) << 1;
+
+        screen->keys[i] = (uint64_t)code << 32 | (uint64_t)i;
+    }
+}
+
+static void
+ScreenOrderJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    const ScreenKeys * const screen = data;
+
+    (void)worker;
+
+    for (size_t i = begin; i < end; ++i)
+        screen->order[i] = (uint32_t)screen->keys[i];
+}
+
+// Chooses the order to draw faces in this frame. By default that's the one
+// sorted front to back along the direction nearest the camera, so nearer
+// faces hide the rest before they are shaded. With RENDER_SCREEN_ORDER the
+// faces are instead sorted by their screen centers, so consecutive faces
+// touch nearby depth and color lines while they are still cached.
+static inline int
+OrderFaces(
+          RenderContext * const context,
+    const Camera        * const camera)
+{
+    SDL_assert(context && context->mesh && context->projected);
+    SDL_assert(camera);
+
+    const Mesh * const mesh = context->mesh;
+
+    if (!(context->flags & RENDER_SCREEN_ORDER) || mesh->faces.size > UINT32_MAX)
+    {
+        Vector view = VectorSub(&camera->pos, &camera->focus);
+               view.y *= -1.0f;
+
+        context->order = MeshFaceOrder(mesh, &view);
+        return 0;
+    }
+
+    ScreenOrder * const sorted = &context->screen_order;
+
+    const float turn = cosf(SCREEN_ORDER_DEGREES * (float)M_PI / 360.0f);
+
+    if (sorted->faces
+     && sorted->mesh   == mesh
+     && sorted->size   == mesh->faces.size
+     && sorted->width  == context->target->w
+     && sorted->height == context->target->h
+     && fabsf(QuaternionDot(&sorted->rotation, &context->rotation)) >= turn)
+    {
+        context->order = sorted->faces;
+        return 0;
+    }
+
+    if (sorted->size != mesh->faces.size)
+    {
+        free(sorted->faces);
+        *sorted = (ScreenOrder){
+            .faces = malloc(SizeMult(sizeof(uint32_t), mesh->faces.size)),
+            .size  = mesh->faces.size,
+        };
+
+        if (!sorted->faces)
+        {
+            sorted->size = 0;
+            return SDL_SetError("Unable to allocate screen order");
+        }
+    }
+
+    // Left unsorted if anything fails
+    sorted->mesh = NULL;
+
+    uint64_t * const keys = ArenaAllocArray(&context->arena, mesh->faces.size, sizeof(uint64_t));
+
+    if (!keys)
+        return -1;
+
+    ScreenKeys screen = {context, keys, sorted->faces};
+
+    JobParallelFor(context->jobs, mesh->faces.size, SCREEN_ORDER_GRAIN, ScreenKeysJob, &screen);
+
+    // Faces stay within their material ranges
+    for (size_t r = 0; r < mesh->ranges.size; ++r)
+    {
+        const MaterialRange * const range = &mesh->ranges.data[r];
+
+        if (JobRadixSort(context->jobs, &context->arena, &keys[range->start], range->count, 32, 64))
+            return -1;
+    }
+
+    JobParallelFor(context->jobs, mesh->faces.size, SCREEN_ORDER_GRAIN, ScreenOrderJob, &screen);
+
+    sorted->mesh     = mesh;
+    sorted->rotation = context->rotation;
+    sorted->width    = context->target->w;
+    sorted->height   = context->target->h;
+
+    context->order = sorted->faces;
+    return 0;
+}
+
+// Range of tiles a light can reach, from the screen bounds of the box around
+// its sphere of influence. Returns false if entirely off screen.
+static inline bool
+LightTileBounds(
+    const RenderContext * const context,
+    const Light         * const light,
+    const Matrix        * const model_view_projection,
+          SDL_Rect      * const tiles)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(light);
+    SDL_assert(model_view_projection);
+    SDL_assert(tiles);
+
+    const Matrix * const m = model_view_projection;
+
+    const LightTiles * const grid = &context->light_tiles;
+
+    SDL_FRect bounds = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+
+    for (int i = 0; i < 8; ++i)
+    {
+        Vector corner = light->position;
+        corner.x += (i & 1) ? light->radius : -light->radius;
+        corner.y += (i & 2) ? light->radius : -light->radius;
+        corner.z += (i & 4) ? light->radius : -light->radius;
+        corner.y *= -1.0f;
+
+        const float w = m->m[3][0] * corner.x
+                      + m->m[3][1] * corner.y
+                      + m->m[3][2] * corner.z
+                      + m->m[3][3];
+
+        // Behind the camera, so may cover anything
+        if (w <= 1e-6f)
+        {
+            *tiles = (SDL_Rect){0, 0, grid->columns, grid->rows};
+            return true;
+        }
+
+        const Vector point = MatrixMultv(m, &corner);
+
+        bounds.x = fminf(bounds.x, point.x);
+        bounds.y = fminf(bounds.y, point.y);
+        bounds.w = fmaxf(bounds.w, point.x);
+        bounds.h = fmaxf(bounds.h, point.y);
+    }
+
+    if (bounds.w < 0.0f || bounds.h < 0.0f
+     || bounds.x >= (float)context->target->w
+     || bounds.y >= (float)context->target->h)
+        return false;
+
+    const int min_x = (int)fmaxf(bounds.x, 0.0f) / LIGHT_TILE_SIZE;
+    const int min_y = (int)fmaxf(bounds.y, 0.0f) / LIGHT_TILE_SIZE;
+    const int max_x = (int)fminf(bounds.w, (float)(context->target->w - 1)) / LIGHT_TILE_SIZE;
+    const int max_y = (int)fminf(bounds.h, (float)(context->target->h - 1)) / LIGHT_TILE_SIZE;
+
+    *tiles = (SDL_Rect){min_x, min_y, max_x - min_x + 1, max_y - min_y + 1};
+    return true;
+}
+
+// Builds the list of lights reaching each screen tile, counting each tile's
+// lights and then filling them in
+static inline int
+CullLights(
+          RenderContext * const context,
+    const Matrix        * const model_view_projection)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(model_view_projection);
+    SDL_assert(context->lights.size <= UINT16_MAX);
+
+    LightTiles * const grid = &context->light_tiles;
+
+    grid->columns = (context->target->w + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    grid->rows    = (context->target->h + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+
+    const size_t tile_count = (size_t)grid->columns * (size_t)grid->rows;
+
+    SDL_Rect * const bounds = ArenaAllocArray(
+        &context->arena, context->lights.size, sizeof(SDL_Rect)
+    );
+
+    grid->offsets = ArenaAllocArray(
+        &context->arena, tile_count + 2, sizeof(uint32_t)
+    );
+
+    if (!bounds || !grid->offsets)
+        return -1;
+
+    memset(grid->offsets, 0, sizeof(uint32_t) * (tile_count + 2));
+
+    size_t total = context->lights.size;
+
+    for (size_t i = 0; i < context->lights.size; ++i)
+    {
+        if (!LightTileBounds(context, &context->lights.data[i], model_view_projection, &bounds[i]))
+        {
+            bounds[i] = (SDL_Rect){0};
+            continue;
+        }
+
+        RENDER_COUNT(context, lights, 1);
+
+        for (int y = bounds[i].y; y < bounds[i].y + bounds[i].h; ++y)
+            for (int x = bounds[i].x; x < bounds[i].x + bounds[i].w; ++x)
+                grid->offsets[(size_t)y * (size_t)grid->columns + (size_t)x + 1]++;
+
+        total += (size_t)bounds[i].w * (size_t)bounds[i].h;
+    }
+
+    // Every light goes in the extra tile
+    grid->offsets[tile_count + 1] = (uint32_t)context->lights.size;
+
+    for (size_t i = 1; i < tile_count + 2; ++i)
+        grid->offsets[i] += grid->offsets[i - 1];
+
+    SDL_assert(grid->offsets[tile_count + 1] == total);
+
+    grid->indices = ArenaAllocArray(&context->arena, total, sizeof(uint16_t));
+
+    if (!grid->indices)
+        return -1;
+
+    // Offsets are advanced while filling, and shifted back after
+    for (size_t i = 0; i < context->lights.size; ++i)
+    {
+        for (int y = bounds[i].y; y < bounds[i].y + bounds[i].h; ++y)
+        {
+            for (int x = bounds[i].x; x < bounds[i].x + bounds[i].w; ++x)
+            {
+                uint32_t * const offset = &grid->offsets[(size_t)y * (size_t)grid->columns + (size_t)x];
+                grid->indices[(*offset)++] = (uint16_t)i;
+            }
+        }
+
+        grid->indices[grid->offsets[tile_count]++] = (uint16_t)i;
+    }
+
+    for (size_t i = tile_count + 1; i > 0; --i)
+        grid->offsets[i] = grid->offsets[i - 1];
+
+    grid->offsets[0] = 0;
+
+    return 0;
+}
+
+// Sums the light reaching a point from the lights of the tile containing its
+// screen position, with the normal normalized here
+static inline Vector
+LightsAt(
+          RenderContext * const context,
+    const int                   x,
+    const int                   y,
+    const Vector        * const position,
+    const Vector        * const normal)
+{
+    SDL_assert(context);
+    SDL_assert(position);
+    SDL_assert(normal);
+
+    const LightTiles * const grid = &context->light_tiles;
+    SDL_assert(grid->offsets);
+
+    const size_t tile = (x >= 0 && x < grid->columns * LIGHT_TILE_SIZE
+                      && y >= 0 && y < grid->rows    * LIGHT_TILE_SIZE)
+        ? (size_t)(y / LIGHT_TILE_SIZE) * (size_t)grid->columns + (size_t)(x / LIGHT_TILE_SIZE)
+        : (size_t)grid->columns * (size_t)grid->rows;
+
+    const uint32_t start = grid->offsets[tile];
+    const uint32_t end   = grid->offsets[tile + 1];
+
+    Vector sum = {.x = 0.0f};
+
+    if (start == end)
+        return sum;
+
+    const Vector unit = VectorNormalize(normal);
+
+    for (uint32_t i = start; i < end; ++i)
+        LightAccumulate(&context->lights.data[grid->indices[i]], position, &unit, &sum);
+
+    RENDER_COUNT(context, light_evals, end - start);
+
+    return sum;
+}
+
+// Adds a light color to a pixel, saturating each channel
+static inline uint32_t
+AddLight(
+    const SDL_PixelFormat * const format,
+    const uint32_t                color,
+    const Vector          * const light)
+{
+    SDL_assert(format);
+    SDL_assert(light);
+
+    uint8_t r, g, b, a;
+    SDL_GetRGBA(color, format, &r, &g, &b, &a);
+
+    return SDL_MapRGBA(
+        format,
+        (uint8_t)fminf((float)r + light->x * 255.0f, 255.0f),
+        (uint8_t)fminf((float)g + light->y * 255.0f, 255.0f),
+        (uint8_t)fminf((float)b + light->z * 255.0f, 255.0f),
+        a
+    );
+}
+
+// Adds the lights of a pixel's tile to its color, at the point given by the
+// barycentric coordinate within a face
+static inline uint32_t
+ShadeLights(
+          RenderContext * const context,
+    const int                   x,
+    const int                   y,
+    const Vector        * const positions,
+    const Vector        * const normal,
+    const Vector        * const coord,
+    const uint32_t              color)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(positions);
+    SDL_assert(coord);
+
+    Vector position = VectorMultf(&positions[0], coord->x);
+    for (size_t k = 1; k < 3; ++k)
+    {
+        const Vector weighted = VectorMultf(&positions[k], coord->xyz[k]);
+        position = VectorAdd(&position, &weighted);
+    }
+
+    const Vector light = LightsAt(context, x, y, &position, normal);
+
+    if (light.x <= 0.0f && light.y <= 0.0f && light.z <= 0.0f)
+        return color;
+
+    return AddLight(context->target->format, color, &light);
+}
+
+static void
+RasterDepth(
+          RenderContext * const context,
+    const Matrix        * const model_view_projection)
+{
+    SDL_assert(context && context->mesh && context->projected);
+
+    (void)model_view_projection;
+
+    const Mesh * const mesh = context->mesh;
+    for (size_t position = 0; position < mesh->faces.size; ++position)
+    {
+        const size_t i = FrameFace(context, position);
+
+        if (!FaceInBand(context, i))
+            continue;
+
+        size_t vertex_index[3];
+        FaceVertices(&mesh->faces, i, vertex_index);
+
+        Vector verts[3];
+        for (size_t j = 0; j < 3; ++j)
+        {
+            verts[j] = mesh->vertices.data[vertex_index[j]];
+            verts[j].y *= -1.0f;
+        }
+
+        if (!TestBackface(context, verts))
+            continue;
+
+        for (size_t j = 0; j < 3; ++j)
+            verts[j] = context->projected[vertex_index[j]];
+
+        Triangle tri;
+        if (!TriangleSetup(context, &tri, verts))
+            continue;
+
+        for (int y = tri.bounds.y; y < tri.bounds.y + tri.bounds.h; ++y)
+        {
+            for (int x = tri.bounds.x; x < tri.bounds.x + tri.bounds.w; ++x)
+            {
+                Vector coord;
+                TestSamples(context, &tri, x, y, &coord);
+            }
+        }
+    }
+}
+
+static inline Matrix
+GetViewport(
+    const SDL_FRect * const bounds,
+    const float             depth)
+{
+    SDL_assert(bounds);
+
+    Matrix matrix = MatrixIdentity();
+    matrix.m[0][0] = bounds->w / 2.0f;
+    matrix.m[0][3] = bounds->x + bounds->w / 2.0f;
+
+    matrix.m[1][1] = bounds->h / 2.0f;
+    matrix.m[1][3] = bounds->y + bounds->h / 2.0f;
+
+    matrix.m[2][2] = depth / 2.0f;
+    matrix.m[2][3] = depth * 2.0f;
+
+    return matrix;
+}
+
+static inline Matrix
+LookAt(
+    const Camera * const camera)
+{
+    SDL_assert(camera);
+
+    Vector z = VectorSub(&camera->pos, &camera->focus);
+           z = VectorNormalize(&z);
+
+    Vector x = VectorCross(&camera->up, &z);
+           x = VectorNormalize(&x);
+
+    Vector y = VectorCross(&z, &x);
+           y = VectorNormalize(&y);
+
+    Matrix minv      = MatrixIdentity();
+    Matrix transform = MatrixIdentity();
+    for (size_t i = 0; i < 3; ++i)
+    {
+        minv.m[0][i] = x.xyz[i];
+        minv.m[1][i] = y.xyz[i];
+        minv.m[2][i] = z.xyz[i];
+        transform.m[i][3] = -camera->focus.xyz[i];
+    }
+
+    return MatrixMult(&minv, &transform);
+}
+
+#if RENDER_STATS
+// Blue through red for one to seven or more writes to a pixel
+static const SDL_Color OVERDRAW_COLORS[8] = {
+    {  0,   0,   0, 255},
+    { 32,  64, 255, 255},
+    {  0, 192, 255, 255},
+    {  0, 224,  64, 255},
+    {224, 224,   0, 255},
+    {255, 128,   0, 255},
+    {255,  32,   0, 255},
+    {255, 255, 255, 255},
+};
+
+// Counts distinct pixels written, and replaces the shaded image with the
+// heatmap if asked to
+static void
+ResolveOverdraw(
+    RenderContext * const context)
+{
+    SDL_assert(context && context->target && context->overdraw);
+    SDL_assert(context->target->format->BytesPerPixel == (int)sizeof(uint32_t));
+
+    const bool heatmap = (context->flags & RENDER_OVERDRAW) != 0;
+
+    uint32_t colors[8];
+    for (size_t i = 0; i < 8; ++i)
+        colors[i] = SDL_MapRGBA(
+            context->target->format,
+            OVERDRAW_COLORS[i].r,
+            OVERDRAW_COLORS[i].g,
+            OVERDRAW_COLORS[i].b,
+            OVERDRAW_COLORS[i].a
+        );
+
+    size_t covered = 0;
+
+    const uint16_t * count = context->overdraw;
+    for (int y = 0; y < context->target->h; ++y)
+    {
+        uint32_t * const dest = (uint32_t*)(
+            (uint8_t*)context->target->pixels
+          + (y * context->target->pitch)
+        );
+
+        for (int x = 0; x < context->target->w; ++x, ++count)
+        {
+            covered += (*count > 0);
+
+            if (heatmap)
+                dest[x] = colors[SDL_min(*count, 7)];
+        }
+    }
+
+    context->stats.covered = covered;
+}
+#endif
+
+// Model to screen transform for the context's rotation and target size,
+// also giving the rotated camera
+static inline Matrix
+FrameTransform(
+    const RenderContext * const context,
+          Camera        * const camera)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(camera);
+
+    Matrix projection = MatrixIdentity();
+    {
+        const Vector distance = VectorSub(
+            &context->camera.pos, &context->camera.focus
+        );
+
+        projection.m[3][2] = 1.0f / VectorMag(&distance);
+    }
+
+    // Scaled to the shorter side of the target so that the model keeps its
+    // aspect ratio, and centered along the longer one
+    const float size = (float)SDL_min(context->target->w, context->target->h);
+
+    const Matrix viewport = GetViewport(
+        &(SDL_FRect){
+            .x = ((float)context->target->w - size) / 2.0f + size / 8.0f,
+            .y = ((float)context->target->h - size) / 2.0f + size / 8.0f,
+            .w = size * 0.25f,
+            .h = size * 0.25f,
+        },
+        255.0f /* depth */
+    );
+
+    *camera = context->camera;
+    camera->pos = QuaternionRotatev(&context->rotation, &camera->pos);
+
+    const Matrix model = LookAt(camera);
+
+    Matrix mvpm = MatrixMult(&viewport, &projection);
+           mvpm = MatrixMult(&mvpm, &model);
+
+    return mvpm;
+}
+
+// Counts of the rendering thread and of every worker that may draw for it
+static inline void
+StageRead(
+    const RenderContext * const context,
+          PerfValues    * const values)
+{
+    SDL_assert(context && context->perf);
+    SDL_assert(values);
+
+    PerfRead(context->perf, values);
+    JobPerfRead(context->jobs, values);
+}
+
+// Position within a frame, for timing and counting each stage in turn
+typedef struct StageClock {
+    uint64_t   time;
+    PerfValues counts;
+} StageClock;
+
+static inline StageClock
+StageStart(
+    const RenderContext * const context)
+{
+    SDL_assert(context);
+
+    StageClock clock = {.time = GetTimeNs()};
+
+    if (context->perf)
+        StageRead(context, &clock.counts);
+
+    return clock;
+}
+
+static inline void
+StageEnd(
+    const RenderContext * const context,
+          StageClock    * const clock,
+          uint64_t      * const duration,
+          PerfValues    * const counts)
+{
+    SDL_assert(context);
+    SDL_assert(clock);
+    SDL_assert(duration);
+    SDL_assert(counts);
+
+    const uint64_t time = GetTimeNs();
+
+    *duration   = time - clock->time;
+    clock->time = time;
+
+    if (!context->perf)
+        return;
+
+    PerfValues now;
+    StageRead(context, &now);
+
+    memset(counts, 0, sizeof(PerfValues));
+    PerfAccumulate(counts, &clock->counts, &now);
+
+    clock->counts = now;
+}
+
+static inline bool
+FrameCancelled(
+    const RenderContext * const context)
+{
+    SDL_assert(context);
+    return context->cancel && SDL_AtomicGet(context->cancel);
+}
+
+typedef void (*RenderFunc)(RenderContext * const, const Matrix * const);
+
+static void RenderWireframe(RenderContext * const, const Matrix * const);
+static void RenderFlat     (RenderContext * const, const Matrix * const);
+static void RenderGouraud  (RenderContext * const, const Matrix * const);
+static void RenderPhong    (RenderContext * const, const Matrix * const);
+static void RenderToon     (RenderContext * const, const Matrix * const);
+
+// Bands per thread, so that bands with more faces than others still balance
+#define RENDER_BANDS_PER_THREAD 4
+
+// Fewest rows in a band, as faces spanning several bands are set up by each
+#define RENDER_BAND_MIN 32
+
+// Faces whose rows are found at a time
+#define FACE_ROWS_GRAIN 4096
+
+typedef struct RenderBands {
+          RenderContext * bands;
+          RenderFunc      func;
+    const Matrix        * model_view_projection;
+} RenderBands;
+
+static void
+RenderBandJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    const RenderBands * const bands = data;
+
+    (void)worker;
+
+    for (size_t i = begin; i < end; ++i)
+        if (!FrameCancelled(&bands->bands[i]))
+            bands->func(&bands->bands[i], bands->model_view_projection);
+}
+
+// Draws the faces in horizontal bands on the context's scheduler. Bands
+// never share a pixel, and each draws the faces in the same order, so the
+// result is the same as drawing in one piece.
+static inline void
+RenderInBands(
+          RenderContext * const context,
+    const RenderFunc            func,
+    const Matrix        * const model_view_projection)
+{
+    SDL_assert(context && context->target);
+    SDL_assert(func);
+    SDL_assert(!context->band_h);
+
+    const int    height  = context->target->h;
+    const size_t threads = JobThreadCount(context->jobs);
+
+    const int rows = SDL_max(
+        RENDER_BAND_MIN,
+        (int)((size_t)height / (threads * RENDER_BANDS_PER_THREAD))
+    );
+
+    const size_t count = (size_t)((height + rows - 1) / rows);
+
+    // Frames that can be cancelled are split even on one thread, so that
+    // they can be abandoned between bands
+    const bool split = (threads > 1 || context->cancel) && count > 1;
+
+    RenderContext * const bands = (split)
+        ? ArenaAllocArray(&context->arena, count, sizeof(RenderContext))
+        : NULL;
+
+    context->face_rows = (split)
+        ? ArenaAllocArray(&context->arena, context->mesh->faces.size, sizeof(FaceRows))
+        : NULL;
+
+    // Drawn in one piece when there's nothing to share, or no memory to
+    // share it with
+    if (!bands || !context->face_rows)
+    {
+        context->face_rows = NULL;
+        func(context, model_view_projection);
+        return;
+    }
+
+    JobParallelFor(
+        context->jobs, context->mesh->faces.size, FACE_ROWS_GRAIN,
+        FaceRowsJob, context
+    );
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        RenderContext * const band = &bands[i];
+
+        *band = *context;
+        band->band_y = (int)i * rows;
+        band->band_h = SDL_min(rows, height - band->band_y);
+        band->perf   = NULL;
+
+        memset(&band->stats, 0, sizeof(RenderStats));
+    }
+
+    JobParallelFor(
+        context->jobs, count, 1, RenderBandJob,
+        &(RenderBands){bands, func, model_view_projection}
+    );
+
+#if RENDER_STATS
+    for (size_t i = 0; i < count; ++i)
+    {
+        const RenderStats * const band = &bands[i].stats;
+
+        context->stats.faces       += band->faces;
+        context->stats.culled      += band->culled;
+        context->stats.clipped     += band->clipped;
+        context->stats.tested      += band->tested;
+        context->stats.passed      += band->passed;
+        context->stats.written     += band->written;
+        context->stats.reused      += band->reused;
+        context->stats.light_evals += band->light_evals;
+    }
+#endif
+}
+
+static inline int
+Render(
+    RenderContext * const context)
+{
+    SDL_assert(context);
+    SDL_assert(context->target);
+    SDL_assert(context->mesh);
+
+    StageClock clock = StageStart(context);
+
+    context->timings.start = clock.time;
+    context->cancelled     = false;
+
+    if (PrepareBuffers(context))
+        return 1;
+
+    if (ResetArena(context))
+        return 1;
+
+#if RENDER_STATS
+    memset(&context->stats, 0, sizeof(RenderStats));
+    memset(context->overdraw, 0, sizeof(uint16_t) * context->overdraw_size);
+#endif
+
+    SDL_FillRect(context->target, NULL, 0);
+    SDL_FillRect(context->depth,  NULL, 0);
+
+    if (context->color)
+        SDL_FillRect(context->color, NULL, 0);
+
+    if (SDL_MUSTLOCK(context->target))
+        if (SDL_LockSurface(context->target) != 0)
+            goto Error_SurfaceLocking;
+
+    if (SDL_MUSTLOCK(context->depth))
+        if (SDL_LockSurface(context->depth) != 0)
+            goto Error_SurfaceLocking;
+
+    Camera camera;
+    const Matrix mvpm = FrameTransform(context, &camera);
+
+    context->eye = camera.pos;
+
+    void (*render_func)(RenderContext * const, const Matrix * const) = NULL;
+    switch (context->mode)
+    {
+        case RENDER_WIREFRAME: render_func = RenderWireframe; break;
+        case RENDER_FLAT:      render_func = RenderFlat;      break;
+        case RENDER_GOURAUD:   render_func = RenderGouraud;   break;
+        case RENDER_PHONG:     render_func = RenderPhong;     break;
+        case RENDER_TOON:      render_func = RenderToon;      break;
+
+        default:
+            SDL_assert(0);
+    }
+
+    StageEnd(context, &clock, &context->timings.clear, &context->counters.clear);
+
+    if (ProjectVertices(context, &mvpm))
+        goto Error_Frame;
+
+    if (OrderFaces(context, &camera))
+        goto Error_Frame;
+
+    StageEnd(context, &clock, &context->timings.transform, &context->counters.transform);
+
+    if (FrameCancelled(context))
+        goto Frame_Cancelled;
+
+    if (context->mode == RENDER_PHONG || context->mode == RENDER_TOON)
+    {
+        Vector view = VectorSub(&camera.pos, &camera.focus);
+               view.y *= -1.0f;
+               view = VectorNormalize(&view);
+
+        const int status = LightingTableUpdate(
+            &context->lighting,
+            context->target->format,
+            (context->mode == RENDER_TOON) ? LIGHTING_TOON : LIGHTING_DIFFUSE,
+            (context->flags & RENDER_SPECULAR) != 0,
+            &context->light,
+            &view
+        );
+
+        if (status)
+            goto Error_Frame;
+    }
+
+    if ((context->flags & RENDER_TEXTURES)
+     && context->texture_source
+     && context->mesh->faces.t)
+    {
+        if (TextureUpdate(&context->texture, context->texture_source, context->target->format))
+            goto Error_Frame;
+    }
+
+    if (context->lights.size && context->mode != RENDER_WIREFRAME)
+    {
+        if (CullLights(context, &mvpm))
+            goto Error_Frame;
+    }
+
+    if ((context->flags & RENDER_SHADOWS) && context->mode != RENDER_WIREFRAME)
+    {
+        if (ShadowMapUpdate(&context->shadow, context->target->format, context->mesh, &context->light))
+            goto Error_Frame;
+    }
+
+    if (TemporalEnabled(context))
+    {
+        const TemporalKey key = {
+            .mesh        = context->mesh,
+            .mode        = context->mode,
+            .flags       = context->flags & ~(RENDER_HUD | RENDER_OVERDRAW),
+            .format      = context->target->format->format,
+            .light       = context->light,
+            .lights      = context->lights.data,
+            .light_count = context->lights.size,
+            .texture     = context->texture_source,
+        };
+
+        const int status = TemporalUpdate(
+            &context->temporal, &key,
+            context->target->w, context->target->h,
+            &mvpm
+        );
+
+        if (status)
+            goto Error_Frame;
+    }
+
+    StageEnd(context, &clock, &context->timings.lighting, &context->counters.lighting);
+
+    if (FrameCancelled(context))
+        goto Frame_Cancelled;
+
+    // Lines are drawn in one piece, after any depth pass
+    if (context->mode == RENDER_WIREFRAME)
+        render_func(context, &mvpm);
+    else if (render_func)
+        RenderInBands(context, render_func, &mvpm);
+
+    StageEnd(context, &clock, &context->timings.raster, &context->counters.raster);
+
+    if (FrameCancelled(context))
+        goto Frame_Cancelled;
+
+    // Lines are drawn straight into the target, everything else is shaded
+    // per sample and needs resolving
+    if (context->color && context->mode != RENDER_WIREFRAME)
+        ResolveSamples(context);
+
+    StageEnd(context, &clock, &context->timings.resolve, &context->counters.resolve);
+
+#if RENDER_STATS
+    ResolveOverdraw(context);
+    CountArena(context);
+#endif
+
+    if (SDL_MUSTLOCK(context->target))
+        SDL_UnlockSurface(context->target);
+
+    if (SDL_MUSTLOCK(context->depth))
+        SDL_UnlockSurface(context->depth);
+
+    return 0;
 
-    context->camera = camera_old;
+Frame_Cancelled:
+    context->cancelled = true;
 
     if (SDL_MUSTLOCK(context->target))
         SDL_UnlockSurface(context->target);
@@ -313,6 +2309,7 @@ Render(
 
     return 0;
 
+Error_Frame:
 Error_SurfaceLocking:
     if (SDL_MUSTLOCK(context->target))
         SDL_UnlockSurface(context->target);
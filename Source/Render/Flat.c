@@ -20,82 +20,120 @@ RenderFlat(
 {
     SDL_assert(context);
     SDL_assert(model_view_projection);
+    SDL_assert(context->projected);
 
-    Mesh * const mesh = context->mesh;
-    for (size_t i = 0; i < mesh->faces.size; ++i)
+    const Mesh      * const mesh    = context->mesh;
+    const Texture   * const texture = FrameTexture(context);
+    const ShadowMap * const shadow  = FrameShadow(context);
+
+    // Faces are sorted into one batch per material
+    for (size_t r = 0; r < mesh->ranges.size; ++r)
     {
-        const Face * const face = &mesh->faces.data[i];
+        const MaterialRange * const range = &mesh->ranges.data[r];
+        const uint32_t              tint  = MaterialTint(context, range->material);
 
-        Vector verts[3];
-        for (size_t j = 0; j < 3; ++j)
+        for (size_t position = range->start; position < range->start + range->count; ++position)
         {
-            verts[j] = mesh->vertices.data[face->indices[j].v];
-            verts[j].y *= -1.0f;
-        }
+            const size_t i = FrameFace(context, position);
 
-        if (!TestBackface(context, verts))
-            continue;
+            if (!FaceInBand(context, i))
+                continue;
 
-        const Vector side[2] = {
-            VectorSub(&verts[2], &verts[0]),
-            VectorSub(&verts[1], &verts[0]),
-        };
+            size_t vertex_index[3];
+            FaceVertices(&mesh->faces, i, vertex_index);
 
-        Vector normal = VectorCross(&side[0], &side[1]);
-               normal = VectorNormalize(&normal);
+            Vector verts[3];
+            for (size_t j = 0; j < 3; ++j)
+            {
+                verts[j] = mesh->vertices.data[vertex_index[j]];
+                verts[j].y *= -1.0f;
+            }
 
-        normal.y *= -1.0f;
+            if (!TestBackface(context, verts))
+                continue;
 
-        float intensity = VectorDot(&normal, &context->light);
-        intensity = fmaxf(fminf(intensity, 1.0f), 0.0f) * 255.0f;
+            const Vector side[2] = {
+                VectorSub(&verts[2], &verts[0]),
+                VectorSub(&verts[1], &verts[0]),
+            };
 
-        for (size_t j = 0; j < 3; ++j)
-        {
-            Matrix vert_mat = VectorToMatrix(&verts[j]);
-                   vert_mat = MatrixMult(model_view_projection, &vert_mat);
-                   verts[j] = MatrixToVector(&vert_mat);
+            Vector normal = VectorCross(&side[0], &side[1]);
+                   normal = VectorNormalize(&normal);
 
-            verts[j].x = roundf(verts[j].x);
-            verts[j].y = roundf(verts[j].y);
-            verts[j].z = roundf(verts[j].z);
-        }
+            normal.y *= -1.0f;
 
-        Vector temp;
-        if (verts[0].y > verts[1].y)
-            temp = verts[0], verts[0] = verts[1], verts[1] = temp;
-        if (verts[0].y > verts[2].y)
-            temp = verts[0], verts[0] = verts[2], verts[2] = temp;
-        if (verts[1].y > verts[2].y)
-            temp = verts[1], verts[1] = verts[2], verts[2] = temp;
+            float intensity = VectorDot(&normal, &context->light);
+            intensity = fmaxf(fminf(intensity, 1.0f), 0.0f) * 255.0f;
 
-        const SDL_FRect bounds = TriBoundingBox(verts);
+            const uint32_t color = SDL_MapRGBA(
+                context->target->format,
+                (uint8_t)intensity,
+                (uint8_t)intensity,
+                (uint8_t)intensity,
+                255
+            );
 
-        Vector point;
-        for (point.x = bounds.x; point.x <= bounds.x + bounds.w; point.x += 0.5f)
-        {
-            for (point.y = bounds.y; point.y <= bounds.y + bounds.h; point.y += 0.5f)
+            TexturePlanes planes;
+            if (texture)
+                TexturePlanesInit(&planes, mesh, i, verts, model_view_projection);
+
+            ShadowPlanes shadow_planes = {.state = SHADOW_LIT};
+            if (shadow)
+                ShadowPlanesInit(&shadow_planes, shadow, i, vertex_index, verts, model_view_projection);
+
+            for (size_t j = 0; j < 3; ++j)
+                verts[j] = context->projected[vertex_index[j]];
+
+            Triangle tri;
+            if (!TriangleSetup(context, &tri, verts))
+                continue;
+
+            if (texture)
+                TexturePlanesDerive(&planes, &tri);
+
+            // Point and spot lights are evaluated once, at the center
+            Vector glow = {.x = 0.0f};
+            if (context->lights.size)
+            {
+                Vector center = {.x = 0.0f};
+                Vector screen = {.x = 0.0f};
+                for (size_t j = 0; j < 3; ++j)
+                {
+                    center = VectorAdd(&center, &mesh->vertices.data[vertex_index[j]]);
+                    screen = VectorAdd(&screen, &tri.verts[j]);
+                }
+
+                center = VectorMultf(&center, 1.0f / 3.0f);
+                screen = VectorMultf(&screen, 1.0f / 3.0f);
+
+                glow = LightsAt(context, (int)screen.x, (int)screen.y, &center, &normal);
+            }
+
+            const bool glowing = (glow.x + glow.y + glow.z > 0.0f);
+
+            for (int y = tri.bounds.y; y < tri.bounds.y + tri.bounds.h; ++y)
             {
-                const Vector coord = Barycenter(verts, &point);
-                if (coord.x < 0.0f || coord.y < 0.0f || coord.z < 0.0f)
-                    continue;
-
-                point.z = 0.0f;
-                for (size_t i = 0; i < 3; ++i)
-                    point.z += verts[i].z * coord.xyz[i];
-
-                if (!TestDepth(context, &point))
-                    continue;
-
-                PutFragment(
-                    context,
-                    &point,
-                    &(SDL_Color){
-                        (uint8_t)intensity,
-                        (uint8_t)intensity,
-                        (uint8_t)intensity,
-                        255,
-                    }
-                );
+                for (int x = tri.bounds.x; x < tri.bounds.x + tri.bounds.w; ++x)
+                {
+                    Vector coord;
+                    const unsigned mask = TestSamples(context, &tri, x, y, &coord);
+
+                    if (!mask)
+                        continue;
+
+                    uint32_t shaded = color;
+
+                    if (shadow_planes.state != SHADOW_LIT)
+                        shaded = ShadowShade(context, &shadow_planes, &coord, shaded);
+
+                    if (glowing)
+                        shaded = AddLight(context->target->format, shaded, &glow);
+
+                    if (texture)
+                        shaded = TextureShade(texture, &planes, &coord, shaded);
+
+                    PutSamples(context, x, y, mask, MaterialShade(tint, shaded));
+                }
             }
         }
     }
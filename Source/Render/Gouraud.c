@@ -20,91 +20,134 @@ RenderGouraud(
 {
     SDL_assert(context);
     SDL_assert(model_view_projection);
+    SDL_assert(context->projected);
 
-    Mesh * const mesh = context->mesh;
-    for (size_t i = 0; i < mesh->faces.size; ++i)
+    const Mesh      * const mesh    = context->mesh;
+    const Texture   * const texture = FrameTexture(context);
+    const ShadowMap * const shadow  = FrameShadow(context);
+
+    // Faces are sorted into one batch per material
+    for (size_t r = 0; r < mesh->ranges.size; ++r)
     {
-        const Face * const face = &mesh->faces.data[i];
+        const MaterialRange * const range = &mesh->ranges.data[r];
+        const uint32_t              tint  = MaterialTint(context, range->material);
 
-        Vector verts[3];
-        float  light[3];
-        for (size_t j = 0; j < 3; ++j)
+        for (size_t position = range->start; position < range->start + range->count; ++position)
         {
-            verts[j] = mesh->vertices.data[face->indices[j].v];
-            verts[j].y *= -1.0f;
-        }
+            const size_t i = FrameFace(context, position);
 
-        if (!TestBackface(context, verts))
-            continue;
+            if (!FaceInBand(context, i))
+                continue;
 
-        for (size_t j = 0; j < 3; ++j)
-        {
-            light[j] = VectorDot(
-                &mesh->normals.data[face->indices[j].n],
-                &context->light
-            );
+            size_t vertex_index[3];
+            FaceVertices(&mesh->faces, i, vertex_index);
 
-            light[j] = fmaxf(fminf(light[j], 1.0f), 0.0f);
+            Vector verts[3];
+            float  light[3];
+            for (size_t j = 0; j < 3; ++j)
+            {
+                verts[j] = mesh->vertices.data[vertex_index[j]];
+                verts[j].y *= -1.0f;
+            }
 
-            Matrix vert_mat = VectorToMatrix(&verts[j]);
-                   vert_mat = MatrixMult(model_view_projection, &vert_mat);
-                   verts[j] = MatrixToVector(&vert_mat);
+            if (!TestBackface(context, verts))
+                continue;
 
-            verts[j].x = roundf(verts[j].x);
-            verts[j].y = roundf(verts[j].y);
-            verts[j].z = roundf(verts[j].z);
-        }
+            size_t normal_index[3];
+            FaceNormals(&mesh->faces, i, normal_index);
 
-        if (verts[0].y > verts[1].y)
-        {
-            const Vector vtmp = verts[0]; verts[0] = verts[1]; verts[1] = vtmp;
-            const float  ltmp = light[0]; light[0] = light[1]; light[1] = ltmp;
-        }
-        if (verts[0].y > verts[2].y)
-        {
-            const Vector vtmp = verts[0]; verts[0] = verts[2]; verts[2] = vtmp;
-            const float  ltmp = light[0]; light[0] = light[2]; light[2] = ltmp;
-        }
-        if (verts[1].y > verts[2].y)
-        {
-            const Vector vtmp = verts[1]; verts[1] = verts[2]; verts[2] = vtmp;
-            const float  ltmp = light[1]; light[1] = light[2]; light[2] = ltmp;
-        }
+            TexturePlanes planes;
+            if (texture)
+                TexturePlanesInit(&planes, mesh, i, verts, model_view_projection);
 
-        const SDL_FRect bounds = TriBoundingBox(verts);
+            ShadowPlanes shadow_planes = {.state = SHADOW_LIT};
+            if (shadow)
+                ShadowPlanesInit(&shadow_planes, shadow, i, vertex_index, verts, model_view_projection);
 
-        Vector point;
-        for (point.x = bounds.x; point.x <= bounds.x + bounds.w; point.x += 0.5f)
-        {
-            for (point.y = bounds.y; point.y <= bounds.y + bounds.h; point.y += 0.5f)
+            for (size_t j = 0; j < 3; ++j)
             {
-                const Vector coord = Barycenter(verts, &point);
-                if (coord.x < 0.0f || coord.y < 0.0f || coord.z < 0.0f)
-                    continue;
-
-                point.z = 0.0f;
-                for (size_t i = 0; i < 3; ++i)
-                    point.z += verts[i].z * coord.xyz[i];
-
-                if (!TestDepth(context, &point))
-                    continue;
-
-                const float interp_color = (
-                    (coord.x * light[0])
-                  + (coord.y * light[1])
-                  + (coord.z * light[2])
-                ) * 255.0f;
-
-                PutFragment(
-                    context,
-                    &point,
-                    &(SDL_Color){
+                light[j] = VectorDot(
+                    &mesh->normals.data[normal_index[j]],
+                    &context->light
+                );
+
+                light[j] = fmaxf(fminf(light[j], 1.0f), 0.0f);
+
+                verts[j] = context->projected[vertex_index[j]];
+            }
+
+            Triangle tri;
+            if (!TriangleSetup(context, &tri, verts))
+                continue;
+
+            if (texture)
+                TexturePlanesDerive(&planes, &tri);
+
+            // Point and spot lights are evaluated per vertex, like the
+            // directional light
+            Vector glow[3] = {{.x = 0.0f}, {.x = 0.0f}, {.x = 0.0f}};
+            bool   glowing = false;
+            if (context->lights.size)
+            {
+                for (size_t j = 0; j < 3; ++j)
+                {
+                    glow[j] = LightsAt(
+                        context,
+                        (int)tri.verts[j].x, (int)tri.verts[j].y,
+                        &mesh->vertices.data[vertex_index[j]],
+                        &mesh->normals.data[normal_index[j]]
+                    );
+
+                    glowing |= (glow[j].x + glow[j].y + glow[j].z > 0.0f);
+                }
+            }
+
+            for (int y = tri.bounds.y; y < tri.bounds.y + tri.bounds.h; ++y)
+            {
+                for (int x = tri.bounds.x; x < tri.bounds.x + tri.bounds.w; ++x)
+                {
+                    Vector coord;
+                    const unsigned mask = TestSamples(context, &tri, x, y, &coord);
+
+                    if (!mask)
+                        continue;
+
+                    const float interp_color = (
+                        (coord.x * light[0])
+                      + (coord.y * light[1])
+                      + (coord.z * light[2])
+                    ) * 255.0f;
+
+                    const uint32_t color = SDL_MapRGBA(
+                        context->target->format,
                         (uint8_t)interp_color,
                         (uint8_t)interp_color,
                         (uint8_t)interp_color,
-                        255,
+                        255
+                    );
+
+                    uint32_t shaded = color;
+
+                    if (shadow_planes.state != SHADOW_LIT)
+                        shaded = ShadowShade(context, &shadow_planes, &coord, shaded);
+
+                    if (glowing)
+                    {
+                        Vector interp_glow = VectorMultf(&glow[0], coord.x);
+                        for (size_t k = 1; k < 3; ++k)
+                        {
+                            const Vector weighted = VectorMultf(&glow[k], coord.xyz[k]);
+                            interp_glow = VectorAdd(&interp_glow, &weighted);
+                        }
+
+                        shaded = AddLight(context->target->format, shaded, &interp_glow);
                     }
-                );
+
+                    if (texture)
+                        shaded = TextureShade(texture, &planes, &coord, shaded);
+
+                    PutSamples(context, x, y, mask, MaterialShade(tint, shaded));
+                }
             }
         }
     }
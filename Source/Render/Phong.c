@@ -20,96 +20,118 @@ RenderPhong(
 {
     SDL_assert(context);
     SDL_assert(model_view_projection);
+    SDL_assert(context->projected);
+    SDL_assert(context->lighting);
 
-    Mesh * const mesh = context->mesh;
-    for (size_t i = 0; i < mesh->faces.size; ++i)
+    const Mesh      * const mesh    = context->mesh;
+    const Texture   * const texture = FrameTexture(context);
+    const ShadowMap * const shadow  = FrameShadow(context);
+    TemporalCache   * const history = FrameTemporal(context);
+
+    // Faces are sorted into one batch per material
+    for (size_t r = 0; r < mesh->ranges.size; ++r)
     {
-        const Face * const face = &mesh->faces.data[i];
+        const MaterialRange * const range = &mesh->ranges.data[r];
+        const uint32_t              tint  = MaterialTint(context, range->material);
 
-        Vector verts[3];
-        Vector norms[3];
-        for (size_t j = 0; j < 3; ++j)
+        for (size_t position = range->start; position < range->start + range->count; ++position)
         {
-            verts[j] = mesh->vertices.data[face->indices[j].v];
-            verts[j].y *= -1.0f;
-        }
+            const size_t i = FrameFace(context, position);
 
-        if (!TestBackface(context, verts))
-            continue;
+            if (!FaceInBand(context, i))
+                continue;
 
-        for (size_t j = 0; j < 3; ++j)
-        {
-            norms[j] = mesh->normals.data[face->indices[j].n];
+            size_t vertex_index[3];
+            FaceVertices(&mesh->faces, i, vertex_index);
 
-            Matrix vert_mat = VectorToMatrix(&verts[j]);
-                   vert_mat = MatrixMult(model_view_projection, &vert_mat);
-                   verts[j] = MatrixToVector(&vert_mat);
+            Vector verts[3];
+            Vector norms[3];
+            Vector positions[3];
+            for (size_t j = 0; j < 3; ++j)
+            {
+                positions[j] = mesh->vertices.data[vertex_index[j]];
 
-            verts[j].x = roundf(verts[j].x);
-            verts[j].y = roundf(verts[j].y);
-            verts[j].z = roundf(verts[j].z);
-        }
+                verts[j] = positions[j];
+                verts[j].y *= -1.0f;
+            }
 
-        if (verts[0].y > verts[1].y)
-        {
-            const Vector vtmp = verts[0]; verts[0] = verts[1]; verts[1] = vtmp;
-            const Vector ntmp = norms[0]; norms[0] = norms[1]; norms[1] = ntmp;
-        }
-        if (verts[0].y > verts[2].y)
-        {
-            const Vector vtmp = verts[0]; verts[0] = verts[2]; verts[2] = vtmp;
-            const Vector ntmp = norms[0]; norms[0] = norms[2]; norms[2] = ntmp;
-        }
-        if (verts[1].y > verts[2].y)
-        {
-            const Vector vtmp = verts[1]; verts[1] = verts[2]; verts[2] = vtmp;
-            const Vector ntmp = norms[1]; norms[1] = norms[2]; norms[2] = ntmp;
-        }
+            if (!TestBackface(context, verts))
+                continue;
 
-        const SDL_FRect bounds = TriBoundingBox(verts);
+            size_t normal_index[3];
+            FaceNormals(&mesh->faces, i, normal_index);
 
-        Vector point;
-        for (point.x = bounds.x; point.x <= bounds.x + bounds.w; point.x += 0.5f)
-        {
-            for (point.y = bounds.y; point.y <= bounds.y + bounds.h; point.y += 0.5f)
+            TexturePlanes planes;
+            if (texture)
+                TexturePlanesInit(&planes, mesh, i, verts, model_view_projection);
+
+            ShadowPlanes shadow_planes = {.state = SHADOW_LIT};
+            if (shadow)
+                ShadowPlanesInit(&shadow_planes, shadow, i, vertex_index, verts, model_view_projection);
+
+            TemporalFace reprojected = {.index = TEMPORAL_EMPTY};
+            if (history)
+                TemporalFaceInit(history, &reprojected, i, verts);
+
+            for (size_t j = 0; j < 3; ++j)
             {
-                const Vector coord = Barycenter(verts, &point);
-                if (coord.x < 0.0f || coord.y < 0.0f || coord.z < 0.0f)
-                    continue;
+                norms[j] = mesh->normals.data[normal_index[j]];
+                verts[j] = context->projected[vertex_index[j]];
+            }
 
-                point.z = 0.0f;
-                for (size_t i = 0; i < 3; ++i)
-                    point.z += verts[i].z * coord.xyz[i];
+            Triangle tri;
+            if (!TriangleSetup(context, &tri, verts))
+                continue;
 
-                if (!TestDepth(context, &point))
-                    continue;
+            if (texture)
+                TexturePlanesDerive(&planes, &tri);
 
-                Vector interp_norm = {{.x = 0.0f}};
-                for (size_t i = 0; i < 3; ++i)
+            for (int y = tri.bounds.y; y < tri.bounds.y + tri.bounds.h; ++y)
+            {
+                for (int x = tri.bounds.x; x < tri.bounds.x + tri.bounds.w; ++x)
                 {
-                    Vector norm = VectorMultf(&norms[i], coord.xyz[i]);
-                    interp_norm = VectorAdd(&interp_norm, &norm);
-                }
+                    Vector coord;
+                    const unsigned mask = TestSamples(context, &tri, x, y, &coord);
+
+                    if (!mask)
+                        continue;
 
-                interp_norm = VectorNormalize(&interp_norm);
+                    uint32_t   color;
+                    SDL_FPoint drift = {0.0f, 0.0f};
 
-                float interp_color = VectorDot(
-                    &interp_norm,
-                    &context->light
-                );
+                    if (history && TemporalFetch(history, &reprojected, &coord, &color, &drift))
+                    {
+                        RENDER_COUNT(context, reused, 1);
+                    }
+                    else
+                    {
+                        // Normalizing is unnecessary for the lighting lookup
+                        Vector interp_norm = VectorMultf(&norms[0], coord.x);
+                        for (size_t k = 1; k < 3; ++k)
+                        {
+                            const Vector norm = VectorMultf(&norms[k], coord.xyz[k]);
+                            interp_norm = VectorAdd(&interp_norm, &norm);
+                        }
 
-                interp_color = fmaxf(fminf(interp_color, 1.0f), 0.0f) * 255.0f;
+                        uint32_t shaded = LightingLookup(context->lighting, &interp_norm);
 
-                PutFragment(
-                    context,
-                    &point,
-                    &(SDL_Color){
-                        (uint8_t)interp_color,
-                        (uint8_t)interp_color,
-                        (uint8_t)interp_color,
-                        255,
+                        if (shadow_planes.state != SHADOW_LIT)
+                            shaded = ShadowShade(context, &shadow_planes, &coord, shaded);
+
+                        if (context->lights.size)
+                            shaded = ShadeLights(context, x, y, positions, &interp_norm, &coord, shaded);
+
+                        if (texture)
+                            shaded = TextureShade(texture, &planes, &coord, shaded);
+
+                        color = MaterialShade(tint, shaded);
                     }
-                );
+
+                    if (history)
+                        TemporalStore(history, x, y, &reprojected, color, &drift);
+
+                    PutSamples(context, x, y, mask, color);
+                }
             }
         }
     }
@@ -20,26 +20,24 @@ RenderWireframe(
 {
     SDL_assert(context);
     SDL_assert(model_view_projection);
+    SDL_assert(context->projected);
 
-    Mesh * const mesh = context->mesh;
-    for (size_t i = 0; i < mesh->faces.size; ++i)
+    // Hidden line removal tests edges against the depth of the faces
+    if (context->flags & RENDER_HIDDEN_LINES)
+        RenderInBands(context, RasterDepth, model_view_projection);
+
+    const uint32_t color = SDL_MapRGBA(context->target->format, 255, 255, 255, 255);
+
+    const Mesh * const mesh = context->mesh;
+    for (size_t i = 0; i < mesh->edges.size; ++i)
     {
-        const Face * const face = &mesh->faces.data[i];
-
-        Vector verts[3];
-        for (size_t j = 0; j < 3; ++j)
-        {
-            verts[j] = mesh->vertices.data[face->indices[j].v];
-            verts[j].y *= -1.0f;
-
-            Matrix vert_mat = VectorToMatrix(&verts[j]);
-                   vert_mat = MatrixMult(model_view_projection, &vert_mat);
-                   verts[j] = MatrixToVector(&vert_mat);
-        }
-
-        const SDL_Color color = {255, 255, 255, 255};
-        DrawLine(context, &verts[0], &verts[1], &color);
-        DrawLine(context, &verts[1], &verts[2], &color);
-        DrawLine(context, &verts[2], &verts[0], &color);
+        const Edge * const edge = &mesh->edges.data[i];
+
+        DrawLine(
+            context,
+            &context->projected[edge->a],
+            &context->projected[edge->b],
+            color
+        );
     }
 }
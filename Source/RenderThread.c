@@ -0,0 +1,412 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Everything a frame depends on, handed from the input thread to the render
+// thread. Frames are only rendered when this changes.
+typedef struct RenderState {
+    Quaternion rotation;
+    Vector     light;
+    RenderMode mode;
+    int        flags;
+    int        samples;
+    int        width;
+    int        height;
+    uint32_t   format;
+
+    // Frames are rendered at full size once the camera stops
+    bool       moving;
+
+    // Quality tier in REFINE_TIERS, raised once the camera has been still
+    // for a while, REFINE_FULL when refinement is off
+    int        refine;
+
+    // Performance counter value when the input leading to this state was
+    // received, not part of the comparison
+    uint64_t   input_time;
+} RenderState;
+
+static inline bool
+RenderStateEqual(
+    const RenderState * const a,
+    const RenderState * const b)
+{
+    SDL_assert(a);
+    SDL_assert(b);
+
+    return !memcmp(&a->rotation, &b->rotation, sizeof(Quaternion))
+        && !memcmp(&a->light,    &b->light,    sizeof(Vector))
+        && a->mode    == b->mode
+        && a->flags   == b->flags
+        && a->samples == b->samples
+        && a->width   == b->width
+        && a->height  == b->height
+        && a->format  == b->format
+        && a->moving  == b->moving
+        && a->refine  == b->refine;
+}
+
+typedef struct RenderFrame {
+    SDL_Surface * surface;
+    RenderState   state;
+} RenderFrame;
+
+// Renders on a dedicated thread, so that a frame can be rendered while the
+// previous one is presented. States and frames are each passed through a
+// triple buffer, and only the latest of either is ever used.
+typedef struct RenderThread {
+    SDL_Thread    * thread;
+    SDL_sem       * wake;
+    SDL_atomic_t    quit;
+    SDL_atomic_t    failed;
+    SDL_atomic_t    cancel; // Set on submission, abandons refining frames
+    uint32_t        event;  // Pushed whenever a frame is published
+
+    RenderContext   context;
+    Trace         * trace;  // Optional
+    bool            perf;   // Count on the render thread, if available
+
+    // Moving frames are rendered smaller and upscaled when over budget
+    ResolutionController resolution;
+    SDL_Surface        * scaled;
+
+    TripleBuffer    states;
+    RenderState     state_slots[3];
+
+    TripleBuffer    frames;
+    RenderFrame     frame_slots[3];
+
+    char            error[256];
+} RenderThread;
+
+static int
+RenderThreadMain(
+    void * const data)
+{
+    RenderThread * const thread = data;
+    SDL_assert(thread);
+
+    // Counters only measure the thread that opens them
+    PerfCounters perf;
+
+    if (thread->perf)
+    {
+        if (PerfOpen(&perf) == 0)
+            thread->context.perf = &perf;
+        else
+        {
+            printf("%s\n", SDL_GetError());
+            SDL_ClearError();
+        }
+    }
+
+    while (true)
+    {
+        SDL_SemWait(thread->wake);
+
+        if (SDL_AtomicGet(&thread->quit))
+            break;
+
+        // Several submissions may have been coalesced into the last one
+        if (!TripleBufferAcquire(&thread->states))
+            continue;
+
+        // Cleared after acquiring, so that only a state submitted after
+        // this one can cancel it
+        SDL_AtomicSet(&thread->cancel, 0);
+
+        const RenderState * const state = &thread->state_slots[thread->states.front];
+        RenderFrame       * const frame = &thread->frame_slots[thread->frames.back];
+
+        if (!frame->surface
+         || frame->surface->w != state->width
+         || frame->surface->h != state->height
+         || frame->surface->format->format != state->format)
+        {
+            SDL_FreeSurface(frame->surface);
+
+            frame->surface = SDL_CreateRGBSurfaceWithFormat(
+                0 /* flags */,
+                state->width, state->height,
+                32, state->format
+            );
+
+            if (!frame->surface)
+                goto Error;
+        }
+
+        const uint64_t start = GetTimeNs();
+
+        // Render into the smaller buffer only while moving or refining, so
+        // the frame left on screen once the camera stops is at full size
+        float scale = RefineGetTier(state->refine)->scale;
+
+        if (state->moving)
+            scale = SDL_min(scale, thread->resolution.scale);
+
+        const bool scaling = scale < 1.0f;
+
+        if (scaling)
+        {
+            const int width  = SDL_max((int)lroundf((float)state->width  * scale), 1);
+            const int height = SDL_max((int)lroundf((float)state->height * scale), 1);
+
+            if (!thread->scaled
+             || thread->scaled->w != width
+             || thread->scaled->h != height
+             || thread->scaled->format->format != state->format)
+            {
+                SDL_FreeSurface(thread->scaled);
+
+                thread->scaled = SDL_CreateRGBSurfaceWithFormat(
+                    0 /* flags */,
+                    width, height,
+                    32, state->format
+                );
+
+                if (!thread->scaled)
+                    goto Error;
+            }
+        }
+
+        RenderContext * const context = &thread->context;
+        context->target   = (scaling) ? thread->scaled : frame->surface;
+        context->rotation = state->rotation;
+        context->light    = state->light;
+        context->mode     = RefineMode   (state->mode,    state->refine);
+        context->flags    = RefineFlags  (state->flags,   state->refine);
+        context->samples  = RefineSamples(state->samples, state->refine);
+
+        // Frames drawn while moving are always finished, as every new
+        // state would otherwise cancel the last
+        context->cancel   = (state->moving) ? NULL : &thread->cancel;
+
+        if (Render(context) != 0)
+            goto Error;
+
+        if (context->cancelled)
+            continue;
+
+        if (scaling && UpscaleBilinear(thread->scaled, frame->surface) != 0)
+            goto Error;
+
+        if (state->moving)
+            ResolutionUpdate(&thread->resolution, GetTimeNs() - start);
+
+        if (thread->trace)
+            TraceFrame(thread->trace, context, 1);
+
+        if (context->flags & RENDER_HUD)
+            DrawStats(context, frame->surface);
+
+        frame->state = *state;
+        TripleBufferPublish(&thread->frames);
+
+        SDL_PushEvent(&(SDL_Event){.type = thread->event});
+    }
+
+    if (thread->context.perf)
+        PerfClose(thread->context.perf);
+
+    thread->context.perf = NULL;
+    return 0;
+
+Error:
+    if (thread->context.perf)
+        PerfClose(thread->context.perf);
+
+    thread->context.perf = NULL;
+
+    SDL_snprintf(thread->error, sizeof(thread->error), "%s", SDL_GetError());
+    SDL_AtomicSet(&thread->failed, 1);
+    SDL_PushEvent(&(SDL_Event){.type = thread->event});
+    return 1;
+}
+
+static inline int
+RenderThreadStart(
+          RenderThread * const thread,
+          JobSystem    * const jobs,
+    const Mesh         * const mesh,
+    const Camera       * const camera,
+    const Lights       * const lights,
+          SDL_Surface  * const texture,
+          Trace        * const trace,
+    const bool                 perf,
+    const uint64_t             budget)
+{
+    SDL_assert(thread);
+    SDL_assert(mesh);
+    SDL_assert(camera);
+    SDL_assert(lights);
+
+    memset(thread, 0, sizeof(RenderThread));
+
+    thread->context.jobs   = jobs;
+    thread->context.mesh   = mesh;
+    thread->context.camera = *camera;
+    thread->context.lights = *lights;
+
+    thread->context.texture_source = texture;
+    thread->trace          = trace;
+    thread->perf           = perf;
+
+    ResolutionInit(&thread->resolution, budget);
+
+    TripleBufferInit(&thread->states);
+    TripleBufferInit(&thread->frames);
+
+    thread->event = SDL_RegisterEvents(1);
+
+    if (thread->event == (uint32_t)-1)
+        return SDL_SetError("Unable to register render event");
+
+    thread->wake = SDL_CreateSemaphore(0);
+
+    if (!thread->wake)
+        return -1;
+
+    thread->thread = SDL_CreateThread(RenderThreadMain, "Render", thread);
+
+    if (!thread->thread)
+    {
+        SDL_DestroySemaphore(thread->wake);
+        thread->wake = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void
+RenderThreadSubmit(
+          RenderThread * const thread,
+    const RenderState  * const state)
+{
+    SDL_assert(thread && thread->thread);
+    SDL_assert(state);
+
+    // Set before publishing, so that the state can never cancel itself
+    SDL_AtomicSet(&thread->cancel, 1);
+
+    thread->state_slots[thread->states.back] = *state;
+    TripleBufferPublish(&thread->states);
+
+    SDL_SemPost(thread->wake);
+}
+
+// Returns the latest frame published since the last call, if any. The frame
+// stays valid until the next call.
+static inline const RenderFrame *
+RenderThreadAcquire(
+    RenderThread * const thread)
+{
+    SDL_assert(thread);
+
+    if (!TripleBufferAcquire(&thread->frames))
+        return NULL;
+
+    return &thread->frame_slots[thread->frames.front];
+}
+
+static inline void
+RenderThreadStop(
+    RenderThread * const thread)
+{
+    SDL_assert(thread);
+
+    if (thread->thread)
+    {
+        SDL_AtomicSet(&thread->quit, 1);
+        SDL_SemPost(thread->wake);
+        SDL_WaitThread(thread->thread, NULL);
+        thread->thread = NULL;
+    }
+
+    SDL_DestroySemaphore(thread->wake);
+    thread->wake = NULL;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        SDL_FreeSurface(thread->frame_slots[i].surface);
+        thread->frame_slots[i].surface = NULL;
+    }
+
+    SDL_FreeSurface(thread->scaled);
+    thread->scaled = NULL;
+
+    RenderContextFree(&thread->context);
+}
+
+typedef struct FrameCopy {
+    const SDL_Surface * source;
+          SDL_Surface * dest;
+} FrameCopy;
+
+static void
+FrameCopyRows(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    const FrameCopy * const copy = data;
+
+    (void)worker;
+
+    const size_t row = (size_t)copy->source->w * sizeof(uint32_t);
+
+    for (size_t y = begin; y < end; ++y)
+    {
+        memcpy(
+            (uint8_t *)copy->dest->pixels + y * (size_t)copy->dest->pitch,
+            (const uint8_t *)copy->source->pixels + y * (size_t)copy->source->pitch,
+            row
+        );
+    }
+}
+
+// Rows copied at a time
+#define PRESENT_GRAIN 32
+
+// Copies a frame into the window surface, by rows in parallel when it is a
+// plain copy, and through SDL when it needs converting or blending
+static inline int
+RenderFramePresent(
+          JobSystem   * const jobs,
+          SDL_Surface * const frame,
+          SDL_Surface * const surface)
+{
+    SDL_assert(frame);
+    SDL_assert(surface);
+
+    SDL_BlendMode blend = SDL_BLENDMODE_NONE;
+
+    if (SDL_GetSurfaceBlendMode(frame, &blend) != 0
+     || blend != SDL_BLENDMODE_NONE
+     || frame->w != surface->w
+     || frame->h != surface->h
+     || frame->format->format != surface->format->format
+     || frame->format->BytesPerPixel != (int)sizeof(uint32_t)
+     || SDL_MUSTLOCK(frame)
+     || SDL_MUSTLOCK(surface))
+        return SDL_BlitSurface(frame, NULL, surface, NULL);
+
+    JobParallelFor(
+        jobs, (size_t)frame->h, PRESENT_GRAIN, FrameCopyRows,
+        &(FrameCopy){frame, surface}
+    );
+
+    return 0;
+}
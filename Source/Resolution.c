@@ -0,0 +1,166 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Smallest fraction of the window size rendered while holding a budget
+const float RESOLUTION_MIN_SCALE = 0.25f;
+
+// Scales are rounded to this step, so that the buffers are not resized for
+// every small change in frame time
+const float RESOLUTION_SCALE_STEP = 1.0f / 32.0f;
+
+// Chooses the internal size rendered each frame, from the time taken by the
+// previous frames against a budget. The cost of a frame is assumed to grow
+// with the number of pixels, so the linear scale follows the square root of
+// the ratio between the budget and the measured time.
+typedef struct ResolutionController {
+    uint64_t budget;  // Nanoseconds per frame, zero disables scaling
+    float    scale;   // Linear fraction of the window size
+    float    time;    // Smoothed frame time at the current scale
+} ResolutionController;
+
+static inline void
+ResolutionInit(
+    ResolutionController * const controller,
+    const uint64_t               budget)
+{
+    SDL_assert(controller);
+
+    *controller = (ResolutionController){
+        .budget = budget,
+        .scale  = 1.0f,
+    };
+}
+
+static inline void
+ResolutionUpdate(
+    ResolutionController * const controller,
+    const uint64_t               time)
+{
+    SDL_assert(controller);
+
+    if (!controller->budget)
+        return;
+
+    // Single slow frames should not halve the resolution
+    controller->time = (controller->time > 0.0f)
+        ? controller->time * 0.5f + (float)time * 0.5f
+        : (float)time;
+
+    const float budget = (float)controller->budget;
+
+    // Hold the scale while within the budget and not far below it
+    if (controller->time <= budget && controller->time >= budget * 0.8f)
+        return;
+
+    // Aim slightly under the budget, and grow slowly to avoid oscillating
+    float scale = controller->scale
+                * sqrtf(budget * 0.9f / fmaxf(controller->time, 1.0f));
+
+    scale = fminf(scale, controller->scale * 1.1f);
+    scale = roundf(scale / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP;
+    scale = fmaxf(fminf(scale, 1.0f), RESOLUTION_MIN_SCALE);
+
+    if (scale != controller->scale)
+    {
+        controller->scale = scale;
+        controller->time  = 0.0f;
+    }
+}
+
+static inline int
+ResolutionSize(
+    const ResolutionController * const controller,
+    const int                          size)
+{
+    SDL_assert(controller);
+    SDL_assert(size > 0);
+
+    return SDL_max((int)lroundf((float)size * controller->scale), 1);
+}
+
+// Scales a 32 bit surface into another of the same format, filtering between
+// the four nearest source pixels
+static inline int
+UpscaleBilinear(
+    SDL_Surface * const source,
+    SDL_Surface * const target)
+{
+    SDL_assert(source && source->format->BytesPerPixel == 4);
+    SDL_assert(target && target->format->BytesPerPixel == 4);
+    SDL_assert(source->format->format == target->format->format);
+
+    if (SDL_MUSTLOCK(source))
+        if (SDL_LockSurface(source) != 0)
+            return -1;
+
+    if (SDL_MUSTLOCK(target))
+        if (SDL_LockSurface(target) != 0)
+        {
+            if (SDL_MUSTLOCK(source))
+                SDL_UnlockSurface(source);
+
+            return -1;
+        }
+
+    // Source coordinates of target pixel centers, in 16.16 fixed point
+    const int64_t step_x = ((int64_t)source->w << 16) / target->w;
+    const int64_t step_y = ((int64_t)source->h << 16) / target->h;
+
+    const int64_t max_x = (int64_t)(source->w - 1) << 16;
+    const int64_t max_y = (int64_t)(source->h - 1) << 16;
+
+    for (int y = 0; y < target->h; ++y)
+    {
+        int64_t fy = step_y / 2 - (1 << 15) + y * step_y;
+        fy = SDL_max(SDL_min(fy, max_y), 0);
+
+        const int      y0 = (int)(fy >> 16);
+        const int      y1 = SDL_min(y0 + 1, source->h - 1);
+        const uint32_t ty = (uint32_t)(fy >> 8) & 0xFF;
+
+        const uint32_t * const row0 = (const uint32_t *)(
+            (const uint8_t *)source->pixels + y0 * source->pitch);
+
+        const uint32_t * const row1 = (const uint32_t *)(
+            (const uint8_t *)source->pixels + y1 * source->pitch);
+
+        uint32_t * const out = (uint32_t *)(
+            (uint8_t *)target->pixels + y * target->pitch);
+
+        int64_t fx = step_x / 2 - (1 << 15);
+
+        for (int x = 0; x < target->w; ++x, fx += step_x)
+        {
+            const int64_t  cx = SDL_max(SDL_min(fx, max_x), 0);
+            const int      x0 = (int)(cx >> 16);
+            const int      x1 = SDL_min(x0 + 1, source->w - 1);
+            const uint32_t tx = (uint32_t)(cx >> 8) & 0xFF;
+
+            out[x] = LerpPixel(
+                LerpPixel(row0[x0], row0[x1], tx),
+                LerpPixel(row1[x0], row1[x1], tx),
+                ty
+            );
+        }
+    }
+
+    if (SDL_MUSTLOCK(target))
+        SDL_UnlockSurface(target);
+
+    if (SDL_MUSTLOCK(source))
+        SDL_UnlockSurface(source);
+
+    return 0;
+}
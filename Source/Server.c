@@ -0,0 +1,1295 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Renders on request for other processes, keeping meshes loaded between
+// requests. Clients connect to a Unix domain socket and send one request per
+// line. Frames are rendered straight into slots of a ring in POSIX shared
+// memory, which clients map once and read in place.
+
+// Clients connected at once
+#define SERVER_MAX_CLIENTS 64
+
+// Longest request line
+#define SERVER_LINE_MAX 4096
+
+// Replies held for a client that isn't reading them, before it is dropped
+#define SERVER_OUTPUT_MAX 4096
+
+// Start of the shared memory, followed by the slots from data_offset on.
+// Slots are slot_size bytes apart, and hold RGBA pixels, 8 bits per
+// channel, in rows of 4 * width bytes.
+typedef struct FrameRingHeader {
+    char     magic[8];  // "QRFRAMES", not terminated
+    uint32_t version;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    uint64_t data_offset;
+} FrameRingHeader;
+
+#define FRAME_RING_VERSION 1
+
+typedef enum SlotState {
+    SLOT_FREE,
+    SLOT_RENDERING,
+    SLOT_HELD,  // Rendered, until the client releases it
+} SlotState;
+
+typedef struct FrameSlot {
+    SlotState state;
+    uint64_t  client;
+} FrameSlot;
+
+typedef struct FrameRing {
+    char        name[64];
+    int         fd;
+    uint8_t   * memory;
+    size_t      size;
+    size_t      slot_size;
+    size_t      data_offset;
+    FrameSlot * slots;
+    size_t      slot_count;
+} FrameRing;
+
+// Maps a shared memory object with room for slot_count frames of up to
+// width by height pixels
+static inline int
+FrameRingOpen(
+          FrameRing * const ring,
+    const size_t            slot_count,
+    const int               width,
+    const int               height)
+{
+    SDL_assert(ring);
+    SDL_assert(slot_count > 0);
+
+    memset(ring, 0, sizeof(FrameRing));
+    ring->fd = -1;
+
+    // Slots start on page boundaries, so that each can be mapped alone
+    const size_t page = 4096;
+    const size_t frame = SizeMult(SizeMult((size_t)width, (size_t)height), sizeof(uint32_t));
+
+    ring->slot_size   = SizeAdd(frame, page - 1) & ~(page - 1);
+    ring->data_offset = page;
+    ring->size        = SizeAdd(ring->data_offset, SizeMult(ring->slot_size, slot_count));
+    ring->slot_count  = slot_count;
+
+    SDL_snprintf(ring->name, sizeof(ring->name), "/%s.%ld", APP_NAME, (long)getpid());
+
+    ring->slots = calloc(slot_count, sizeof(FrameSlot));
+
+    if (!ring->slots)
+        return SDL_SetError("Unable to allocate frame slots");
+
+    ring->fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (ring->fd < 0)
+    {
+        SDL_SetError("Unable to create shared memory %s: %s", ring->name, strerror(errno));
+        goto Error;
+    }
+
+    if (ftruncate(ring->fd, (off_t)ring->size) != 0)
+    {
+        SDL_SetError("Unable to size shared memory: %s", strerror(errno));
+        goto Error;
+    }
+
+    void * const memory = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+
+    if (memory == MAP_FAILED)
+    {
+        SDL_SetError("Unable to map shared memory: %s", strerror(errno));
+        goto Error;
+    }
+
+    ring->memory = memory;
+
+    FrameRingHeader header = {
+        .version     = FRAME_RING_VERSION,
+        .slot_count  = (uint32_t)slot_count,
+        .slot_size   = ring->slot_size,
+        .data_offset = ring->data_offset,
+    };
+
+    memcpy(header.magic, "QRFRAMES", sizeof(header.magic));
+    memcpy(ring->memory, &header, sizeof(header));
+
+    return 0;
+
+Error:
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+        shm_unlink(ring->name);
+    }
+
+    free(ring->slots);
+    memset(ring, 0, sizeof(FrameRing));
+    ring->fd = -1;
+    return -1;
+}
+
+static inline void
+FrameRingClose(
+    FrameRing * const ring)
+{
+    SDL_assert(ring);
+
+    if (ring->memory)
+        munmap(ring->memory, ring->size);
+
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+        shm_unlink(ring->name);
+    }
+
+    free(ring->slots);
+    memset(ring, 0, sizeof(FrameRing));
+    ring->fd = -1;
+}
+
+static inline size_t
+FrameRingOffset(
+    const FrameRing * const ring,
+    const size_t            slot)
+{
+    SDL_assert(ring);
+    SDL_assert(slot < ring->slot_count);
+
+    return ring->data_offset + slot * ring->slot_size;
+}
+
+typedef struct MeshCache MeshCache;
+
+typedef struct CachedMesh {
+    MeshCache  * cache;
+    char       * path;
+    Mesh       * mesh;
+    Lights       lights;
+    size_t       bytes;
+    uint64_t     serial;   // Unique to each load, as meshes may reuse addresses
+    uint64_t     used;     // Cache clock when last requested
+    int          refs;     // Requests waiting on it or rendering it
+
+    // Loaded by a job, and only read once done is set
+    bool         loading;  // Until the main thread has seen it done
+    SDL_atomic_t done;
+    bool         failed;
+    double       seconds;
+    char         error[256];
+} CachedMesh;
+
+// Meshes kept loaded between requests. Once over the budget, the least
+// recently requested meshes are freed, as soon as nothing renders them.
+// Meshes are loaded by jobs, so that other requests are served meanwhile.
+struct MeshCache {
+    CachedMesh ** data;
+    size_t        size;
+    size_t        bytes;
+    size_t        budget;
+    uint64_t      clock;
+    uint64_t      serials;
+
+    JobSystem   * jobs;     // Optional
+    JobCounter  * pending;
+    size_t        lights;   // Scattered around each mesh
+    int           wake;     // Written by finished loads
+
+    uint64_t      hits;
+    uint64_t      misses;
+    uint64_t      evictions;
+};
+
+static inline void
+CachedMeshFree(
+    CachedMesh * const entry)
+{
+    SDL_assert(entry && !entry->refs);
+
+    if (entry->mesh)
+        MeshFree(entry->mesh);
+
+    free(entry->mesh);
+    free(entry->lights.data);
+    free(entry->path);
+    free(entry);
+}
+
+static inline void
+MeshCacheTrim(
+    MeshCache * const cache)
+{
+    SDL_assert(cache);
+
+    while (cache->bytes > cache->budget)
+    {
+        size_t oldest = cache->size;
+
+        for (size_t i = 0; i < cache->size; ++i)
+            if (!cache->data[i]->refs && !cache->data[i]->loading
+             && (oldest == cache->size || cache->data[i]->used < cache->data[oldest]->used))
+                oldest = i;
+
+        // Everything left is in use
+        if (oldest == cache->size)
+            break;
+
+        CachedMesh * const entry = cache->data[oldest];
+
+        cache->bytes -= entry->bytes;
+        cache->data[oldest] = cache->data[--cache->size];
+        cache->evictions++;
+
+        CachedMeshFree(entry);
+    }
+}
+
+static void
+MeshCacheLoadJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    CachedMesh * const entry = data;
+    SDL_assert(entry && entry->cache);
+
+    (void)begin;
+    (void)end;
+    (void)worker;
+
+    const MeshCache * const cache = entry->cache;
+    const uint64_t          start = GetTimeNs();
+
+    SDL_ClearError();
+
+    // Printed once by the main thread instead, as loads run side by side
+    entry->mesh = LoadObj(entry->path, cache->jobs, false);
+
+    if (!entry->mesh
+     || (cache->lights && LightsScatter(&entry->lights, cache->lights, entry->mesh)))
+    {
+        // Empty files fail without setting an error
+        const char * const error = SDL_GetError();
+
+        SDL_snprintf(entry->error, sizeof(entry->error), "%s", (*error) ? error : "No geometry data found");
+        entry->failed = true;
+    }
+    else
+        entry->bytes = MeshMemory(entry->mesh);
+
+    entry->seconds = (double)(GetTimeNs() - start) / 1e9;
+
+    SDL_AtomicSet(&entry->done, 1);
+
+    // The main thread only scans for finished loads when woken
+    const ssize_t written = write(cache->wake, "", 1);
+    (void)written;
+}
+
+// Returns the mesh loaded from a path, starting to load it if it isn't
+// already, and holds it until released. The mesh can only be used once
+// MeshCacheFinishLoads() has seen its load done.
+static inline CachedMesh *
+MeshCacheAcquire(
+          MeshCache * const cache,
+    const char      * const path)
+{
+    SDL_assert(cache);
+    SDL_assert(path);
+
+    cache->clock++;
+
+    for (size_t i = 0; i < cache->size; ++i)
+    {
+        CachedMesh * const entry = cache->data[i];
+
+        if (strcmp(entry->path, path))
+            continue;
+
+        entry->used = cache->clock;
+        entry->refs++;
+        cache->hits++;
+        return entry;
+    }
+
+    CachedMesh ** const data = realloc(
+        cache->data, SizeMult(sizeof(CachedMesh *), SizeAdd(cache->size, 1))
+    );
+
+    if (!data)
+    {
+        SDL_SetError("Unable to allocate mesh cache");
+        return NULL;
+    }
+
+    cache->data = data;
+
+    CachedMesh * const entry = calloc(1, sizeof(CachedMesh));
+
+    if (!entry || !(entry->path = SDL_strdup(path)))
+    {
+        free(entry);
+        SDL_SetError("Unable to allocate mesh cache");
+        return NULL;
+    }
+
+    entry->cache   = cache;
+    entry->used    = cache->clock;
+    entry->refs    = 1;
+    entry->loading = true;
+    SDL_AtomicSet(&entry->done, 0);
+
+    cache->data[cache->size++] = entry;
+
+    JobRun(cache->jobs, MeshCacheLoadJob, entry, 1, 1, cache->pending);
+    return entry;
+}
+
+// Counts every load that finished since the last call, and returns the
+// first that failed, if any. Failed meshes are left in the cache until
+// released with MeshCacheDiscard().
+static inline CachedMesh *
+MeshCacheFinishLoads(
+    MeshCache * const cache)
+{
+    SDL_assert(cache);
+
+    CachedMesh * failed = NULL;
+
+    for (size_t i = 0; i < cache->size; ++i)
+    {
+        CachedMesh * const entry = cache->data[i];
+
+        if (!entry->loading || !SDL_AtomicGet(&entry->done))
+            continue;
+
+        if (entry->failed)
+        {
+            failed = (failed) ? failed : entry;
+            continue;
+        }
+
+        entry->loading = false;
+        entry->serial  = ++cache->serials;
+
+        cache->bytes += entry->bytes;
+        cache->misses++;
+
+        printf(
+            "loaded: %s, %zu verts, %zu faces, %zu KiB in %.3f s\n",
+            entry->path,
+            entry->mesh->vertices.size,
+            entry->mesh->faces.size,
+            entry->bytes / 1024,
+            entry->seconds
+        );
+    }
+
+    fflush(stdout);
+
+    MeshCacheTrim(cache);
+    return failed;
+}
+
+// Frees a mesh that failed to load, once every request for it is released
+static inline void
+MeshCacheDiscard(
+    MeshCache  * const cache,
+    CachedMesh * const entry)
+{
+    SDL_assert(cache);
+    SDL_assert(entry && entry->failed && !entry->refs);
+
+    for (size_t i = 0; i < cache->size; ++i)
+    {
+        if (cache->data[i] != entry)
+            continue;
+
+        cache->data[i] = cache->data[--cache->size];
+        break;
+    }
+
+    CachedMeshFree(entry);
+}
+
+static inline void
+MeshCacheRelease(
+    MeshCache  * const cache,
+    CachedMesh * const entry)
+{
+    SDL_assert(cache);
+    SDL_assert(entry && entry->refs > 0);
+
+    entry->refs--;
+    MeshCacheTrim(cache);
+}
+
+static inline void
+MeshCacheFree(
+    MeshCache * const cache)
+{
+    SDL_assert(cache);
+
+    for (size_t i = 0; i < cache->size; ++i)
+        CachedMeshFree(cache->data[i]);
+
+    free(cache->data);
+    memset(cache, 0, sizeof(MeshCache));
+}
+
+typedef struct Server Server;
+
+typedef struct ServerRequest {
+    Server               * server;
+    struct ServerRequest * next;    // Waiting for a slot, or rendering
+
+    uint64_t               client;  // Which may leave before it is done
+    long                   number;  // Render requests the client made before
+    CachedMesh           * mesh;
+    RenderMode             mode;
+    Angles                 view;
+    int                    width;
+    int                    height;
+    size_t                 slot;
+
+    SDL_atomic_t           done;
+    bool                   failed;
+    char                   error[256];
+} ServerRequest;
+
+typedef struct ServerClient {
+    int      fd;  // Negative once dropped
+    uint64_t id;
+    long     requests;
+
+    char     input[SERVER_LINE_MAX];
+    size_t   input_size;
+
+    char     output[SERVER_OUTPUT_MAX];
+    size_t   output_size;
+} ServerClient;
+
+// Render state of each thread of the scheduler, by worker index
+typedef struct ServerWorker {
+    RenderContext context;
+    uint64_t      serial;  // Of the mesh last rendered
+} ServerWorker;
+
+struct Server {
+    const Options  * options;
+          JobSystem * jobs;  // Optional
+          Trace    * trace;  // Optional
+
+    ServerWorker   * workers;
+    JobCounter       pending;
+
+    int              listener;
+    int              wake[2];  // Written by finished renders
+
+    ServerClient     clients[SERVER_MAX_CLIENTS];
+    size_t           client_count;
+    uint64_t         client_ids;
+
+    FrameRing        ring;
+    MeshCache        cache;
+
+    // Requests in the order they arrived, waiting for a free slot
+    ServerRequest  * waiting;
+    ServerRequest ** waiting_end;
+
+    ServerRequest  * rendering;
+
+    uint64_t         frames;
+    uint64_t         failures;
+};
+
+static volatile sig_atomic_t server_quit = 0;
+
+static void
+ServerSignal(
+    const int signal)
+{
+    (void)signal;
+    server_quit = 1;
+}
+
+static inline void
+ServerDrop(
+    ServerClient * const client)
+{
+    SDL_assert(client);
+
+    if (client->fd >= 0)
+        close(client->fd);
+
+    client->fd = -1;
+}
+
+// Sends as much of the queued replies as the socket takes
+static inline void
+ServerFlush(
+    ServerClient * const client)
+{
+    SDL_assert(client);
+
+    if (client->fd < 0 || !client->output_size)
+        return;
+
+    const ssize_t sent = send(client->fd, client->output, client->output_size, 0);
+
+    if (sent < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            ServerDrop(client);
+
+        return;
+    }
+
+    client->output_size -= (size_t)sent;
+    memmove(client->output, client->output + sent, client->output_size);
+}
+
+// Queues a reply, dropping the client once it stops reading them
+static void
+ServerReply(
+          ServerClient * const client,
+    const char         * const format,
+    ...)
+{
+    SDL_assert(client);
+    SDL_assert(format);
+
+    if (client->fd < 0)
+        return;
+
+    const size_t space = sizeof(client->output) - client->output_size;
+
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(client->output + client->output_size, space, format, args);
+    va_end(args);
+
+    if (length < 0 || (size_t)length >= space)
+    {
+        ServerDrop(client);
+        return;
+    }
+
+    client->output_size += (size_t)length;
+    ServerFlush(client);
+}
+
+static inline ServerClient *
+ServerFindClient(
+          Server * const server,
+    const uint64_t       id)
+{
+    SDL_assert(server);
+
+    for (size_t i = 0; i < server->client_count; ++i)
+        if (server->clients[i].id == id && server->clients[i].fd >= 0)
+            return &server->clients[i];
+
+    return NULL;
+}
+
+static void
+ServerRenderJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    ServerRequest * const request = data;
+    SDL_assert(request && request->server);
+
+    (void)begin;
+    (void)end;
+
+    Server        * const server  = request->server;
+    ServerWorker  * const state   = &server->workers[worker];
+    RenderContext * const context = &state->context;
+
+    if (state->serial != request->mesh->serial)
+    {
+        RenderContextForgetMesh(context);
+        state->serial = request->mesh->serial;
+    }
+
+    // Drawn straight into the client's slot
+    SDL_Surface * const target = SDL_CreateRGBSurfaceWithFormatFrom(
+        server->ring.memory + FrameRingOffset(&server->ring, request->slot),
+        request->width, request->height,
+        32, request->width * (int)sizeof(uint32_t),
+        SDL_PIXELFORMAT_RGBA32
+    );
+
+    int status = -1;
+
+    if (target)
+    {
+        context->target   = target;
+        context->mesh     = request->mesh->mesh;
+        context->lights   = request->mesh->lights;
+        context->mode     = request->mode;
+        context->rotation = AnglesToRotation(&request->view);
+
+        status = Render(context);
+
+        if (status == 0 && server->trace)
+            TraceFrame(server->trace, context, (int)worker + 1);
+
+        if (status == 0 && (context->flags & RENDER_HUD))
+            DrawStats(context, target);
+
+        context->target = NULL;
+        SDL_FreeSurface(target);
+    }
+
+    if (status != 0)
+    {
+        SDL_snprintf(request->error, sizeof(request->error), "%s", SDL_GetError());
+        request->failed = true;
+    }
+
+    SDL_AtomicSet(&request->done, 1);
+
+    // The main thread only scans for finished renders when woken
+    const ssize_t written = write(server->wake[1], "", 1);
+    (void)written;
+}
+
+// Unlinks a waiting request, given the link pointing to it
+static inline void
+ServerUnlinkWaiting(
+    Server         *  const server,
+    ServerRequest ** const link)
+{
+    SDL_assert(server);
+    SDL_assert(link && *link);
+
+    ServerRequest * const request = *link;
+
+    *link = request->next;
+
+    if (!*link)
+        server->waiting_end = link;
+}
+
+// Starts rendering waiting requests in order while there are free slots,
+// passing over those whose mesh is still loading
+static inline void
+ServerStartRenders(
+    Server * const server)
+{
+    SDL_assert(server);
+
+    for (ServerRequest ** link = &server->waiting; *link; )
+    {
+        if ((*link)->mesh->loading)
+        {
+            link = &(*link)->next;
+            continue;
+        }
+
+        size_t slot = 0;
+        while (slot < server->ring.slot_count && server->ring.slots[slot].state != SLOT_FREE)
+            slot++;
+
+        if (slot == server->ring.slot_count)
+            return;
+
+        ServerRequest * const request = *link;
+
+        ServerUnlinkWaiting(server, link);
+
+        server->ring.slots[slot] = (FrameSlot){SLOT_RENDERING, request->client};
+        request->slot = slot;
+
+        request->next      = server->rendering;
+        server->rendering  = request;
+
+        JobRun(server->jobs, ServerRenderJob, request, 1, 1, &server->pending);
+    }
+}
+
+// Replies to every finished render, and frees the slots of any whose
+// client has left
+static inline void
+ServerFinishRenders(
+    Server * const server)
+{
+    SDL_assert(server);
+
+    for (ServerRequest ** link = &server->rendering; *link; )
+    {
+        ServerRequest * const request = *link;
+
+        if (!SDL_AtomicGet(&request->done))
+        {
+            link = &request->next;
+            continue;
+        }
+
+        *link = request->next;
+
+        ServerClient * const client = ServerFindClient(server, request->client);
+        FrameSlot    * const slot   = &server->ring.slots[request->slot];
+
+        if (request->failed)
+        {
+            server->failures++;
+            slot->state = SLOT_FREE;
+
+            if (client)
+                ServerReply(client, "error %ld %s\n", request->number, request->error);
+        }
+        else if (client)
+        {
+            server->frames++;
+            slot->state = SLOT_HELD;
+
+            ServerReply(
+                client, "frame %ld %zu %zu %d %d %d\n",
+                request->number,
+                request->slot,
+                FrameRingOffset(&server->ring, request->slot),
+                request->width, request->height,
+                request->width * (int)sizeof(uint32_t)
+            );
+        }
+        else
+        {
+            server->frames++;
+            slot->state = SLOT_FREE;
+        }
+
+        MeshCacheRelease(&server->cache, request->mesh);
+        free(request);
+    }
+}
+
+// Fails the waiting requests for meshes that didn't load
+static inline void
+ServerFinishLoads(
+    Server * const server)
+{
+    SDL_assert(server);
+
+    CachedMesh * failed;
+
+    while ((failed = MeshCacheFinishLoads(&server->cache)))
+    {
+        for (ServerRequest ** link = &server->waiting; *link; )
+        {
+            ServerRequest * const request = *link;
+
+            if (request->mesh != failed)
+            {
+                link = &request->next;
+                continue;
+            }
+
+            ServerClient * const client = ServerFindClient(server, request->client);
+
+            if (client)
+                ServerReply(client, "error %ld %s\n", request->number, failed->error);
+
+            server->failures++;
+
+            ServerUnlinkWaiting(server, link);
+            MeshCacheRelease(&server->cache, failed);
+            free(request);
+        }
+
+        MeshCacheDiscard(&server->cache, failed);
+    }
+}
+
+// Handles one line from a client:
+//     render <file> <w>x<h> <mode> <yaw>,<pitch>,<roll>
+//     release <slot>
+static inline void
+ServerHandleLine(
+    Server       * const server,
+    ServerClient * const client,
+    char         *       line)
+{
+    SDL_assert(server);
+    SDL_assert(client);
+    SDL_assert(line);
+
+    const char * const command = NextToken(&line);
+
+    if (!command)
+        return;
+
+    if (!strcmp(command, "release"))
+    {
+        const char * const value = NextToken(&line);
+
+        int slot = 0;
+        if (!value || ParseInt(value, 0, INT_MAX, &slot)
+         || (size_t)slot >= server->ring.slot_count
+         || server->ring.slots[slot].state  != SLOT_HELD
+         || server->ring.slots[slot].client != client->id)
+        {
+            ServerReply(client, "error - Slot %s isn't held\n", (value) ? value : "");
+            return;
+        }
+
+        server->ring.slots[slot].state = SLOT_FREE;
+        return;
+    }
+
+    if (strcmp(command, "render"))
+    {
+        ServerReply(client, "error - Unknown command %s\n", command);
+        return;
+    }
+
+    const long number = client->requests++;
+
+    const char * const file  = NextToken(&line);
+    const char * const size  = NextToken(&line);
+    const char * const mode  = NextToken(&line);
+    const char * const view  = NextToken(&line);
+
+    ServerRequest request = {.number = number};
+
+    if (!file || !size || !mode || !view || NextToken(&line))
+    {
+        ServerReply(client, "error %ld Expected render <file> <w>x<h> <mode> <y>,<p>,<r>\n", number);
+        return;
+    }
+
+    if (ParseSize(size, &request.width, &request.height)
+     || ParseRenderMode(mode, &request.mode)
+     || ParseAngles(view, &request.view))
+    {
+        ServerReply(client, "error %ld %s\n", number, SDL_GetError());
+        return;
+    }
+
+    if (request.width > server->options->width || request.height > server->options->height)
+    {
+        ServerReply(
+            client, "error %ld Frames are at most %dx%d\n",
+            number, server->options->width, server->options->height
+        );
+        return;
+    }
+
+    request.mesh = MeshCacheAcquire(&server->cache, file);
+
+    if (!request.mesh)
+    {
+        ServerReply(client, "error %ld %s\n", number, SDL_GetError());
+        return;
+    }
+
+    ServerRequest * const queued = malloc(sizeof(ServerRequest));
+
+    if (!queued)
+    {
+        MeshCacheRelease(&server->cache, request.mesh);
+        ServerReply(client, "error %ld Unable to allocate request\n", number);
+        return;
+    }
+
+    request.server = server;
+    request.client = client->id;
+
+    *queued = request;
+    SDL_AtomicSet(&queued->done, 0);
+
+    *server->waiting_end = queued;
+    server->waiting_end  = &queued->next;
+}
+
+// Reads whatever a client sent, handling each complete line
+static inline void
+ServerRead(
+    Server       * const server,
+    ServerClient * const client)
+{
+    SDL_assert(server);
+    SDL_assert(client && client->fd >= 0);
+
+    const ssize_t size = recv(
+        client->fd,
+        client->input + client->input_size,
+        sizeof(client->input) - client->input_size - 1,
+        0
+    );
+
+    if (size <= 0)
+    {
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+
+        ServerDrop(client);
+        return;
+    }
+
+    client->input_size += (size_t)size;
+    client->input[client->input_size] = '\0';
+
+    char * start = client->input;
+
+    for (char * newline; (newline = strchr(start, '\n')); start = newline + 1)
+    {
+        *newline = '\0';
+        ServerHandleLine(server, client, start);
+
+        if (client->fd < 0)
+            return;
+    }
+
+    client->input_size -= (size_t)(start - client->input);
+    memmove(client->input, start, client->input_size);
+
+    // A line longer than the buffer is never going to finish
+    if (client->input_size == sizeof(client->input) - 1)
+        ServerDrop(client);
+}
+
+static inline void
+ServerAccept(
+    Server * const server)
+{
+    SDL_assert(server);
+
+    const int fd = accept(server->listener, NULL, NULL);
+
+    if (fd < 0)
+        return;
+
+    if (server->client_count == SERVER_MAX_CLIENTS
+     || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        close(fd);
+        return;
+    }
+
+    ServerClient * const client = &server->clients[server->client_count++];
+
+    client->fd          = fd;
+    client->id          = ++server->client_ids;
+    client->requests    = 0;
+    client->input_size  = 0;
+    client->output_size = 0;
+
+    ServerReply(
+        client, "hello %s %zu %zu %zu\n",
+        server->ring.name,
+        server->ring.slot_count,
+        server->ring.slot_size,
+        server->ring.data_offset
+    );
+}
+
+// Forgets clients that left, freeing their slots and waiting requests.
+// Their renders in flight free their own slots when done.
+static inline void
+ServerRemoveClients(
+    Server * const server)
+{
+    SDL_assert(server);
+
+    for (size_t i = 0; i < server->client_count; )
+    {
+        const ServerClient * const client = &server->clients[i];
+
+        if (client->fd >= 0)
+        {
+            i++;
+            continue;
+        }
+
+        for (size_t slot = 0; slot < server->ring.slot_count; ++slot)
+            if (server->ring.slots[slot].state  == SLOT_HELD
+             && server->ring.slots[slot].client == client->id)
+                server->ring.slots[slot].state = SLOT_FREE;
+
+        server->waiting_end = &server->waiting;
+
+        for (ServerRequest ** link = &server->waiting; *link; )
+        {
+            ServerRequest * const request = *link;
+
+            if (request->client != client->id)
+            {
+                link = &request->next;
+                server->waiting_end = link;
+                continue;
+            }
+
+            *link = request->next;
+            MeshCacheRelease(&server->cache, request->mesh);
+            free(request);
+        }
+
+        server->clients[i] = server->clients[--server->client_count];
+    }
+}
+
+static inline int
+ServerListen(
+          Server * const server,
+    const char   * const path)
+{
+    SDL_assert(server);
+    SDL_assert(path);
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        return SDL_SetError("Socket path is too long");
+
+    strcpy(address.sun_path, path);
+
+    server->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (server->listener < 0)
+        return SDL_SetError("Unable to create socket: %s", strerror(errno));
+
+    if (bind(server->listener, (const struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        SDL_SetError("Unable to bind %s: %s", path, strerror(errno));
+        close(server->listener);
+        server->listener = -1;
+        return -1;
+    }
+
+    if (listen(server->listener, SERVER_MAX_CLIENTS) != 0
+     || fcntl(server->listener, F_SETFL, fcntl(server->listener, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        SDL_SetError("Unable to listen on %s: %s", path, strerror(errno));
+        close(server->listener);
+        server->listener = -1;
+        unlink(path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+RunServer(
+    const Options     * const options,
+          JobSystem   * const jobs,
+    const Camera      * const camera,
+    const Vector      * const light,
+          SDL_Surface * const texture,
+          Trace       * const trace)
+{
+    SDL_assert(options && options->serve);
+    SDL_assert(camera);
+    SDL_assert(light);
+
+    const size_t thread_count = JobThreadCount(jobs);
+
+    Server * const server = calloc(1, sizeof(Server));
+
+    if (!server)
+        return SDL_SetError("Unable to allocate server");
+
+    server->options     = options;
+    server->jobs        = jobs;
+    server->trace       = trace;
+    server->listener    = -1;
+    server->wake[0]     = -1;
+    server->wake[1]     = -1;
+    server->waiting_end = &server->waiting;
+    server->ring.fd     = -1;
+
+    server->cache.budget  = SizeMult((size_t)options->cache, 1024 * 1024);
+    server->cache.jobs    = jobs;
+    server->cache.pending = &server->pending;
+    server->cache.lights  = (size_t)options->lights;
+
+    int status = -1;
+
+    server->workers = calloc(thread_count, sizeof(ServerWorker));
+
+    if (!server->workers)
+    {
+        SDL_SetError("Unable to allocate server workers");
+        goto Cleanup;
+    }
+
+    // Renders don't split their own frames, as concurrent requests keep the
+    // other threads busy
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        server->workers[i].context = (RenderContext){
+            .camera  = *camera,
+            .light   = *light,
+            .flags   = options->flags,
+            .samples = options->samples,
+
+            .texture_source = texture,
+        };
+    }
+
+    if (pipe(server->wake) != 0
+     || fcntl(server->wake[0], F_SETFL, O_NONBLOCK) != 0
+     || fcntl(server->wake[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        SDL_SetError("Unable to create pipe: %s", strerror(errno));
+        goto Cleanup;
+    }
+
+    server->cache.wake = server->wake[1];
+
+    if (FrameRingOpen(&server->ring, (size_t)options->slots, options->width, options->height))
+        goto Cleanup;
+
+    if (ServerListen(server, options->serve))
+        goto Cleanup;
+
+    // Stopped by a signal, and clients leaving must not stop the server
+    struct sigaction action = {.sa_handler = ServerSignal};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT,  &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf(
+        "serving: %s\n"
+        "frames: %s, %zu slots of %dx%d\n"
+        "threads: %zu\n",
+        options->serve,
+        server->ring.name, server->ring.slot_count, options->width, options->height,
+        thread_count
+    );
+
+    fflush(stdout);
+
+    struct pollfd fds[SERVER_MAX_CLIENTS + 2];
+
+    while (!server_quit)
+    {
+        fds[0] = (struct pollfd){.fd = server->wake[0], .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = server->listener, .events = POLLIN};
+
+        for (size_t i = 0; i < server->client_count; ++i)
+        {
+            const ServerClient * const client = &server->clients[i];
+
+            fds[i + 2] = (struct pollfd){
+                .fd     = client->fd,
+                .events = (short)(POLLIN | ((client->output_size) ? POLLOUT : 0)),
+            };
+        }
+
+        const size_t client_count = server->client_count;
+
+        if (poll(fds, (nfds_t)(client_count + 2), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            SDL_SetError("Unable to poll: %s", strerror(errno));
+            goto Cleanup;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            char drain[256];
+            while (read(server->wake[0], drain, sizeof(drain)) > 0);
+
+            ServerFinishLoads(server);
+            ServerFinishRenders(server);
+        }
+
+        // Only clients polled above, as accepting may add more
+        for (size_t i = 0; i < client_count; ++i)
+        {
+            ServerClient * const client = &server->clients[i];
+
+            if (client->fd >= 0 && (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+                ServerRead(server, client);
+
+            if (client->fd >= 0 && (fds[i + 2].revents & POLLOUT))
+                ServerFlush(client);
+        }
+
+        if (fds[1].revents & POLLIN)
+            ServerAccept(server);
+
+        ServerRemoveClients(server);
+        ServerStartRenders(server);
+    }
+
+    status = 0;
+
+Cleanup:
+    JobWait(jobs, &server->pending);
+
+    if (server->rendering)
+        ServerFinishRenders(server);
+
+    for (size_t i = 0; i < server->client_count; ++i)
+        ServerDrop(&server->clients[i]);
+
+    ServerRemoveClients(server);
+
+    // Errors were already sent to the clients that caused them
+    if (status == 0)
+        SDL_ClearError();
+
+    if (status == 0)
+        printf(
+            "frames: %llu (%llu failed)\n"
+            "meshes: %llu loaded, %llu reused, %llu evicted\n",
+            (unsigned long long)server->frames,
+            (unsigned long long)server->failures,
+            (unsigned long long)server->cache.misses,
+            (unsigned long long)server->cache.hits,
+            (unsigned long long)server->cache.evictions
+        );
+
+    if (server->workers)
+    {
+        for (size_t i = 0; i < thread_count; ++i)
+            RenderContextFree(&server->workers[i].context);
+    }
+
+    if (server->listener >= 0)
+    {
+        close(server->listener);
+        unlink(options->serve);
+    }
+
+    if (server->wake[0] >= 0)
+        close(server->wake[0]);
+
+    if (server->wake[1] >= 0)
+        close(server->wake[1]);
+
+    FrameRingClose(&server->ring);
+    MeshCacheFree(&server->cache);
+
+    free(server->workers);
+    free(server);
+
+    return status;
+}
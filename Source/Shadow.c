@@ -0,0 +1,421 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Shadows are a depth map rendered orthographically along the light, in
+// model space. The light is fixed in model space while the camera orbits, so
+// the map only needs rebuilding when the light or the mesh changes.
+//
+// Each face is also classified against the map when it is built, so that
+// only faces on the edge of a shadow are tested per pixel.
+
+// Texels per side
+#define SHADOW_SIZE 1024
+
+// Steepest depth slope biased for, in texels of depth per texel
+#define SHADOW_MAX_SLOPE 8.0f
+
+typedef enum ShadowState {
+    SHADOW_PARTIAL,
+    SHADOW_LIT,
+    SHADOW_HIDDEN,
+} ShadowState;
+
+typedef struct ShadowFace {
+    float       bias;  // Grows with the slope of the face away from the light
+    ShadowState state;
+} ShadowFace;
+
+typedef struct ShadowMap {
+    const Vector * vertices;  // Rebuilt when these or the light change
+    size_t         vertex_count;
+    size_t         face_count;
+    Vector         light;
+
+    // Colors to modulate by for each number of lit taps, in the target
+    // format
+    uint32_t       levels[10];
+
+    ShadowFace   * faces;  // After the coordinates, in the same allocation
+
+    float          depth[SHADOW_SIZE * SHADOW_SIZE];  // Larger is nearer the light
+    Vector         coords[];  // Per vertex texel x, y and depth
+} ShadowMap;
+
+// Edge and depth planes of a face in the map, as in TriangleSetup
+typedef struct ShadowTriangle {
+    Vector   weights[3];
+    Vector   depth;
+    SDL_Rect bounds;  // Covered texels, unclipped
+} ShadowTriangle;
+
+static inline bool
+ShadowTriangleSetup(
+          ShadowTriangle * const tri,
+    const Vector         * const verts)
+{
+    SDL_assert(tri);
+    SDL_assert(verts);
+
+    const float area = (verts[1].x - verts[0].x) * (verts[2].y - verts[0].y)
+                     - (verts[1].y - verts[0].y) * (verts[2].x - verts[0].x);
+
+    if (fabsf(area) < 1e-6f)
+        return false;
+
+    const float inv_area = 1.0f / area;
+
+    tri->depth = (Vector){.x = 0.0f};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector * const a = &verts[(i + 1) % 3];
+        const Vector * const b = &verts[(i + 2) % 3];
+
+        tri->weights[i] = (Vector){
+            .x = (a->y - b->y) * inv_area,
+            .y = (b->x - a->x) * inv_area,
+            .z = (a->x * b->y - a->y * b->x) * inv_area,
+        };
+
+        const Vector plane = VectorMultf(&tri->weights[i], verts[i].z);
+        tri->depth = VectorAdd(&tri->depth, &plane);
+    }
+
+    const SDL_FRect bounds = TriBoundingBox(verts);
+
+    tri->bounds = (SDL_Rect){
+        .x = (int)floorf(bounds.x),
+        .y = (int)floorf(bounds.y),
+        .w = (int)ceilf(bounds.x + bounds.w) - (int)floorf(bounds.x) + 1,
+        .h = (int)ceilf(bounds.y + bounds.h) - (int)floorf(bounds.y) + 1,
+    };
+
+    return true;
+}
+
+// Whether a texel center is within the face, or within half a texel of it
+static inline bool
+ShadowTriangleCovers(
+    const ShadowTriangle * const tri,
+    const float                  x,
+    const float                  y,
+    const bool                   conservative)
+{
+    SDL_assert(tri);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector * const w = &tri->weights[i];
+
+        const float margin = (conservative)
+            ? (fabsf(w->x) + fabsf(w->y)) * 0.5f
+            : 0.0f;
+
+        if (w->x * x + w->y * y + w->z < -margin)
+            return false;
+    }
+
+    return true;
+}
+
+static inline void
+ShadowRasterFace(
+          ShadowMap      * const shadow,
+    const ShadowTriangle * const tri)
+{
+    SDL_assert(shadow);
+    SDL_assert(tri);
+
+    const int min_x = SDL_max(tri->bounds.x, 0);
+    const int min_y = SDL_max(tri->bounds.y, 0);
+    const int max_x = SDL_min(tri->bounds.x + tri->bounds.w - 1, SHADOW_SIZE - 1);
+    const int max_y = SDL_min(tri->bounds.y + tri->bounds.h - 1, SHADOW_SIZE - 1);
+
+    for (int y = min_y; y <= max_y; ++y)
+    {
+        float * const row = &shadow->depth[y * SHADOW_SIZE];
+
+        for (int x = min_x; x <= max_x; ++x)
+        {
+            const float px = (float)x + 0.5f;
+            const float py = (float)y + 0.5f;
+
+            if (!ShadowTriangleCovers(tri, px, py, false))
+                continue;
+
+            const float depth = tri->depth.x * px + tri->depth.y * py + tri->depth.z;
+
+            row[x] = fmaxf(row[x], depth);
+        }
+    }
+}
+
+// Tests every texel any sample of the face could fall in, and the taps
+// around it, allowing for the depth to change by up to a texel's worth of
+// slope between the texel center and the sample
+static inline ShadowState
+ShadowClassifyFace(
+    const ShadowMap      * const shadow,
+    const ShadowTriangle * const tri,
+    const float                  bias)
+{
+    SDL_assert(shadow);
+    SDL_assert(tri);
+
+    const float slope = fabsf(tri->depth.x) + fabsf(tri->depth.y);
+
+    // Texels outside these are always lit, see ShadowMapTest()
+    const int min_x = SDL_max(tri->bounds.x - 1, 1);
+    const int min_y = SDL_max(tri->bounds.y - 1, 1);
+    const int max_x = SDL_min(tri->bounds.x + tri->bounds.w, SHADOW_SIZE - 2);
+    const int max_y = SDL_min(tri->bounds.y + tri->bounds.h, SHADOW_SIZE - 2);
+
+    bool lit    = false;
+    bool hidden = false;
+
+    if (min_x > tri->bounds.x - 1 || min_y > tri->bounds.y - 1
+     || max_x < tri->bounds.x + tri->bounds.w
+     || max_y < tri->bounds.y + tri->bounds.h)
+        lit = true;
+
+    for (int y = min_y; y <= max_y; ++y)
+    {
+        for (int x = min_x; x <= max_x; ++x)
+        {
+            const float px = (float)x + 0.5f;
+            const float py = (float)y + 0.5f;
+
+            if (!ShadowTriangleCovers(tri, px, py, true))
+                continue;
+
+            const float depth = tri->depth.x * px + tri->depth.y * py + tri->depth.z + bias;
+
+            for (int j = -1; j <= 1; ++j)
+            {
+                const float * const taps = &shadow->depth[(y + j) * SHADOW_SIZE + x];
+
+                for (int i = -1; i <= 1; ++i)
+                {
+                    lit    |= (depth + slope >= taps[i]);
+                    hidden |= (depth - slope <  taps[i]);
+                }
+            }
+
+            if (lit && hidden)
+                return SHADOW_PARTIAL;
+        }
+    }
+
+    return (hidden) ? SHADOW_HIDDEN : SHADOW_LIT;
+}
+
+static inline void
+ShadowMapLevels(
+          ShadowMap       * const shadow,
+    const SDL_PixelFormat * const format)
+{
+    SDL_assert(shadow);
+    SDL_assert(format);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        const uint8_t level = (uint8_t)(i * 255 / 9);
+        shadow->levels[i] = SDL_MapRGBA(format, level, level, level, 255);
+    }
+}
+
+// Rebuilds the map if the mesh or light changed since it was last built.
+// Rotating the camera never invalidates it.
+static inline int
+ShadowMapUpdate(
+          ShadowMap       ** const shadow,
+    const SDL_PixelFormat  * const format,
+    const Mesh             * const mesh,
+    const Vector           * const light)
+{
+    SDL_assert(shadow);
+    SDL_assert(format);
+    SDL_assert(mesh);
+    SDL_assert(light);
+
+    if (*shadow)
+        ShadowMapLevels(*shadow, format);
+
+    if (*shadow
+     && (*shadow)->vertices     == mesh->vertices.data
+     && (*shadow)->vertex_count == mesh->vertices.size
+     && (*shadow)->face_count   == mesh->faces.size
+     && !memcmp(&(*shadow)->light, light, sizeof(Vector)))
+        return 0;
+
+    if (!*shadow
+     || (*shadow)->vertex_count != mesh->vertices.size
+     || (*shadow)->face_count   != mesh->faces.size)
+    {
+        ShadowMap * const resized = realloc(
+            *shadow,
+            SizeAdd(
+                SizeAdd(sizeof(ShadowMap), SizeMult(sizeof(Vector), mesh->vertices.size)),
+                SizeMult(sizeof(ShadowFace), mesh->faces.size)
+            )
+        );
+
+        if (!resized)
+            return SDL_SetError("Unable to allocate shadow map");
+
+        *shadow = resized;
+        (*shadow)->vertex_count = mesh->vertices.size;
+        (*shadow)->face_count   = mesh->faces.size;
+        (*shadow)->faces        = (ShadowFace*)&resized->coords[mesh->vertices.size];
+    }
+
+    ShadowMap * const result = *shadow;
+    ShadowMapLevels(result, format);
+
+    result->vertices = mesh->vertices.data;
+    result->light    = *light;
+
+    // Light space basis, looking down the light with any perpendicular up
+    const Vector z  = VectorNormalize(light);
+    const Vector up = (fabsf(z.y) < 0.9f)
+        ? (Vector){.y = 1.0f}
+        : (Vector){.x = 1.0f};
+
+    Vector x = VectorCross(&up, &z);
+           x = VectorNormalize(&x);
+
+    const Vector y = VectorCross(&z, &x);
+
+    Vector min = { .x =  INFINITY, .y =  INFINITY};
+    Vector max = { .x = -INFINITY, .y = -INFINITY};
+
+    for (size_t i = 0; i < mesh->vertices.size; ++i)
+    {
+        const Vector * const vert = &mesh->vertices.data[i];
+
+        result->coords[i] = (Vector){
+            .x = VectorDot(vert, &x),
+            .y = VectorDot(vert, &y),
+            .z = VectorDot(vert, &z),
+        };
+
+        min.x = fminf(min.x, result->coords[i].x);
+        min.y = fminf(min.y, result->coords[i].y);
+        max.x = fmaxf(max.x, result->coords[i].x);
+        max.y = fmaxf(max.y, result->coords[i].y);
+    }
+
+    // Fit the mesh with a texel of margin, keeping texels square
+    const float extent = fmaxf(fmaxf(max.x - min.x, max.y - min.y), 1e-6f);
+    const float scale  = (float)(SHADOW_SIZE - 2) / extent;
+    const float texel  = 1.0f / scale;
+
+    for (size_t i = 0; i < mesh->vertices.size; ++i)
+    {
+        result->coords[i].x = (result->coords[i].x - min.x) * scale + 1.0f;
+        result->coords[i].y = (result->coords[i].y - min.y) * scale + 1.0f;
+    }
+
+    for (size_t i = 0; i < SHADOW_SIZE * SHADOW_SIZE; ++i)
+        result->depth[i] = -INFINITY;
+
+    // Every face casts, whichever way it faces the light
+    for (size_t i = 0; i < mesh->faces.size; ++i)
+    {
+        size_t vertex_index[3];
+        FaceVertices(&mesh->faces, i, vertex_index);
+
+        const Vector verts[3] = {
+            result->coords[vertex_index[0]],
+            result->coords[vertex_index[1]],
+            result->coords[vertex_index[2]],
+        };
+
+        ShadowTriangle tri;
+        if (ShadowTriangleSetup(&tri, verts))
+            ShadowRasterFace(result, &tri);
+    }
+
+    for (size_t i = 0; i < mesh->faces.size; ++i)
+    {
+        size_t vertex_index[3];
+        FaceVertices(&mesh->faces, i, vertex_index);
+
+        const Vector verts[3] = {
+            result->coords[vertex_index[0]],
+            result->coords[vertex_index[1]],
+            result->coords[vertex_index[2]],
+        };
+
+        ShadowFace * const face = &result->faces[i];
+
+        // Faces seen edge on by the light get the steepest bias, and are
+        // always tested per pixel
+        ShadowTriangle tri;
+        if (!ShadowTriangleSetup(&tri, verts))
+        {
+            face->bias  = texel * (1.0f + SHADOW_MAX_SLOPE * 2.0f);
+            face->state = SHADOW_PARTIAL;
+            continue;
+        }
+
+        // One texel of depth, plus the slope across the texels between a
+        // sample and the furthest filter tap
+        const float slope = fminf(
+            fabsf(tri.depth.x) + fabsf(tri.depth.y),
+            SHADOW_MAX_SLOPE * texel
+        );
+
+        face->bias  = texel + slope * 2.0f;
+        face->state = ShadowClassifyFace(result, &tri, face->bias);
+    }
+
+    return 0;
+}
+
+// Number of lit taps out of the 3x3 around a texel, or of the texel alone
+// counted as all nine without filtering
+static inline int
+ShadowMapTest(
+    const ShadowMap * const shadow,
+    const Vector    * const coord,
+    const float             bias,
+    const bool              filter)
+{
+    SDL_assert(shadow);
+    SDL_assert(coord);
+
+    const int x = (int)coord->x;
+    const int y = (int)coord->y;
+
+    // The map has a texel of margin, so that filtering stays inside
+    if (x < 1 || x >= SHADOW_SIZE - 1 || y < 1 || y >= SHADOW_SIZE - 1)
+        return 9;
+
+    const float   depth = coord->z + bias;
+    const float * row   = &shadow->depth[y * SHADOW_SIZE + x];
+
+    if (!filter)
+        return (depth >= *row) ? 9 : 0;
+
+    int lit = 0;
+    for (int j = -1; j <= 1; ++j)
+    {
+        const float * const taps = row + j * SHADOW_SIZE;
+
+        lit += (depth >= taps[-1]) + (depth >= taps[0]) + (depth >= taps[1]);
+    }
+
+    return lit;
+}
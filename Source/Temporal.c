@@ -0,0 +1,263 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Shading of the last frame, reprojected into the next one while the camera
+// orbits. Visibility is still depth tested every frame, but a pixel showing
+// the same face as the pixel it came from reuses that pixel's color instead
+// of being shaded again.
+//
+// Colors come from the nearest pixel, so each reuse can shift them by up to
+// half a pixel along the surface. Each pixel keeps how far its color is from
+// where it was shaded, and is shaded again once that passes
+// TEMPORAL_MAX_DRIFT. Every TEMPORAL_REFRESH frames everything is shaded
+// again regardless, to also catch what drift doesn't account for.
+
+// Frames between full refreshes
+#define TEMPORAL_REFRESH 16
+
+// Furthest a reused color can be from where it was shaded, in pixels along
+// either axis
+#define TEMPORAL_MAX_DRIFT 1.0f
+
+// Pixels without a face
+#define TEMPORAL_EMPTY UINT32_MAX
+
+// Point and spot lights needed before reprojecting a pixel is cheaper than
+// shading it. With fewer, plain, textured and shadowed Phong frames take
+// longer with reprojection than without.
+#define TEMPORAL_MIN_LIGHTS 32
+
+// Everything besides the camera that shading depends on. The camera only
+// moves pixels around, which reprojection accounts for.
+typedef struct TemporalKey {
+    const Mesh  * mesh;
+    int           mode;
+    int           flags;
+    uint32_t      format;
+    Vector        light;
+    const Light * lights;
+    size_t        light_count;
+    SDL_Surface * texture;
+} TemporalKey;
+
+static inline bool
+TemporalKeyEqual(
+    const TemporalKey * const a,
+    const TemporalKey * const b)
+{
+    SDL_assert(a);
+    SDL_assert(b);
+
+    return a->mesh        == b->mesh
+        && a->mode        == b->mode
+        && a->flags       == b->flags
+        && a->format      == b->format
+        && !memcmp(&a->light, &b->light, sizeof(Vector))
+        && a->lights      == b->lights
+        && a->light_count == b->light_count
+        && a->texture     == b->texture;
+}
+
+typedef struct TemporalPixel {
+    uint32_t   color;
+    SDL_FPoint drift;  // From the pixel center to where the color was shaded
+} TemporalPixel;
+
+typedef struct TemporalCache {
+    int         width;
+    int         height;
+
+    TemporalKey key;
+    int         age;     // Frames since everything was shaded
+    bool        filled;  // Whether any frame has been drawn into it
+    bool        reuse;   // Whether this frame reuses the last one
+
+    // Transforms of the frame being drawn and of the last one
+    Matrix      current;
+    Matrix      previous;
+
+    // Pixels of the last frame and of this one, which are swapped each frame.
+    // Faces are kept apart so that they can be cleared quickly.
+    uint32_t      * faces[2];
+    TemporalPixel * pixels[2];
+    size_t          back;
+
+    TemporalPixel   data[];  // Followed by the faces
+} TemporalCache;
+
+// Screen position of each vertex of a face in the last frame
+typedef struct TemporalFace {
+    uint32_t index;
+    Vector   previous[3];
+} TemporalFace;
+
+// Starts a frame, reusing the last one drawn with the cache if the shading
+// and size are unchanged and it isn't due a refresh
+static inline int
+TemporalUpdate(
+          TemporalCache ** const cache,
+    const TemporalKey    * const key,
+    const int                    width,
+    const int                    height,
+    const Matrix         * const model_view_projection)
+{
+    SDL_assert(cache);
+    SDL_assert(key);
+    SDL_assert(width > 0 && height > 0);
+    SDL_assert(model_view_projection);
+
+    const size_t pixels = SizeMult((size_t)width, (size_t)height);
+
+    if (!*cache || (*cache)->width != width || (*cache)->height != height)
+    {
+        free(*cache);
+
+        *cache = malloc(
+            SizeAdd(
+                sizeof(TemporalCache),
+                SizeMult((sizeof(TemporalPixel) + sizeof(uint32_t)) * 2, pixels)
+            )
+        );
+
+        if (!*cache)
+            return SDL_SetError("Unable to allocate temporal cache");
+
+        TemporalCache * const result = *cache;
+
+        *result = (TemporalCache){.width = width, .height = height};
+
+        result->pixels[0] = &result->data[0];
+        result->pixels[1] = &result->data[pixels];
+        result->faces[0]  = (uint32_t*)&result->data[pixels * 2];
+        result->faces[1]  = &result->faces[0][pixels];
+    }
+
+    TemporalCache * const result = *cache;
+
+    result->reuse = result->filled
+                 && result->age + 1 < TEMPORAL_REFRESH
+                 && TemporalKeyEqual(&result->key, key);
+
+    result->age    = (result->reuse) ? result->age + 1 : 0;
+    result->key    = *key;
+    result->filled = true;
+
+    result->previous = result->current;
+    result->current  = *model_view_projection;
+
+    result->back ^= 1;
+    memset(result->faces[result->back], 0xff, sizeof(uint32_t) * pixels);
+
+    return 0;
+}
+
+// Projects a face's vertices, flipped as for drawing, into the last frame
+static inline void
+TemporalFaceInit(
+    const TemporalCache * const cache,
+          TemporalFace  * const face,
+    const size_t                index,
+    const Vector        * const verts)
+{
+    SDL_assert(cache);
+    SDL_assert(face);
+    SDL_assert(index < TEMPORAL_EMPTY);
+    SDL_assert(verts);
+
+    face->index = (uint32_t)index;
+
+    if (!cache->reuse)
+        return;
+
+    for (size_t i = 0; i < 3; ++i)
+        face->previous[i] = MatrixMultv(&cache->previous, &verts[i]);
+}
+
+// Color of the face at a point, given by its barycentric coordinate, in the
+// last frame. Fails if the face wasn't the one drawn there, or if the color
+// would drift too far from where it was shaded.
+static inline bool
+TemporalFetch(
+    const TemporalCache * const cache,
+    const TemporalFace  * const face,
+    const Vector        * const coord,
+          uint32_t      * const color,
+          SDL_FPoint    * const drift)
+{
+    SDL_assert(cache);
+    SDL_assert(face);
+    SDL_assert(coord);
+    SDL_assert(color);
+    SDL_assert(drift);
+
+    if (!cache->reuse)
+        return false;
+
+    const float x = face->previous[0].x * coord->x
+                  + face->previous[1].x * coord->y
+                  + face->previous[2].x * coord->z;
+
+    const float y = face->previous[0].y * coord->x
+                  + face->previous[1].y * coord->y
+                  + face->previous[2].y * coord->z;
+
+    // Written to also reject NaN
+    if (!(x >= 0.0f && x < (float)cache->width && y >= 0.0f && y < (float)cache->height))
+        return false;
+
+    const size_t front = cache->back ^ 1;
+    const size_t index = (size_t)y * (size_t)cache->width + (size_t)x;
+
+    if (cache->faces[front][index] != face->index)
+        return false;
+
+    const TemporalPixel * const pixel = &cache->pixels[front][index];
+
+    const SDL_FPoint moved = {
+        .x = floorf(x) + 0.5f + pixel->drift.x - x,
+        .y = floorf(y) + 0.5f + pixel->drift.y - y,
+    };
+
+    if (fabsf(moved.x) > TEMPORAL_MAX_DRIFT || fabsf(moved.y) > TEMPORAL_MAX_DRIFT)
+        return false;
+
+    *color = pixel->color;
+    *drift = moved;
+    return true;
+}
+
+static inline void
+TemporalStore(
+          TemporalCache * const cache,
+    const int                   x,
+    const int                   y,
+    const TemporalFace  * const face,
+    const uint32_t              color,
+    const SDL_FPoint    * const drift)
+{
+    SDL_assert(cache);
+    SDL_assert(x >= 0 && x < cache->width);
+    SDL_assert(y >= 0 && y < cache->height);
+    SDL_assert(face);
+    SDL_assert(drift);
+
+    const size_t index = (size_t)y * (size_t)cache->width + (size_t)x;
+
+    cache->faces[cache->back][index]  = face->index;
+    cache->pixels[cache->back][index] = (TemporalPixel){
+        .color = color,
+        .drift = *drift,
+    };
+}
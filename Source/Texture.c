@@ -0,0 +1,313 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Textures are resampled to a square power of two and stored with a full
+// mip chain. Each level is stored in 4x4 tiles of one cache line each, so
+// that the texels around a sample are close in memory whichever direction
+// a triangle is walked.
+
+// Largest level 0 size, as a power of two
+#define TEXTURE_MAX_LOG2 12
+
+// Texels per tile side, as a power of two
+#define TEXTURE_TILE_LOG2 2
+
+#define TEXTURE_MAX_LEVELS (TEXTURE_MAX_LOG2 + 1)
+
+typedef struct Texture {
+    const SDL_Surface * source;  // Rebuilt when this or the format changes
+    uint32_t            format;
+
+    int                 size_log2;  // Level 0 is 2^size_log2 texels square
+    int                 levels;
+    size_t              offsets[TEXTURE_MAX_LEVELS];
+
+    uint32_t            texels[];
+} Texture;
+
+// Offset of a texel within a level. Levels smaller than a tile are a single
+// tile of their own size.
+static inline uint32_t
+TexelIndex(
+    const uint32_t x,
+    const uint32_t y,
+    const int      size_log2)
+{
+    const int      tile_log2 = SDL_min(size_log2, TEXTURE_TILE_LOG2);
+    const uint32_t tile_mask = (1u << tile_log2) - 1;
+
+    const uint32_t tile = ((y >> tile_log2) << (size_log2 - tile_log2))
+                        | (x >> tile_log2);
+
+    return (tile << (tile_log2 * 2))
+         | ((y & tile_mask) << tile_log2)
+         | (x & tile_mask);
+}
+
+// Interpolates each of the four bytes in a pair of pixels, two channels at a
+// time, where t is in [0, 256]
+static inline uint32_t
+LerpPixel(
+    const uint32_t a,
+    const uint32_t b,
+    const uint32_t t)
+{
+    const uint32_t rb = ((a & 0x00FF00FF) * (256 - t)
+                      +  (b & 0x00FF00FF) * t) >> 8;
+
+    const uint32_t ag = (((a >> 8) & 0x00FF00FF) * (256 - t)
+                      +  ((b >> 8) & 0x00FF00FF) * t) >> 8;
+
+    return (rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8);
+}
+
+// Averages each of the four bytes of four pixels, two channels at a time
+static inline uint32_t
+AveragePixels(
+    const uint32_t a,
+    const uint32_t b,
+    const uint32_t c,
+    const uint32_t d)
+{
+    const uint32_t rb = (
+        (a & 0x00FF00FF) + (b & 0x00FF00FF)
+      + (c & 0x00FF00FF) + (d & 0x00FF00FF)
+      + 0x00020002
+    ) >> 2;
+
+    const uint32_t ag = (
+        ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF)
+      + ((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF)
+      + 0x00020002
+    ) >> 2;
+
+    return (rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8);
+}
+
+// Multiplies each of the four bytes of two pixels
+static inline uint32_t
+ModulatePixel(
+    const uint32_t a,
+    const uint32_t b)
+{
+    uint32_t result = 0;
+
+    for (uint32_t shift = 0; shift < 32; shift += 8)
+    {
+        const uint32_t product = ((a >> shift) & 0xFF) * ((b >> shift) & 0xFF);
+        result |= ((product + 255) >> 8) << shift;
+    }
+
+    return result;
+}
+
+static inline void
+TextureStoreLevel(
+          Texture  * const texture,
+    const int              level,
+    const uint32_t * const linear)
+{
+    SDL_assert(texture);
+    SDL_assert(level < texture->levels);
+    SDL_assert(linear);
+
+    const int      size_log2 = texture->size_log2 - level;
+    const uint32_t size      = 1u << size_log2;
+
+    uint32_t * const texels = texture->texels + texture->offsets[level];
+
+    for (uint32_t y = 0; y < size; ++y)
+        for (uint32_t x = 0; x < size; ++x)
+            texels[TexelIndex(x, y, size_log2)] = linear[y * size + x];
+}
+
+// Rebuilds the texture if its source image or the target format changed
+// since it was last built
+static inline int
+TextureUpdate(
+          Texture         **      texture,
+          SDL_Surface     * const source,
+    const SDL_PixelFormat * const format)
+{
+    SDL_assert(texture);
+    SDL_assert(source);
+    SDL_assert(format && format->BytesPerPixel == 4);
+
+    if (*texture
+     && (*texture)->source == source
+     && (*texture)->format == format->format)
+        return 0;
+
+    free(*texture);
+    *texture = NULL;
+
+    SDL_Surface * const converted = SDL_ConvertSurfaceFormat(source, format->format, 0);
+
+    if (!converted)
+        return -1;
+
+    int size_log2 = 0;
+    while (size_log2 < TEXTURE_MAX_LOG2
+        && (1 << size_log2) < SDL_max(converted->w, converted->h))
+        size_log2++;
+
+    const size_t size = (size_t)1 << size_log2;
+
+    size_t offsets[TEXTURE_MAX_LEVELS];
+    size_t total = 0;
+
+    for (int level = 0; level <= size_log2; ++level)
+    {
+        offsets[level] = total;
+        total = SizeAdd(total, (size >> level) * (size >> level));
+    }
+
+    Texture  * const result = malloc(SizeAdd(sizeof(Texture), SizeMult(sizeof(uint32_t), total)));
+    uint32_t * const linear = malloc(SizeMult(sizeof(uint32_t), size * size));
+
+    if (!result || !linear)
+    {
+        free(result);
+        free(linear);
+        SDL_FreeSurface(converted);
+        return SDL_SetError("Unable to allocate texture");
+    }
+
+    result->source    = source;
+    result->format    = format->format;
+    result->size_log2 = size_log2;
+    result->levels    = size_log2 + 1;
+    memcpy(result->offsets, offsets, sizeof(offsets));
+
+    if (SDL_MUSTLOCK(converted))
+        SDL_LockSurface(converted);
+
+    // Nearest resampling to the power of two, images usually already are
+    for (size_t y = 0; y < size; ++y)
+    {
+        const size_t sy = y * (size_t)converted->h / size;
+
+        const uint32_t * const row = (const uint32_t *)(
+            (const uint8_t *)converted->pixels + sy * (size_t)converted->pitch);
+
+        for (size_t x = 0; x < size; ++x)
+            linear[y * size + x] = row[x * (size_t)converted->w / size];
+    }
+
+    if (SDL_MUSTLOCK(converted))
+        SDL_UnlockSurface(converted);
+
+    SDL_FreeSurface(converted);
+
+    // Each level is a box filter of the last, computed in place
+    TextureStoreLevel(result, 0, linear);
+
+    for (int level = 1; level < result->levels; ++level)
+    {
+        const size_t next = size >> level;
+
+        for (size_t y = 0; y < next; ++y)
+        {
+            for (size_t x = 0; x < next; ++x)
+            {
+                const uint32_t * const a = &linear[(y * 2)     * next * 2 + x * 2];
+                const uint32_t * const b = &linear[(y * 2 + 1) * next * 2 + x * 2];
+
+                linear[y * next + x] = AveragePixels(a[0], a[1], b[0], b[1]);
+            }
+        }
+
+        TextureStoreLevel(result, level, linear);
+    }
+
+    free(linear);
+
+    *texture = result;
+    return 0;
+}
+
+// Fractional part, without the libm call floorf() compiles to on baseline
+// x86-64. Coordinates beyond the range of int32_t are not expected.
+static inline float
+Fract(
+    const float x)
+{
+    const float f = x - (float)(int32_t)x;
+    return (f < 0.0f) ? f + 1.0f : f;
+}
+
+// Samples the texture where a pixel covers the given number of texels at
+// level 0, squared. Minified samples take the nearest texel of the nearest
+// level, where the mip chain has already done the filtering, and only
+// magnified samples are filtered. Coordinates wrap around.
+static inline uint32_t
+TextureSample(
+    const Texture * const texture,
+    const float           u,
+    const float           v,
+    const float           footprint)
+{
+    SDL_assert(texture);
+
+    if (footprint >= 1.0f)
+    {
+        // Half the exponent of the squared footprint is log2 of the
+        // footprint, read straight from the float bits instead of log2f()
+        uint32_t bits;
+        memcpy(&bits, &footprint, sizeof(bits));
+
+        const int level     = SDL_min((int)((bits >> 23) & 0xFF) - 127, 2 * texture->size_log2) / 2;
+        const int size_log2 = texture->size_log2 - level;
+        const float size    = (float)(1 << size_log2);
+
+        const uint32_t * const texels = texture->texels + texture->offsets[level];
+
+        const uint32_t x = (uint32_t)(Fract(u) * size) & ((1u << size_log2) - 1);
+        const uint32_t y = (uint32_t)(Fract(v) * size) & ((1u << size_log2) - 1);
+
+        return texels[TexelIndex(x, y, size_log2)];
+    }
+
+    const int      size_log2 = texture->size_log2;
+    const float    size      = (float)(1 << size_log2);
+    const uint32_t mask      = (1u << size_log2) - 1;
+
+    // Texel coordinates in 24.8 fixed point, offset by one texel so that
+    // truncating rounds down
+    const int32_t tx = (int32_t)((Fract(u) * size + 0.5f) * 256.0f) - 256;
+    const int32_t ty = (int32_t)((Fract(v) * size + 0.5f) * 256.0f) - 256;
+
+    const uint32_t x0 = (uint32_t)(tx >> 8) & mask;
+    const uint32_t y0 = (uint32_t)(ty >> 8) & mask;
+    const uint32_t x1 = (x0 + 1) & mask;
+    const uint32_t y1 = (y0 + 1) & mask;
+
+    const uint32_t wx = (uint32_t)tx & 0xFF;
+    const uint32_t wy = (uint32_t)ty & 0xFF;
+
+    return LerpPixel(
+        LerpPixel(
+            texture->texels[TexelIndex(x0, y0, size_log2)],
+            texture->texels[TexelIndex(x1, y0, size_log2)],
+            wx
+        ),
+        LerpPixel(
+            texture->texels[TexelIndex(x0, y1, size_log2)],
+            texture->texels[TexelIndex(x1, y1, size_log2)],
+            wx
+        ),
+        wy
+    );
+}
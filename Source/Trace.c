@@ -0,0 +1,184 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Frame timings written as Chrome trace events, viewable in about:tracing
+// or Perfetto. Every frame is a span with a nested span per stage, and
+// frames rendered on several threads may share one trace.
+
+typedef struct Trace {
+    FILE      * file;
+    SDL_mutex * lock;
+    uint64_t    start;  // GetTimeNs() when opened, the trace's zero
+    size_t      events;
+} Trace;
+
+static inline int
+TraceOpen(
+          Trace * const trace,
+    const char  * const filepath)
+{
+    SDL_assert(trace);
+    SDL_assert(filepath);
+
+    *trace = (Trace){.start = GetTimeNs()};
+
+    trace->lock = SDL_CreateMutex();
+
+    if (!trace->lock)
+        return -1;
+
+    trace->file = fopen(filepath, "w");
+
+    if (!trace->file)
+    {
+        SDL_DestroyMutex(trace->lock);
+        trace->lock = NULL;
+        return SDL_SetError("Unable to open %s: %s", filepath, strerror(errno));
+    }
+
+    fputs("{\"traceEvents\": [\n", trace->file);
+    return 0;
+}
+
+static inline void
+TraceSpan(
+          Trace    * const trace,
+    const char     * const name,
+    const int              thread,
+    const uint64_t         start,
+    const uint64_t         duration,
+    const char     * const args)
+{
+    SDL_assert(trace && trace->file);
+    SDL_assert(name);
+
+    // Timestamps are in microseconds
+    fprintf(
+        trace->file,
+        "%s{\"name\": \"%s\", \"cat\": \"render\", \"ph\": \"X\", "
+        "\"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f%s%s}",
+        (trace->events++) ? ",\n" : "",
+        name,
+        thread,
+        (double)(start - SDL_min(start, trace->start)) / 1e3,
+        (double)duration / 1e3,
+        (args) ? ", \"args\": " : "",
+        (args) ? args : ""
+    );
+}
+
+// Adds the last frame rendered by the context
+static inline void
+TraceFrame(
+          Trace         * const trace,
+    const RenderContext * const context,
+    const int                   thread)
+{
+    SDL_assert(trace);
+    SDL_assert(context);
+
+    if (!trace->file)
+        return;
+
+    const RenderTimings * const timings = &context->timings;
+
+    const struct { const char * name; uint64_t duration; } stages[] = {
+        {"clear",     timings->clear},
+        {"transform", timings->transform},
+        {"lighting",  timings->lighting},
+        {"raster",    timings->raster},
+        {"resolve",   timings->resolve},
+    };
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i)
+        total += stages[i].duration;
+
+    char   args[512] = "{";
+    size_t length    = 1;
+
+#if RENDER_STATS
+    const RenderStats * const stats = &context->stats;
+
+    length += (size_t)SDL_snprintf(
+        args + length, sizeof(args) - length,
+        "\"faces\": %zu, \"culled\": %zu, \"clipped\": %zu, "
+        "\"tested\": %zu, \"passed\": %zu, \"written\": %zu, "
+        "\"covered\": %zu, \"arena\": %zu, \"arena_peak\": %zu, "
+        "\"reused\": %zu, \"lights\": %zu, \"light_evals\": %zu",
+        stats->faces, stats->culled, stats->clipped,
+        stats->tested, stats->passed, stats->written,
+        stats->covered, stats->arena, stats->arena_peak,
+        stats->reused, stats->lights, stats->light_evals
+    );
+#endif
+
+    if (context->perf)
+    {
+        const PerfValues total = RenderCountersTotal(&context->counters);
+
+        for (size_t i = 0; i < PERF_COUNTERS && length < sizeof(args); ++i)
+        {
+            if (!PerfAvailable(context->perf, (PerfCounter)i))
+                continue;
+
+            length += (size_t)SDL_snprintf(
+                args + length, sizeof(args) - length,
+                "%s\"%s\": %llu",
+                (length > 1) ? ", " : "",
+                PERF_COUNTER_NAMES[i],
+                (unsigned long long)total.counts[i]
+            );
+        }
+    }
+
+    if (length < sizeof(args) - 1)
+        SDL_snprintf(args + length, sizeof(args) - length, "}");
+
+    SDL_LockMutex(trace->lock);
+
+    TraceSpan(trace, "frame", thread, timings->start, total, args);
+
+    uint64_t start = timings->start;
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i)
+    {
+        TraceSpan(trace, stages[i].name, thread, start, stages[i].duration, NULL);
+        start += stages[i].duration;
+    }
+
+    SDL_UnlockMutex(trace->lock);
+}
+
+static inline int
+TraceClose(
+    Trace * const trace)
+{
+    SDL_assert(trace);
+
+    if (!trace->file)
+        return 0;
+
+    fputs("\n]}\n", trace->file);
+
+    const int status = fclose(trace->file);
+
+    SDL_DestroyMutex(trace->lock);
+    *trace = (Trace){.file = NULL};
+
+    if (status != 0)
+        return SDL_SetError("Unable to write trace");
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Copyright (C) 2021  Nicole Alassandro
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Lock-free single producer, single consumer handoff of the latest value.
+// The writer and reader each own one of three slots, and the third is
+// swapped atomically with whichever side moves next. The reader always sees
+// the most recently published slot, and neither side ever waits.
+
+enum {
+    TRIPLE_BUFFER_INDEX = 0x3,
+    TRIPLE_BUFFER_FRESH = 0x4,  // Shared slot was published since last read
+};
+
+typedef struct TripleBuffer {
+    SDL_atomic_t shared;
+    int          front;  // Owned by the reader
+    int          back;   // Owned by the writer
+} TripleBuffer;
+
+static inline void
+TripleBufferInit(
+    TripleBuffer * const buffer)
+{
+    SDL_assert(buffer);
+
+    buffer->front = 0;
+    buffer->back  = 2;
+    SDL_AtomicSet(&buffer->shared, 1);
+}
+
+// Publishes the back slot, returning the slot to write next
+static inline int
+TripleBufferPublish(
+    TripleBuffer * const buffer)
+{
+    SDL_assert(buffer);
+
+    const int shared = SDL_AtomicSet(
+        &buffer->shared, buffer->back | TRIPLE_BUFFER_FRESH
+    );
+
+    buffer->back = shared & TRIPLE_BUFFER_INDEX;
+    return buffer->back;
+}
+
+// Moves the front slot to the latest published one, if there is one
+static inline bool
+TripleBufferAcquire(
+    TripleBuffer * const buffer)
+{
+    SDL_assert(buffer);
+
+    if (!(SDL_AtomicGet(&buffer->shared) & TRIPLE_BUFFER_FRESH))
+        return false;
+
+    const int shared = SDL_AtomicSet(&buffer->shared, buffer->front);
+
+    buffer->front = shared & TRIPLE_BUFFER_INDEX;
+    return true;
+}
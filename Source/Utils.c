@@ -81,3 +81,33 @@ LoadFile(
     data[read_total] = '\0';
     return (File){data, size};
 }
+
+// Monotonic time in nanoseconds, split to avoid overflowing the product
+static inline uint64_t
+GetTimeNs(void)
+{
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t counter   = SDL_GetPerformanceCounter();
+
+    return (counter / frequency) * UINT64_C(1000000000)
+         + (counter % frequency) * UINT64_C(1000000000) / frequency;
+}
+
+// File name without its directory or extension
+static inline void
+FileStem(
+          char * const name,
+    const size_t       size,
+    const char * const file)
+{
+    SDL_assert(name && size > 0);
+    SDL_assert(file);
+
+    const char * base = strrchr(file, '/');
+    base = (base) ? base + 1 : file;
+
+    const char * const ext = strrchr(base, '.');
+    const size_t length = (ext && ext != base) ? (size_t)(ext - base) : strlen(base);
+
+    SDL_snprintf(name, size, "%.*s", (int)SDL_min(length, size - 1), base);
+}
@@ -13,6 +13,17 @@
 // You should have received a copy of the GNU General Public License along
 // with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+// Face as written in the file, before its indices are checked and stored in
+// the mesh
+typedef union Index {
+    struct { size_t v, t, n; };
+    size_t vtn[3];
+} Index;
+
+typedef struct ObjFace {
+    Index indices[3];
+} ObjFace;
+
 static inline int
 ObjParseVertex(
     const char   * const str,
@@ -51,10 +62,48 @@ ObjParseVertex(
     return 0;
 }
 
+// Texture coordinates have a required u and optional v and w, only u and v
+// are kept
+static inline int
+ObjParseTexCoord(
+    const char     * const str,
+          TexCoord * const result)
+{
+    SDL_assert(str);
+    SDL_assert(result);
+
+    const char * start = str;
+          char * end;
+
+    float  values[3] = {0.0f};
+    size_t argc      = 0;
+
+    errno = 0;
+
+    for (float f = strtof(start, &end); start != end; f = strtof(start, &end))
+    {
+        if (argc >= 3)
+            return SDL_SetError("Too many texture coordinates given");
+
+        if (errno)
+            return SDL_SetError("Invalid texture coordinate value");
+
+        values[argc++] = f;
+        start = end;
+    }
+
+    if (!argc)
+        return SDL_SetError("Too few texture coordinates given");
+
+    *result = (TexCoord){.u = values[0], .v = values[1]};
+
+    return 0;
+}
+
 static inline int
 ObjParseFace(
-    const char * const str,
-          Face * const result)
+    const char    * const str,
+          ObjFace * const result)
 {
     SDL_assert(str);
     SDL_assert(result);
@@ -85,11 +134,18 @@ ObjParseFace(
         if (*end == '\r' || !*end)
             break;
 
-        // Move to next index attribute on '/' delimiters
+        // Move to next index attribute on '/' delimiters, where v//n skips
+        // the texture coordinate
         if (*end == '/')
         {
             argf++;
             end++;
+
+            if (*end == '/')
+            {
+                argf++;
+                end++;
+            }
         }
         else
         {
@@ -112,36 +168,222 @@ ObjParseFace(
     return 0;
 }
 
-static Mesh*
-LoadObj(
-    const char * const filepath)
+static inline int
+MaterialsPush(
+          Materials * const materials,
+    const char      * const name,
+    const size_t            length)
+{
+    SDL_assert(materials);
+    SDL_assert(name);
+
+    Material * const data = realloc(
+        materials->data,
+        SizeMult(sizeof(Material), SizeAdd(materials->size, 1))
+    );
+
+    if (!data)
+        return SDL_SetError("Unable to allocate materials");
+
+    Material * const material = &data[materials->size];
+    *material = (Material){
+        .diffuse = (Vector){.x = 1.0f, .y = 1.0f, .z = 1.0f},
+    };
+
+    SDL_snprintf(
+        material->name, sizeof(material->name),
+        "%.*s", (int)SDL_min(length, sizeof(material->name) - 1), name
+    );
+
+    materials->data = data;
+    materials->size++;
+
+    return 0;
+}
+
+// Index of a material by name, or the default material if not found
+static inline uint32_t
+MaterialsFind(
+    const Materials * const materials,
+    const char      * const name,
+    const size_t            length)
+{
+    SDL_assert(materials);
+    SDL_assert(name);
+
+    for (size_t i = 1; i < materials->size; ++i)
+    {
+        const char * const other = materials->data[i].name;
+
+        if (strlen(other) == length && !strncmp(other, name, length))
+            return (uint32_t)i;
+    }
+
+    return 0;
+}
+
+// Length of a name argument, up to trailing whitespace or a carriage return
+static inline size_t
+ObjNameLength(
+    const char * const str)
+{
+    SDL_assert(str);
+
+    size_t length = strcspn(str, "\r");
+
+    while (length && (str[length - 1] == ' ' || str[length - 1] == '\t'))
+        length--;
+
+    return length;
+}
+
+// Appends the materials of an MTL file. Only the diffuse color is used.
+static int
+LoadMtl(
+    const char      * const filepath,
+          Materials * const materials)
 {
     SDL_assert(filepath);
+    SDL_assert(materials);
 
     const File source = LoadFile(filepath);
 
-    if (!source.data || !source.size)
-        return NULL;
+    if (!source.data)
+        return SDL_SetError("Unable to read material library %s", filepath);
 
-    Mesh * result = NULL;
+    const char * err   = NULL;
+    size_t       liner = 0;
+    bool         named = false;
 
-    size_t verts = 0;
-    size_t norms = 0;
-    size_t faces = 0;
+    // Parse errors are copied out, as prefixing them formats into the
+    // buffer SDL_GetError() points to
+    char message[256];
+
+    char * ptr = source.data;
+
+    while (ptr < source.data + source.size)
+    {
+        char * const newline = memchr(ptr, '\n', (size_t)(source.data + source.size - ptr));
+
+        if (newline)
+            *newline = '\0';
+
+        liner++;
+
+        ptr += strspn(ptr, " \t\r");
+
+        const size_t toklen = strcspn(ptr, " \t");
+
+        if (toklen == 6 && !strncmp(ptr, "newmtl", toklen))
+        {
+            const char * const name = ptr + toklen + strspn(ptr + toklen, " \t");
+
+            if (MaterialsPush(materials, name, ObjNameLength(name)))
+                goto Error;
+
+            named = true;
+        }
+        else if (toklen == 2 && !strncmp(ptr, "Kd", toklen))
+        {
+            if (!named)
+            {
+                err = "Color given before newmtl";
+                goto Set_Error;
+            }
+
+            if (ObjParseVertex(ptr + toklen, &materials->data[materials->size - 1].diffuse))
+            {
+                SDL_snprintf(message, sizeof(message), "%s", SDL_GetError());
+                err = message;
+                goto Set_Error;
+            }
+        }
+
+        // Everything else describes lighting models and maps that aren't
+        // supported, and is ignored
+
+        ptr = (newline) ? newline + 1 : source.data + source.size;
+    }
+
+    free(source.data);
+    return 0;
+
+Set_Error:
+    SDL_SetError("%s:%zu: %s", filepath, liner, err);
+
+Error:
+    free(source.data);
+    return -1;
+}
+
+// Files are split into chunks of whole lines, parsed in parallel in both
+// passes. Each chunk is at least this large, so small files stay in one.
+#define OBJ_CHUNK_SIZE ((size_t)256 * 1024)
+
+// Chunks per thread, so that uneven chunks still balance
+#define OBJ_CHUNKS_PER_THREAD 4
+
+typedef struct ObjChunk {
+    char       * start;
+    char       * end;
+
+    // Counted by the first pass
+    size_t       lines;
+    size_t       verts;
+    size_t       norms;
+    size_t       uvs;
+    size_t       faces;
+    size_t       libraries;  // mtllib lines
+    const char * material;   // Name of the last usemtl, if any
+
+    // Where the chunk's lines and elements start in the whole file
+    size_t       first_line;
+    size_t       first_vert;
+    size_t       first_norm;
+    size_t       first_uv;
+    size_t       first_face;
+    uint32_t     first_material;
+
+    // First error in the chunk, either described here at a line within the
+    // chunk, or already formatted by a parser
+    const char * err;
+    size_t       liner;
+    size_t       linec;
+    bool         failed;
+    char         message[256];
+} ObjChunk;
+
+typedef struct ObjLoad {
+    ObjChunk * chunks;
+    Mesh     * mesh;
+    uint32_t * face_materials;
+} ObjLoad;
+
+// Preprocess
+// - Find counts to use for memory allocation
+// - Place null delimiters at newlines, unlike strtok() this is safe to
+//   do from several threads at once
+// - Detect unsupported OBJ features
+static inline void
+ObjCountChunk(
+    ObjChunk * const chunk)
+{
+    SDL_assert(chunk);
 
     // Cursor row/column
     size_t liner = 0;
     size_t linec = 0;
 
-          char * ptr = strtok(source.data, "\n");
+          char * ptr = chunk->start;
     const char * err = NULL;
 
-    // Preprocess
-    // - Find counts to use for memory allocation
-    // - Use strtok() to place null delimiters at newlines
-    // - Detect unsupported OBJ features
-    while (ptr)
+    while (ptr < chunk->end)
     {
+        char * const newline = memchr(ptr, '\n', (size_t)(chunk->end - ptr));
+
+        if (newline)
+            *newline = '\0';
+
         if (liner == SIZE_MAX)
             goto Error_OversizedFile;
 
@@ -157,9 +399,10 @@ LoadObj(
         if (!toklen); // pass
 
         // Supported Features
-        else if (!strncmp(ptr,  "v", toklen)) verts++;
-        else if (!strncmp(ptr, "vn", toklen)) norms++;
-        else if (!strncmp(ptr,  "f", toklen)) faces++;
+        else if (!strncmp(ptr,  "v", toklen)) chunk->verts++;
+        else if (!strncmp(ptr, "vn", toklen)) chunk->norms++;
+        else if (!strncmp(ptr, "vt", toklen)) chunk->uvs++;
+        else if (!strncmp(ptr,  "f", toklen)) chunk->faces++;
 
         // Ignored Features
         else if (!strncmp(ptr,          "o", toklen));
@@ -172,7 +415,6 @@ LoadObj(
         else if (!strncmp(ptr,         "mg", toklen));
         else if (!strncmp(ptr,         "fo", toklen));
         else if (!strncmp(ptr,         "vp", toklen));
-        else if (!strncmp(ptr,         "vt", toklen));
         else if (!strncmp(ptr,        "lod", toklen));
         else if (!strncmp(ptr,        "con", toklen));
         else if (!strncmp(ptr,        "deg", toklen));
@@ -187,8 +429,11 @@ LoadObj(
         else if (!strncmp(ptr,      "ctech", toklen));
         else if (!strncmp(ptr,      "stech", toklen));
         else if (!strncmp(ptr,      "bevel", toklen));
-        else if (!strncmp(ptr,     "mtllib", toklen));
-        else if (!strncmp(ptr,     "usemtl", toklen));
+
+        // Libraries are loaded once every chunk is counted, in file order
+        else if (!strncmp(ptr,     "mtllib", toklen)) chunk->libraries++;
+        else if (!strncmp(ptr,     "usemtl", toklen))
+            chunk->material = ptr + toklen + strspn(ptr + toklen, " \t");
         else if (!strncmp(ptr,     "cstype", toklen));
         else if (!strncmp(ptr,   "c_interp", toklen));
         else if (!strncmp(ptr,   "d_interp", toklen));
@@ -196,41 +441,112 @@ LoadObj(
         else if (!strncmp(ptr, "shadow_obj", toklen));
         else goto Error_Unknown;
 
-        ptr = strtok(NULL, "\n");
+        ptr = (newline) ? newline + 1 : chunk->end;
     }
 
-    // Vert and face data required for rendering, but baked normals are optional
-    if (!(verts | faces))
-        goto Error_NoGeometry;
+    chunk->lines = liner;
+    return;
 
-    printf(
-        "verts: %zu\n"
-        "norms: %zu\n"
-        "faces: %zu\n",
-        verts,
-        norms,
-        faces
-    );
+Error_OversizedFile:
+    err = "File is too large";
+    goto Set_Error;
 
-    // Force calculation of normals if the .obj did not have any
-    const bool calculate_normals = (norms == 0);
-    norms = (calculate_normals) ? verts : norms;
+Error_Unknown:
+    err = "Unknown identifier";
+    goto Set_Error;
 
-    if (calculate_normals)
-        printf("Calculating normals...\n");
+Set_Error:
+    chunk->failed = true;
+    chunk->err    = err;
+    chunk->liner  = liner;
+    chunk->linec  = linec;
+}
 
-    result = calloc(1, sizeof(Mesh));
-    if (!result || MeshAlloc(result, verts, norms, faces))
-        goto Error_Allocation;
+static void
+ObjCountJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    ObjLoad * const load = data;
 
-    // Re-use variables as current indices for each data structure
-    verts = norms = faces = 0;
+    (void)worker;
 
-    liner = 0;
-    linec = 0;
-    ptr   = source.data;
+    for (size_t i = begin; i < end; ++i)
+        ObjCountChunk(&load->chunks[i]);
+}
 
-    while (ptr < source.data + source.size)
+// Loads the libraries named by a chunk's mtllib lines, relative to the OBJ
+// file. A missing library only leaves its materials undefined.
+static inline void
+ObjLoadLibraries(
+    const char      * const filepath,
+    const ObjChunk  * const chunk,
+          Materials * const materials)
+{
+    SDL_assert(filepath);
+    SDL_assert(chunk);
+    SDL_assert(materials);
+
+    const char * const slash = strrchr(filepath, '/');
+    const int          dir   = (slash) ? (int)(slash - filepath + 1) : 0;
+
+    // Lines are null delimited by the first pass
+    for (const char * ptr = chunk->start; ptr < chunk->end; ptr += strlen(ptr) + 1)
+    {
+        const char * const line   = ptr + strspn(ptr, " \r\n");
+        const size_t       toklen = strcspn(line, " ");
+
+        // Matched the same way as the first pass, where a lone "m" is mg
+        if (toklen < 2 || strncmp(line, "mtllib", toklen))
+            continue;
+
+        const char * name = line + toklen;
+
+        for (name += strspn(name, " \t"); *name; name += strspn(name, " \t"))
+        {
+            const size_t length = strcspn(name, " \t\r");
+
+            char path[1024];
+            SDL_snprintf(path, sizeof(path), "%.*s%.*s", dir, filepath, (int)length, name);
+
+            if (LoadMtl(path, materials))
+            {
+                printf("%s\n", SDL_GetError());
+                SDL_ClearError();
+            }
+
+            name += length;
+            name += strspn(name, "\r");
+        }
+    }
+}
+
+static inline void
+ObjParseChunk(
+    ObjLoad  * const load,
+    ObjChunk * const chunk)
+{
+    SDL_assert(load && load->mesh && load->face_materials);
+    SDL_assert(chunk);
+
+    Mesh * const result = load->mesh;
+
+    // Current indices for each data structure
+    size_t verts = chunk->first_vert;
+    size_t norms = chunk->first_norm;
+    size_t uvs   = chunk->first_uv;
+    size_t faces = chunk->first_face;
+
+    uint32_t material = chunk->first_material;
+
+    size_t liner = 0;
+    size_t linec = 0;
+
+    char * ptr = chunk->start;
+
+    while (ptr < chunk->end)
     {
         liner++;
         linec = 0;
@@ -257,17 +573,273 @@ LoadObj(
             if (ObjParseVertex(ptr + toklen, &result->normals.data[norms++]))
                 goto Error;
         }
+        else if (!strncmp(ptr, "vt", toklen))
+        {
+            SDL_assert(uvs < result->texcoords.size);
+            if (ObjParseTexCoord(ptr + toklen, &result->texcoords.data[uvs++]))
+                goto Error;
+        }
+        else if (!strncmp(ptr, "usemtl", toklen))
+        {
+            const char * const name = ptr + toklen + strspn(ptr + toklen, " \t");
+            material = MaterialsFind(&result->materials, name, ObjNameLength(name));
+        }
         else if (!strncmp(ptr, "f", toklen))
         {
             SDL_assert(faces < result->faces.size);
-            if (ObjParseFace(ptr + toklen, &result->faces.data[faces++]))
+            load->face_materials[faces] = material;
+
+            ObjFace face = {0};
+            if (ObjParseFace(ptr + toklen, &face))
                 goto Error;
+
+            // Indices are checked before storing, as they may not fit
+            Faces * const stored = &result->faces;
+            for (size_t j = 0; j < 3; ++j)
+            {
+                if (face.indices[j].v >= result->vertices.size)
+                    goto Error_Value;
+
+                FacesSetIndex(stored, stored->v, faces * 3 + j, face.indices[j].v);
+
+                if (stored->n)
+                {
+                    if (face.indices[j].n >= result->normals.size)
+                        goto Error_Value;
+
+                    FacesSetIndex(stored, stored->n, faces * 3 + j, face.indices[j].n);
+                }
+
+                if (stored->t)
+                {
+                    if (face.indices[j].t >= result->texcoords.size)
+                        goto Error_Value;
+
+                    FacesSetIndex(stored, stored->t, faces * 3 + j, face.indices[j].t);
+                }
+            }
+
+            faces++;
         }
 
         // Skip over null delimiters
         while (*ptr++);
     }
 
+    return;
+
+Error_Value:
+    chunk->failed = true;
+    chunk->err    = "Invalid index value";
+    chunk->liner  = liner;
+    chunk->linec  = linec;
+    return;
+
+Error:
+    // Parsers set the error on this thread
+    chunk->failed = true;
+    SDL_snprintf(chunk->message, sizeof(chunk->message), "%s", SDL_GetError());
+}
+
+static void
+ObjParseJob(
+    void * const data,
+    const size_t begin,
+    const size_t end,
+    const size_t worker)
+{
+    ObjLoad * const load = data;
+
+    (void)worker;
+
+    for (size_t i = begin; i < end; ++i)
+        ObjParseChunk(load, &load->chunks[i]);
+}
+
+// Sets the error of the first failed chunk, in file order. Returns false if
+// none failed.
+static inline bool
+ObjChunkError(
+    const char     * const filepath,
+    const ObjChunk * const chunks,
+    const size_t           count)
+{
+    SDL_assert(filepath);
+    SDL_assert(chunks);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const ObjChunk * const chunk = &chunks[i];
+
+        if (!chunk->failed)
+            continue;
+
+        if (chunk->err)
+            SDL_SetError(
+                "%s:%zu:%zu: %s",
+                filepath, chunk->first_line + chunk->liner, chunk->linec, chunk->err
+            );
+        else
+            SDL_SetError("%s", chunk->message);
+
+        return true;
+    }
+
+    return false;
+}
+
+// Counts of what was loaded are printed when verbose
+static Mesh*
+LoadObj(
+    const char * const filepath,
+    JobSystem  * const jobs,
+    const bool         verbose)
+{
+    SDL_assert(filepath);
+
+    const File source = LoadFile(filepath);
+
+    if (!source.data || !source.size)
+        return NULL;
+
+    Mesh * result = NULL;
+
+    // The first material is used by faces without one
+    Materials  materials      = {0};
+    uint32_t * face_materials = NULL;
+
+    const char * err = NULL;
+
+    const size_t chunk_count = SDL_max(
+        SDL_min(
+            source.size / OBJ_CHUNK_SIZE,
+            SizeMult(JobThreadCount(jobs), OBJ_CHUNKS_PER_THREAD)
+        ),
+        (size_t)1
+    );
+
+    ObjChunk * const chunks = calloc(chunk_count, sizeof(ObjChunk));
+
+    if (!chunks || MaterialsPush(&materials, "", 0))
+    {
+        free(chunks);
+        free(materials.data);
+        free(source.data);
+        return NULL;
+    }
+
+    ObjLoad load = {.chunks = chunks};
+
+    // Chunks start after the first newline past an even split of the file
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        char * const end  = source.data + source.size;
+        char *       from = source.data + source.size / chunk_count * (i + 1);
+
+        if (i > 0)
+            from = SDL_max(from, chunks[i - 1].end);
+
+        const char * const newline = (i + 1 < chunk_count && from < end)
+            ? memchr(from, '\n', (size_t)(end - from))
+            : NULL;
+
+        chunks[i].start = (i > 0) ? chunks[i - 1].end : source.data;
+        chunks[i].end   = (newline) ? (char *)newline + 1 : end;
+    }
+
+    JobParallelFor(jobs, chunk_count, 1, ObjCountJob, &load);
+
+    size_t verts = 0;
+    size_t norms = 0;
+    size_t uvs   = 0;
+    size_t faces = 0;
+    size_t lines = 0;
+
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        ObjChunk * const chunk = &chunks[i];
+
+        chunk->first_line = lines;
+        chunk->first_vert = verts;
+        chunk->first_norm = norms;
+        chunk->first_uv   = uvs;
+        chunk->first_face = faces;
+
+        lines += chunk->lines;
+        verts += chunk->verts;
+        norms += chunk->norms;
+        uvs   += chunk->uvs;
+        faces += chunk->faces;
+    }
+
+    if (ObjChunkError(filepath, chunks, chunk_count))
+        goto Cleanup;
+
+    for (size_t i = 0; i < chunk_count; ++i)
+        if (chunks[i].libraries)
+            ObjLoadLibraries(filepath, &chunks[i], &materials);
+
+    // Vert and face data required for rendering, but baked normals are optional
+    if (!(verts | faces))
+        goto Error_NoGeometry;
+
+    if (verbose)
+    {
+        printf(
+            "verts: %zu\n"
+            "norms: %zu\n"
+            "uvs:   %zu\n"
+            "faces: %zu\n"
+            "mtls:  %zu\n",
+            verts,
+            norms,
+            uvs,
+            faces,
+            materials.size - 1
+        );
+    }
+
+    // Force calculation of normals if the .obj did not have any
+    const bool calculate_normals = (norms == 0);
+    norms = (calculate_normals) ? verts : norms;
+
+    if (verbose && calculate_normals)
+        printf("Calculating normals...\n");
+
+    result = calloc(1, sizeof(Mesh));
+    if (!result || MeshAlloc(result, verts, norms, uvs, faces, !calculate_normals))
+        goto Error_Allocation;
+
+    result->materials = materials;
+    materials = (Materials){0};
+
+    face_materials = malloc(SizeMult(sizeof(uint32_t), faces));
+
+    if (!face_materials)
+        goto Error_Allocation;
+
+    // Each chunk starts with the material last used before it
+    uint32_t material = 0;
+
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        chunks[i].first_material = material;
+
+        if (chunks[i].material)
+        {
+            const char * const name = chunks[i].material;
+            material = MaterialsFind(&result->materials, name, ObjNameLength(name));
+        }
+    }
+
+    load.mesh           = result;
+    load.face_materials = face_materials;
+
+    JobParallelFor(jobs, chunk_count, 1, ObjParseJob, &load);
+
+    if (ObjChunkError(filepath, chunks, chunk_count))
+        goto Cleanup;
+
     // {
     //     float max_vert = 0.0f;
     //     for (size_t i = 0; i < result->vertices.size; ++i)
@@ -287,35 +859,36 @@ LoadObj(
     //     }
     // }
 
+    // One batch per material
+    if (MeshSortFaces(result, face_materials))
+        goto Error_Allocation;
+
+    free(face_materials);
+    face_materials = NULL;
+
     // Calculate normals if none were provided
-    if (calculate_normals)
-        MeshCalcNorms(result);
+    if (calculate_normals && MeshCalcNorms(result, jobs))
+        goto Error_Allocation;
 
-    // Validate face index values
-    for (size_t i = 0; i < result->faces.size; ++i)
-    {
-        const Face * const face = &result->faces.data[i];
-        for (size_t j = 0; j < 3; ++j)
-        {
-            if (face->indices[j].v >= result->vertices.size)
-                goto Error_Value;
+    // Unique edge list for wireframe rendering
+    if (MeshCalcEdges(result))
+        goto Error_Allocation;
 
-            if (result->normals.size > 0)
-                if (face->indices[j].n >= result->normals.size)
-                    goto Error_Value;
-        }
-    }
+    // Front to back face orders for drawing from any direction
+    if (MeshCalcOrders(result, jobs))
+        goto Error_Allocation;
 
-    ptr = NULL;
+    if (verbose)
+    {
+        printf("edges: %zu\n", result->edges.size);
+        printf("batches: %zu\n", result->ranges.size);
+    }
 
+    free(chunks);
     free(source.data);
 
     return result;
 
-Error_OversizedFile:
-    err = "File is too large";
-    goto Set_Error;
-
 Error_NoGeometry:
     err = "No geometry data found";
     goto Set_Error;
@@ -324,30 +897,14 @@ Error_Allocation:
     err = "Failed to allocate mesh data";
     goto Set_Error;
 
-Error_Unsupported:
-    err = "Unsupported attribute";
-    goto Set_Error;
-
-Error_Unknown:
-    err = "Unknown identifier";
-    goto Set_Error;
-
-Error_Syntax:
-    err = "Syntax error";
-    goto Set_Error;
-
-Error_Value:
-    err = "Invalid index value";
-    goto Set_Error;
-
-Error:
-    goto Cleanup;
-
 Set_Error:
-    SDL_SetError("%s:%zu:%zu: %s", filepath, liner, linec, err);
+    SDL_SetError("%s:%zu:%zu: %s", filepath, lines, (size_t)0, err);
 
 Cleanup:
+    free(chunks);
     free(source.data);
+    free(face_materials);
+    free(materials.data);
 
     if (result) {
         MeshFree(result);
@@ -1,4 +1,4 @@
-#!/usr/bin/env sh
+#!/usr/bin/env bash
 
 # Copyright (C) 2021  Nicole Alassandro
 
@@ -29,8 +29,9 @@ COMPILE_FLAGS=" "
 # COMPILE_FLAGS+="-fsanitize=thread "
 
 # Release
-COMPILE_FLAGS+="-DSDL_ASSERT_LEVEL=0"
+COMPILE_FLAGS+="-DSDL_ASSERT_LEVEL=0 "
 COMPILE_FLAGS+="-O3 "
+# COMPILE_FLAGS+="-DRENDER_STATS=0 "
 
 # COMPILE_FLAGS+="-v "
 COMPILE_FLAGS+="-std=c11 "
@@ -41,11 +42,23 @@ COMPILE_FLAGS+="-Wconversion "
 COMPILE_FLAGS+="-Wno-unused-label "
 COMPILE_FLAGS+="-Wno-unused-function "
 COMPILE_FLAGS+="-Werror "
-COMPILE_FLAGS+="-ferror-limit=10 "
 COMPILE_FLAGS+="-DAPP_NAME=\"$APP_NAME\" "
-COMPILE_FLAGS+="-mmacosx-version-min=10.14 "
-COMPILE_FLAGS+="-F/Library/Frameworks "
-COMPILE_FLAGS+="-framework SDL2 "
+
+# Libraries follow the sources, as linkers drop those nothing needs yet
+LIBS=" "
+
+if [ "$(uname)" = "Darwin" ]; then
+    COMPILE_FLAGS+="-ferror-limit=10 "
+    COMPILE_FLAGS+="-mmacosx-version-min=10.14 "
+    COMPILE_FLAGS+="-F/Library/Frameworks "
+    LIBS+="-framework SDL2 "
+else
+    # SDL2.h is included as <SDL2/SDL.h>, so only the library flags are used
+    LIBS+="$(sdl2-config --libs) "
+    LIBS+="-lm "
+    # shm_open() is in librt before glibc 2.34
+    LIBS+="-lrt "
+fi
 
 rm -rf "Build/"
 mkdir "Build/"
@@ -53,6 +66,21 @@ mkdir "Build/"
 cc \
     $COMPILE_FLAGS  \
     -o "Build/$APP_NAME"   \
-    "Source/Main.c"
+    "Source/Main.c" \
+    $LIBS
+
+cc \
+    $COMPILE_FLAGS  \
+    -o "Build/${APP_NAME}Benchmark"   \
+    "Source/Benchmark.c" \
+    $LIBS
+
+cc \
+    $COMPILE_FLAGS  \
+    -o "Build/${APP_NAME}MicroBenchmark"   \
+    "Source/MicroBenchmark.c" \
+    $LIBS
 
 chmod +x "Build/$APP_NAME"
+chmod +x "Build/${APP_NAME}Benchmark"
+chmod +x "Build/${APP_NAME}MicroBenchmark"